@@ -49,6 +49,7 @@
 #include "codegen/Visitor.h"
 
 #include "Text.h"
+#include "runtime/runtime.h"
 #include "termstyle.h"
 #include "linenoise/linenoise.h"
 
@@ -259,7 +260,9 @@ void repl(llvm::Module *Mod, llvm::FunctionPassManager* funcPassManager, llvm::E
     char replIterationName[100];
     snprintf(replIterationName, 100, "repl#%lu", ++inputCounter);
 
-    // Read input
+    // Read input. Output of the program is buffered by the runtime, so make sure all
+    // of it is out before prompting.
+    hue::stdout_flush();
     if (inputBytes != 0) free(inputBytes);
     inputBytes = linenoise(prompt);
     if (inputBytes == 0) break; // EOF
@@ -332,6 +335,7 @@ void repl(llvm::Module *Mod, llvm::FunctionPassManager* funcPassManager, llvm::E
     errs() << TS_Brown "** Executing\n" TS_None;
     std::vector<llvm::GenericValue> args;
     llvm::GenericValue returnV = EE->runFunction(moduleF, args);
+    hue::stdout_flush(); // before the result is printed
 
     // Find out what the function returns and print a representation
     const ast::Type* resultType = moduleFunc->resultType();
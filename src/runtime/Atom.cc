@@ -0,0 +1,104 @@
+// Copyright (c) 2012, Rasmus Andersson. All rights reserved. Use of this source
+// code is governed by a MIT-style license that can be found in the LICENSE file.
+#include "Atom.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <vector>
+
+namespace hue {
+
+__thread HazardSlot* hazard_slot_ __attribute__((tls_model("initial-exec"))) = 0;
+
+// All slots ever registered. Slots are only ever added to the front.
+static HazardSlot* slots = 0;
+static pthread_key_t slotKey;
+static pthread_once_t slotKeyOnce = PTHREAD_ONCE_INIT;
+
+struct Retired {
+  void* obj;
+  void (*release)(void*);
+};
+typedef std::vector<Retired> RetiredList;
+
+static bool isHazard(void* obj) {
+  for (HazardSlot* slot = __atomic_load_n(&slots, __ATOMIC_ACQUIRE); slot; slot = slot->next) {
+    if (__atomic_load_n(&slot->object, __ATOMIC_SEQ_CST) == obj) return true;
+  }
+  return false;
+}
+
+// Releases the retired objects no hazard pointer refers to
+static void releaseUnprotected(RetiredList& retired) {
+  size_t kept = 0;
+  for (size_t i = 0; i < retired.size(); ++i) {
+    if (isHazard(retired[i].obj)) {
+      retired[kept++] = retired[i];
+    } else {
+      retired[i].release(retired[i].obj);
+    }
+  }
+  retired.resize(kept);
+}
+
+static void threadExited(void* arg) {
+  HazardSlot* slot = (HazardSlot*)arg;
+  RetiredList* retired = (RetiredList*)slot->retired;
+  // Readers only hold a hazard pointer while retaining an object, so this won't spin
+  // for long
+  while (!retired->empty()) {
+    releaseUnprotected(*retired);
+    if (!retired->empty()) sched_yield();
+  }
+  __atomic_store_n(&slot->active, false, __ATOMIC_RELEASE);
+  hazard_slot_ = 0;
+}
+
+static void makeSlotKey() {
+  pthread_key_create(&slotKey, threadExited);
+}
+
+HazardSlot* hazard_register_thread() {
+  pthread_once(&slotKeyOnce, makeSlotKey);
+  HazardSlot* slot = __atomic_load_n(&slots, __ATOMIC_ACQUIRE);
+  for (; slot; slot = slot->next) {
+    bool active = false;
+    if (!__atomic_load_n(&slot->active, __ATOMIC_RELAXED) &&
+        __atomic_compare_exchange_n(&slot->active, &active, true, false,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      break;
+    }
+  }
+  if (!slot) {
+    slot = new HazardSlot;
+    slot->object = 0;
+    slot->active = true;
+    slot->retired = new RetiredList;
+    HazardSlot* head = __atomic_load_n(&slots, __ATOMIC_RELAXED);
+    do {
+      slot->next = head;
+    } while (!__atomic_compare_exchange_n(&slots, &head, slot, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  }
+  pthread_setspecific(slotKey, slot);
+  hazard_slot_ = slot;
+  return slot;
+}
+
+void hazard_retire(void* obj, void (*release)(void*)) {
+  RetiredList& retired = *(RetiredList*)hazard_slot()->retired;
+  Retired entry = { obj, release };
+  retired.push_back(entry);
+  releaseUnprotected(retired);
+}
+
+size_t hazard_collect() {
+  HazardSlot* slot = hazard_slot_;
+  if (!slot) return 0;
+  RetiredList& retired = *(RetiredList*)slot->retired;
+  releaseUnprotected(retired);
+  return retired.size();
+}
+
+} // namespace hue
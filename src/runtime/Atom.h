@@ -0,0 +1,149 @@
+// Copyright (c) 2012, Rasmus Andersson. All rights reserved. Use of this source
+// code is governed by a MIT-style license that can be found in the LICENSE file.
+//
+// A mutable reference to immutable, reference counted objects, like a Vector, which
+// any number of threads can read and update without locks. Updating an atom publishes
+// a new version and readers see either the old or the new version, never a mix:
+//
+//   Atom<Vector> latest(Vector::create(0, 0), TransferReference);
+//
+//   // Updating thread
+//   latest.swap([&](Vector* v) { return v->append(value); })->release();
+//
+//   // Reading threads
+//   Vector* v = latest.deref();
+//   ...
+//   v->release();
+//
+// Simply loading the pointer and retaining the object isn't safe, since the updating
+// thread might release the last reference to the object in between. Readers therefore
+// announce the object they're about to retain in a per-thread hazard pointer, and an
+// updater which replaces the object only releases it once no hazard pointer refers to
+// it. Until then the object is kept on the updating thread's list of retired objects.
+//
+#ifndef _HUE_RUNTIME_ATOM_INCLUDED
+#define _HUE_RUNTIME_ATOM_INCLUDED
+
+#include <hue/runtime/object.h>
+
+namespace hue {
+
+// Hazard pointer of a thread. Slots are never freed; the slot of a thread which has
+// exited is reused by the next thread to register.
+struct HazardSlot {
+  void* object;      // object the thread is about to retain, or 0
+  HazardSlot* next;
+  bool active;       // true while owned by a thread
+  void* retired;     // objects retired by the thread, managed by Atom.cc
+};
+extern __thread HazardSlot* hazard_slot_ __attribute__((tls_model("initial-exec")));
+
+// Registers the calling thread, unless already registered
+HazardSlot* hazard_register_thread();
+inline HazardSlot* hazard_slot() {
+  HazardSlot* slot = hazard_slot_;
+  return slot ? slot : hazard_register_thread();
+}
+
+// Releases *obj* by calling release(obj) once no thread's hazard pointer refers to it,
+// which might be right away. Objects still retired when a thread exits are released
+// before it exits.
+void hazard_retire(void* obj, void (*release)(void*));
+
+// Releases the objects retired by the calling thread which no hazard pointer refers
+// to any longer. Returns the number of objects still retired.
+size_t hazard_collect();
+
+template <typename T>
+class Atom {
+public:
+  // Creates an atom referring to *value*, which may be 0
+  explicit Atom(T* value = 0, RefRule rule = RetainReference) : value_(value) {
+    if (value && rule == RetainReference) value->retain();
+  }
+
+  // No other thread may use the atom while it's destroyed
+  ~Atom() {
+    if (value_) value_->release();
+  }
+
+  // Returns a new reference to the current value, or 0
+  T* deref() const {
+    HazardSlot* slot = hazard_slot();
+    T* value = __atomic_load_n(&value_, __ATOMIC_ACQUIRE);
+    while (value) {
+      // The store must be visible to updaters before the value is loaded again. If the
+      // value is still current after that, any updater replacing it will see the
+      // hazard pointer and hold on to the value until the hazard pointer is cleared.
+      __atomic_store_n(&slot->object, (void*)value, __ATOMIC_SEQ_CST);
+      T* current = __atomic_load_n(&value_, __ATOMIC_SEQ_CST);
+      if (current == value) {
+        value->retain();
+        break;
+      }
+      value = current;
+    }
+    __atomic_store_n(&slot->object, (void*)0, __ATOMIC_RELEASE);
+    return value;
+  }
+
+  // Replaces the value with fn(value) and returns a new reference to the new value.
+  // fn receives a reference it must not release and returns a new reference (for
+  // instance the result of Vector::append), or the value it was given to leave the atom
+  // unchanged. If another thread updates the atom at the same time, fn is called again
+  // with that thread's value, so it should have no side effects.
+  template <typename F> T* swap(F fn) {
+    T* value = deref();
+    while (true) {
+      T* next = fn(value);
+      if (next == value) return value; // unchanged; our reference goes to the caller
+      if (next) next->retain();        // for the caller
+      T* expected = value;
+      if (__atomic_compare_exchange_n(&value_, &expected, next, false,
+                                      __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        retire(value);
+        if (value) value->release();
+        return next;
+      }
+      if (next) {
+        next->release();
+        next->release();
+      }
+      if (value) value->release();
+      value = deref();
+    }
+  }
+
+  // Replaces the value with *value* (which may be 0) regardless of the current value
+  void reset(T* value, RefRule rule = RetainReference) {
+    if (value && rule == RetainReference) value->retain();
+    retire(__atomic_exchange_n(&value_, value, __ATOMIC_SEQ_CST));
+  }
+
+  // Replaces the value with *value* if the current value is *expected*. Returns true
+  // if the value was replaced.
+  bool compareAndSet(T* expected, T* value) {
+    if (value) value->retain();
+    if (__atomic_compare_exchange_n(&value_, &expected, value, false,
+                                    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+      retire(expected);
+      return true;
+    }
+    if (value) value->release();
+    return false;
+  }
+
+private:
+  Atom(const Atom&) = delete;
+  Atom& operator=(const Atom&) = delete;
+
+  static void releaseRetired(void* obj) { ((T*)obj)->release(); }
+  static void retire(T* value) {
+    if (value) hazard_retire(value, &releaseRetired);
+  }
+
+  T* value_;
+};
+
+} // namespace hue
+#endif // _HUE_RUNTIME_ATOM_INCLUDED
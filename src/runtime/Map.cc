@@ -0,0 +1,13 @@
+// Copyright (c) 2012, Rasmus Andersson. All rights reserved. Use of this source
+// code is governed by a MIT-style license that can be found in the LICENSE file.
+#include "Map.h"
+
+namespace hue {
+
+const Map Map::_Empty;
+Map* Map::Empty = (Map*)&Map::_Empty;
+
+const Map::Node Map::Node::_Empty;
+Map::Node* Map::Node::Empty = (Map::Node*)&Map::Node::_Empty;
+
+} // namespace hue
@@ -0,0 +1,367 @@
+// Copyright (c) 2012, Rasmus Andersson. All rights reserved. Use of this source
+// code is governed by a MIT-style license that can be found in the LICENSE file.
+//
+// An immutable and persistent map implemented as a hash array mapped trie (HAMT),
+// in the compressed layout described by Steindorfer and Vinju ("CHAMP").
+//
+// Like Vector, the trie has a branching factor of 32, so lookups, assoc and dissoc
+// are O(log32(n)). Every node holds two bitsets, each with one bit for each of the 32
+// possible positions at its level: datamap marks positions holding a key-value entry
+// and nodemap marks positions holding a child node. Only occupied positions take up
+// space. Entries are stored first, followed by children, both in position order.
+//
+// Keys and values are words, like the values of a Vector, and keys are compared by
+// identity. Keys are hashed with a bijective 64-bit mix function, so distinct keys
+// always have distinct hashes and no collision nodes are needed.
+//
+#ifndef _HUE_RUNTIME_MAP_INCLUDED
+#define _HUE_RUNTIME_MAP_INCLUDED
+
+#include <hue/runtime/object.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+
+namespace hue {
+
+class Map { HUE_OBJECT(Map)
+public:
+  typedef void* K;
+  typedef void* V;
+
+  class Node { HUE_VAR_OBJECT(Node)
+  public:
+    static const Node _Empty;
+    static Node* Empty;
+
+    uint32_t datamap; // positions holding an entry
+    uint32_t nodemap; // positions holding a child node
+
+    // Entries as key, value pairs, followed by children. Must be the last member.
+    void* slots[0];
+
+    inline uint8_t entryCount() const { return __builtin_popcount(datamap); }
+    inline uint8_t childCount() const { return __builtin_popcount(nodemap); }
+
+    // Index of the entry or child at the position of *bit*
+    inline uint8_t entryIndex(uint32_t bit) const {
+      return __builtin_popcount(datamap & (bit - 1));
+    }
+    inline uint8_t childIndex(uint32_t bit) const {
+      return __builtin_popcount(nodemap & (bit - 1));
+    }
+
+    inline K key(uint8_t i) const { return slots[i * 2]; }
+    inline V value(uint8_t i) const { return slots[(i * 2) + 1]; }
+    inline Node* child(uint8_t i) const {
+      return (Node*)slots[(entryCount() * 2) + i];
+    }
+
+    // Creates a node with the entry k1 => v1 and the entry k2 => v2, whose hashes
+    // h1 and h2 are equal below *shift*. Returns a node with a +1 refcount.
+    static Node* create(K k1, V v1, uint64_t h1, K k2, V v2, uint64_t h2,
+                        uint32_t shift) {
+      uint32_t bit1 = bitpos(h1, shift);
+      uint32_t bit2 = bitpos(h2, shift);
+      if (bit1 == bit2) {
+        Node* node = alloc(0, bit1);
+        node->slots[0] = create(k1, v1, h1, k2, v2, h2, shift + 5);
+        return node;
+      }
+      Node* node = alloc(bit1 | bit2, 0);
+      if (bit2 < bit1) {
+        std::swap(k1, k2);
+        std::swap(v1, v2);
+      }
+      node->slots[0] = k1;
+      node->slots[1] = v1;
+      node->slots[2] = k2;
+      node->slots[3] = v2;
+      return node;
+    }
+
+    // Copy of node with the value of entry i replaced
+    static Node* copySetValue(const Node& other, uint8_t i, V value) {
+      Node* node = copy(other, other.datamap, other.nodemap);
+      node->slots[(i * 2) + 1] = value;
+      return node;
+    }
+
+    // Copy of node with child i replaced by *child*, which is transferred
+    static Node* copySetChild(const Node& other, uint8_t i, Node* child) {
+      Node* node = copy(other, other.datamap, other.nodemap);
+      uint8_t slot = (other.entryCount() * 2) + i;
+      ((Node*)node->slots[slot])->release();
+      node->slots[slot] = child;
+      return node;
+    }
+
+    // Copy of node with the entry key => value added at the position of *bit*
+    static Node* copyAddEntry(const Node& other, uint32_t bit, K key, V value) {
+      Node* node = alloc(other.datamap | bit, other.nodemap);
+      uint8_t i = other.entryIndex(bit);
+      void** dst = node->slots;
+      void* const* src = other.slots;
+      size_t nslots = (other.entryCount() * 2) + other.childCount();
+      memcpy(dst, src, sizeof(void*) * (i * 2));
+      dst[i * 2] = key;
+      dst[(i * 2) + 1] = value;
+      memcpy(dst + (i * 2) + 2, src + (i * 2), sizeof(void*) * (nslots - (i * 2)));
+      node->retainChildren();
+      return node;
+    }
+
+    // Copy of node without the entry at the position of *bit*
+    static Node* copyRemoveEntry(const Node& other, uint32_t bit) {
+      Node* node = alloc(other.datamap & ~bit, other.nodemap);
+      uint8_t i = other.entryIndex(bit);
+      void** dst = node->slots;
+      void* const* src = other.slots;
+      size_t nslots = (other.entryCount() * 2) + other.childCount();
+      memcpy(dst, src, sizeof(void*) * (i * 2));
+      memcpy(dst + (i * 2), src + (i * 2) + 2, sizeof(void*) * (nslots - (i * 2) - 2));
+      node->retainChildren();
+      return node;
+    }
+
+    // Copy of node with the entry at the position of *bit* moved into *child*, which is
+    // transferred
+    static Node* copyEntryToChild(const Node& other, uint32_t bit, Node* child) {
+      Node* node = alloc(other.datamap & ~bit, other.nodemap | bit);
+      uint8_t i = other.entryIndex(bit);
+      uint8_t ci = other.childIndex(bit);
+      uint8_t entries = other.entryCount();
+      void** dst = node->slots;
+      void* const* src = other.slots;
+      memcpy(dst, src, sizeof(void*) * (i * 2));
+      memcpy(dst + (i * 2), src + (i * 2) + 2, sizeof(void*) * ((entries - i - 1) * 2));
+      dst += (entries - 1) * 2;
+      src += entries * 2;
+      memcpy(dst, src, sizeof(void*) * ci);
+      memcpy(dst + ci + 1, src + ci, sizeof(void*) * (other.childCount() - ci));
+      dst[ci] = child;
+      for (uint8_t j = 0, n = node->childCount(); j < n; ++j) {
+        if (j != ci) ((Node*)dst[j])->retain();
+      }
+      return node;
+    }
+
+    // Copy of node with the child at the position of *bit* replaced by the entry
+    // key => value
+    static Node* copyChildToEntry(const Node& other, uint32_t bit, K key, V value) {
+      Node* node = alloc(other.datamap | bit, other.nodemap & ~bit);
+      uint8_t i = other.entryIndex(bit);
+      uint8_t ci = other.childIndex(bit);
+      uint8_t entries = other.entryCount();
+      void** dst = node->slots;
+      void* const* src = other.slots;
+      memcpy(dst, src, sizeof(void*) * (i * 2));
+      dst[i * 2] = key;
+      dst[(i * 2) + 1] = value;
+      memcpy(dst + (i * 2) + 2, src + (i * 2), sizeof(void*) * ((entries - i) * 2));
+      dst += (entries + 1) * 2;
+      src += entries * 2;
+      memcpy(dst, src, sizeof(void*) * ci);
+      memcpy(dst + ci, src + ci + 1, sizeof(void*) * (other.childCount() - ci - 1));
+      node->retainChildren();
+      return node;
+    }
+
+    inline static uint32_t bitpos(uint64_t hash, uint32_t shift) {
+      return (uint32_t)1 << ((hash >> shift) & 31);
+    }
+
+    inline static size_t allocsize(uint32_t datamap, uint32_t nodemap) {
+      return sizeof(Node) + sizeof(void*) * ((__builtin_popcount(datamap) * 2) +
+                                             __builtin_popcount(nodemap));
+    }
+    inline size_t allocsize() const { return allocsize(datamap, nodemap); }
+
+    Node() : refcount_(Unretainable), datamap(0), nodemap(0) {}
+
+    void dealloc() {
+      uint8_t entries = entryCount();
+      for (uint8_t i = 0, n = childCount(); i < n; ++i) {
+        ((Node*)slots[(entries * 2) + i])->release();
+      }
+    }
+
+  private:
+    static Node* alloc(uint32_t datamap, uint32_t nodemap) {
+      Node* node = __alloc(allocsize(datamap, nodemap));
+      node->datamap = datamap;
+      node->nodemap = nodemap;
+      return node;
+    }
+
+    // Shallow copy of other, retaining its children
+    static Node* copy(const Node& other, uint32_t datamap, uint32_t nodemap) {
+      Node* node = alloc(datamap, nodemap);
+      memcpy(node->slots, other.slots, allocsize(datamap, nodemap) - sizeof(Node));
+      node->retainChildren();
+      return node;
+    }
+
+    void retainChildren() {
+      uint8_t entries = entryCount();
+      for (uint8_t i = 0, n = childCount(); i < n; ++i) {
+        ((Node*)slots[(entries * 2) + i])->retain();
+      }
+    }
+  };
+
+  static const Map _Empty;
+  static Map* Empty;
+
+  // Hash of key. This is the finalizer of MurmurHash3, which is a bijection.
+  inline static uint64_t hash(K key) {
+    uint64_t h = (uint64_t)key;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+  }
+
+  inline size_t count() const { return count_; }
+
+  // Looks up the value for key. Returns true and sets *value* if found.
+  bool find(K key, V& value) const {
+    uint64_t h = hash(key);
+    const Node* node = root_;
+    for (uint32_t shift = 0; ; shift += 5) {
+      uint32_t bit = Node::bitpos(h, shift);
+      if (node->datamap & bit) {
+        uint8_t i = node->entryIndex(bit);
+        if (node->key(i) != key) return false;
+        value = node->value(i);
+        return true;
+      } else if (node->nodemap & bit) {
+        node = node->child(node->childIndex(bit));
+      } else {
+        return false;
+      }
+    }
+  }
+
+  // Value for key, or *notFound* if there's no value for key
+  inline V get(K key, V notFound = 0) const {
+    V value;
+    return find(key, value) ? value : notFound;
+  }
+
+  inline bool contains(K key) const {
+    V value;
+    return find(key, value);
+  }
+
+  // Returns a new map with key associated with value
+  Map* assoc(K key, V value) const {
+    bool added = false;
+    Node* root = doAssoc(*root_, hash(key), key, value, 0, added);
+    return create(count_ + (added ? 1 : 0), root);
+  }
+
+  // Returns a new map without key. Returns the receiver, retained, if there's no
+  // value for key.
+  Map* dissoc(K key) const {
+    bool removed = false;
+    Node* root = doDissoc(*root_, hash(key), key, 0, removed);
+    if (!removed) return ((Map*)this)->retain();
+    if (root == 0) return Empty;
+    return create(count_ - 1, root);
+  }
+
+  // Calls fn(K key, V value) for each entry, in hash order
+  template <typename F> void forEach(F fn) const {
+    forEach(root_, fn);
+  }
+
+  Map() : refcount_(Unretainable), count_(0), root_(Node::Empty) {}
+
+  void dealloc() {
+    root_->release();
+  }
+
+protected:
+  // Creates a map, transferring root
+  static Map* create(size_t count, Node* root) {
+    Map* m = __alloc();
+    m->count_ = count;
+    m->root_ = root;
+    return m;
+  }
+
+  // Copy of node with key => value. Returns a node with a +1 refcount.
+  static Node* doAssoc(const Node& node, uint64_t h, K key, V value, uint32_t shift,
+                       bool& added) {
+    uint32_t bit = Node::bitpos(h, shift);
+    if (node.datamap & bit) {
+      uint8_t i = node.entryIndex(bit);
+      K existingKey = node.key(i);
+      if (existingKey == key) {
+        return Node::copySetValue(node, i, value);
+      }
+      // Push both entries down into a new child
+      added = true;
+      Node* child = Node::create(existingKey, node.value(i), hash(existingKey),
+                                 key, value, h, shift + 5);
+      return Node::copyEntryToChild(node, bit, child);
+    } else if (node.nodemap & bit) {
+      uint8_t i = node.childIndex(bit);
+      Node* child = doAssoc(*node.child(i), h, key, value, shift + 5, added);
+      return Node::copySetChild(node, i, child);
+    }
+    added = true;
+    return Node::copyAddEntry(node, bit, key, value);
+  }
+
+  // Copy of node without key. Returns a node with a +1 refcount, or 0 if the node
+  // would be empty. If key isn't found, *removed* is left false.
+  static Node* doDissoc(const Node& node, uint64_t h, K key, uint32_t shift,
+                        bool& removed) {
+    uint32_t bit = Node::bitpos(h, shift);
+    if (node.datamap & bit) {
+      uint8_t i = node.entryIndex(bit);
+      if (node.key(i) != key) return 0;
+      removed = true;
+      if (node.datamap == bit && node.nodemap == 0) return 0;
+      return Node::copyRemoveEntry(node, bit);
+    } else if (node.nodemap & bit) {
+      uint8_t i = node.childIndex(bit);
+      Node* child = doDissoc(*node.child(i), h, key, shift + 5, removed);
+      if (!removed) return 0;
+      // Nodes below the root hold at least two entries or a child, so a child is
+      // never left empty
+      assert(child != 0);
+      if (child->nodemap == 0 && child->entryCount() == 1) {
+        // Pull the remaining entry of the child up into this node
+        Node* node2 = Node::copyChildToEntry(node, bit, child->key(0), child->value(0));
+        child->release();
+        return node2;
+      }
+      return Node::copySetChild(node, i, child);
+    }
+    return 0;
+  }
+
+  template <typename F> static void forEach(const Node* node, F& fn) {
+    for (uint8_t i = 0, n = node->entryCount(); i < n; ++i) {
+      fn(node->key(i), node->value(i));
+    }
+    for (uint8_t i = 0, n = node->childCount(); i < n; ++i) {
+      forEach(node->child(i), fn);
+    }
+  }
+
+private:
+  size_t count_;
+  Node* root_;
+};
+
+} // namespace hue
+#endif // _HUE_RUNTIME_MAP_INCLUDED
@@ -0,0 +1,142 @@
+// Copyright (c) 2012, Rasmus Andersson. All rights reserved. Use of this source
+// code is governed by a MIT-style license that can be found in the LICENSE file.
+#include "ThreadPool.h"
+#include "object.h"
+
+#include <chrono>
+
+namespace hue {
+
+// Worker the calling thread runs, if any
+static __thread void* current_worker = 0;
+
+ThreadPool::ThreadPool(size_t threads) : queued_(0), sleepers_(0), stopping_(false) {
+  if (threads == 0) threads = std::thread::hardware_concurrency();
+  if (threads == 0) threads = 1;
+  for (size_t i = 0; i < threads; ++i) {
+    Worker* worker = new Worker;
+    worker->pool = this;
+    worker->index = i;
+    workers_.push_back(worker);
+  }
+  // Start threads only once all workers exist, since they steal from each other
+  for (size_t i = 0; i < threads; ++i) {
+    workers_[i]->thread = std::thread(&ThreadPool::workerMain, this, workers_[i]);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(sleepLock_);
+    stopping_ = true;
+  }
+  wakeup_.notify_all();
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    workers_[i]->thread.join();
+  }
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    delete workers_[i];
+  }
+}
+
+ThreadPool& ThreadPool::shared() {
+  static ThreadPool* pool = new ThreadPool();
+  return *pool;
+}
+
+ThreadPool::Worker* ThreadPool::currentWorker() {
+  Worker* worker = (Worker*)current_worker;
+  return (worker && worker->pool == this) ? worker : 0;
+}
+
+void ThreadPool::push(const Task& task) {
+  Worker* self = currentWorker();
+  if (self) {
+    std::lock_guard<std::mutex> lock(self->lock);
+    self->tasks.push_back(task);
+  } else {
+    std::lock_guard<std::mutex> lock(injectLock_);
+    inject_.push_back(task);
+  }
+  queued_.fetch_add(1);
+  if (sleepers_.load() != 0) {
+    std::lock_guard<std::mutex> lock(sleepLock_);
+    wakeup_.notify_one();
+  }
+}
+
+bool ThreadPool::take(Worker* self, Task& task) {
+  if (queued_.load(std::memory_order_relaxed) == 0) return false;
+
+  // Newest task of our own
+  if (self) {
+    std::lock_guard<std::mutex> lock(self->lock);
+    if (!self->tasks.empty()) {
+      task = self->tasks.back();
+      self->tasks.pop_back();
+      return true;
+    }
+  }
+
+  // Oldest task of another worker
+  size_t n = workers_.size();
+  size_t start = self ? self->index + 1 : 0;
+  for (size_t i = 0; i < n; ++i) {
+    Worker* victim = workers_[(start + i) % n];
+    if (victim == self) continue;
+    std::lock_guard<std::mutex> lock(victim->lock);
+    if (!victim->tasks.empty()) {
+      task = victim->tasks.front();
+      victim->tasks.pop_front();
+      return true;
+    }
+  }
+
+  // Task submitted from outside the pool
+  std::lock_guard<std::mutex> lock(injectLock_);
+  if (!inject_.empty()) {
+    task = inject_.front();
+    inject_.pop_front();
+    return true;
+  }
+  return false;
+}
+
+bool ThreadPool::runOne(Worker* self) {
+  Task task;
+  if (!take(self, task)) return false;
+  queued_.fetch_sub(1);
+  task.run(task.arg);
+  task.group->pending_.fetch_sub(1, std::memory_order_release);
+  return true;
+}
+
+void ThreadPool::workerMain(Worker* self) {
+  current_worker = self;
+  while (!stopping_.load()) {
+    if (runOne(self)) continue;
+
+    #if HUE_BIASED_REFCOUNT
+    // Objects created by this worker and released by other threads are queued with
+    // the worker, so merge them while there's nothing else to do
+    ref_merge_queued();
+    #endif
+
+    std::unique_lock<std::mutex> lock(sleepLock_);
+    sleepers_.fetch_add(1);
+    wakeup_.wait_for(lock, std::chrono::milliseconds(10), [this]{
+      return stopping_.load() || queued_.load() != 0;
+    });
+    sleepers_.fetch_sub(1);
+  }
+  current_worker = 0;
+}
+
+void ThreadPool::TaskGroup::wait() {
+  ThreadPool::Worker* self = pool_.currentWorker();
+  while (pending_.load(std::memory_order_acquire) != 0) {
+    if (!pool_.runOne(self)) std::this_thread::yield();
+  }
+}
+
+} // namespace hue
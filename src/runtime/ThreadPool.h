@@ -0,0 +1,110 @@
+// Copyright (c) 2012, Rasmus Andersson. All rights reserved. Use of this source
+// code is governed by a MIT-style license that can be found in the LICENSE file.
+//
+// A work-stealing thread pool for fork-join style parallelism.
+//
+// Each worker thread has its own deque of tasks. A worker pushes and pops tasks at
+// the back of its own deque, and when it runs out of work it steals from the front of
+// another worker's deque, which is where the largest remaining pieces of work tend to
+// be. Threads that aren't workers of the pool submit tasks through a shared queue.
+//
+// Tasks are spawned in a TaskGroup. Waiting on a group runs pending tasks until all
+// tasks of the group have finished, so tasks may themselves spawn and wait on tasks:
+//
+//   ThreadPool::TaskGroup group(ThreadPool::shared());
+//   group.spawn([&]{ a = work(left); });
+//   group.spawn([&]{ b = work(right); });
+//   group.wait();
+//
+#ifndef _HUE_RUNTIME_THREAD_POOL_INCLUDED
+#define _HUE_RUNTIME_THREAD_POOL_INCLUDED
+
+#include <stddef.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace hue {
+
+class ThreadPool {
+public:
+  class TaskGroup;
+
+  struct Task {
+    void (*run)(void*);
+    void* arg;
+    TaskGroup* group;
+  };
+
+  class TaskGroup {
+  public:
+    explicit TaskGroup(ThreadPool& pool) : pool_(pool), pending_(0) {}
+    ~TaskGroup() { wait(); }
+
+    // Schedules fn() to be run by the pool. fn is copied.
+    template <typename F> void spawn(F fn) {
+      pending_.fetch_add(1, std::memory_order_relaxed);
+      Task task = { &invoke<F>, new F(fn), this };
+      pool_.push(task);
+    }
+
+    // Runs tasks until all tasks spawned in this group have finished
+    void wait();
+
+  private:
+    template <typename F> static void invoke(void* arg) {
+      F* fn = (F*)arg;
+      (*fn)();
+      delete fn;
+    }
+
+    friend class ThreadPool;
+    ThreadPool& pool_;
+    std::atomic<size_t> pending_;
+  };
+
+  // Starts a pool with *threads* workers, or one per CPU if threads is 0
+  explicit ThreadPool(size_t threads = 0);
+
+  // Waits for the workers to finish their current tasks and stops them. Tasks still
+  // queued are not run.
+  ~ThreadPool();
+
+  // Number of worker threads
+  inline size_t size() const { return workers_.size(); }
+
+  // Pool shared by the runtime, with one worker per CPU. Started on first use and
+  // never stopped.
+  static ThreadPool& shared();
+
+private:
+  struct Worker {
+    ThreadPool* pool;
+    size_t index;
+    std::mutex lock;
+    std::deque<Task> tasks;
+    std::thread thread;
+  };
+
+  void push(const Task& task);
+  bool runOne(Worker* self);
+  bool take(Worker* self, Task& task);
+  void workerMain(Worker* self);
+  Worker* currentWorker();
+
+  std::vector<Worker*> workers_;
+  std::mutex injectLock_;
+  std::deque<Task> inject_;      // tasks from threads which aren't workers
+  std::atomic<size_t> queued_;   // tasks waiting in any queue
+  std::atomic<size_t> sleepers_; // workers waiting for tasks
+  std::mutex sleepLock_;
+  std::condition_variable wakeup_;
+  std::atomic<bool> stopping_;
+};
+
+} // namespace hue
+#endif // _HUE_RUNTIME_THREAD_POOL_INCLUDED
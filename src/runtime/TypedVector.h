@@ -0,0 +1,454 @@
+// Copyright (c) 2012, Rasmus Andersson. All rights reserved. Use of this source
+// code is governed by a MIT-style license that can be found in the LICENSE file.
+//
+// An immutable and persistent vector of unboxed values, like Int, Float or Byte.
+//
+// The trie has the same shape as the one of Vector, with branches of 32 children,
+// but leaves hold packed native values instead of pointer-sized slots. A leaf holds
+// LeafSize bytes of values: 32 Ints or Floats, or 256 Bytes. Since values are never
+// objects, leaves carry no object bitset and copying or freeing a leaf never touches
+// its values.
+//
+// LeafSize is four cache lines rather than one, which keeps the trie as shallow as
+// Vector for 8-byte values (a single-line leaf would hold only 6 of them after the
+// node header), while still letting a scan stream through contiguous memory.
+//
+#ifndef _HUE_RUNTIME_TYPED_VECTOR_INCLUDED
+#define _HUE_RUNTIME_TYPED_VECTOR_INCLUDED
+
+#include <hue/runtime/object.h>
+#include <hue/runtime/simd.h>
+#include <hue/runtime/sort.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <stdexcept>
+#include <algorithm>
+
+namespace hue {
+
+template <typename T>
+class TypedVector { HUE_OBJECT(TypedVector<T>)
+public:
+  static const size_t LeafSize = 256; // bytes of values in a leaf
+  static const size_t LeafCap = LeafSize / sizeof(T);
+  static const uint32_t LeafBits = (LeafCap == 256) ? 8 : (LeafCap == 128) ? 7 :
+                                   (LeafCap == 64) ? 6 : (LeafCap == 32) ? 5 : 0;
+  static_assert(LeafBits != 0, "unsupported element size");
+
+  // Leaf holding up to LeafCap packed values
+  class Leaf { HUE_VAR_OBJECT(Leaf)
+  public:
+    static const Leaf _Empty;
+    static Leaf* Empty;
+
+    uint16_t length;
+    uint16_t capacity;
+
+    // Must be the last member
+    T data[0];
+
+    static Leaf* create(const T* values, uint16_t length, uint16_t capacity) {
+      assert(length <= capacity && capacity <= LeafCap);
+      Leaf* leaf = __alloc(allocsize(capacity));
+      leaf->length = length;
+      leaf->capacity = capacity;
+      memcpy(leaf->data, values, sizeof(T) * length);
+      return leaf;
+    }
+
+    // Copy of leaf with value appended
+    static Leaf* create(const Leaf& other, T value) {
+      Leaf* leaf = create(other.data, other.length, other.length + 1);
+      leaf->data[leaf->length++] = value;
+      return leaf;
+    }
+
+    inline static size_t allocsize(uint16_t capacity) {
+      return sizeof(Leaf) + (sizeof(T) * capacity);
+    }
+    inline size_t allocsize() const { return allocsize(capacity); }
+
+    Leaf() : refcount_(Unretainable), length(0), capacity(0) {}
+    void dealloc() {}
+  };
+
+  // Branch holding up to 32 children, which are all leaves or all branches
+  class Branch { HUE_VAR_OBJECT(Branch)
+  public:
+    static const Branch _Empty;
+    static Branch* Empty;
+
+    uint8_t length;
+    uint8_t capacity;
+    bool leaves; // true if children are leaves
+
+    // Must be the last member
+    void* children[0];
+
+    static Branch* create(uint8_t length, bool leaves) {
+      Branch* branch = __alloc(allocsize(length));
+      branch->length = length;
+      branch->capacity = length;
+      branch->leaves = leaves;
+      return branch;
+    }
+
+    // Copies other into a new branch of *length* children, retaining the children
+    // shared with other. Slots past the length of other are left uninitialized.
+    static Branch* create(const Branch& other, uint8_t length) {
+      Branch* branch = create(length, other.leaves);
+      uint8_t n = std::min(length, other.length);
+      memcpy(branch->children, other.children, sizeof(void*) * n);
+      for (uint8_t i = 0; i < n; ++i) branch->retainChild(i);
+      return branch;
+    }
+
+    inline Leaf* leaf(uint8_t i) const { assert(leaves); return (Leaf*)children[i]; }
+    inline Branch* branch(uint8_t i) const { assert(!leaves); return (Branch*)children[i]; }
+
+    inline void retainChild(uint8_t i) {
+      if (leaves) leaf(i)->retain(); else branch(i)->retain();
+    }
+    inline void releaseChild(uint8_t i) {
+      if (leaves) leaf(i)->release(); else branch(i)->release();
+    }
+
+    inline static size_t allocsize(uint8_t capacity) {
+      return sizeof(Branch) + (sizeof(void*) * capacity);
+    }
+    inline size_t allocsize() const { return allocsize(capacity); }
+
+    Branch() : refcount_(Unretainable), length(0), capacity(0), leaves(true) {}
+    void dealloc() {
+      for (uint8_t i = 0; i < length; ++i) releaseChild(i);
+    }
+  };
+
+  static const TypedVector _Empty;
+  static TypedVector* Empty;
+
+  // Creates a vector holding a copy of *count* values
+  static TypedVector* create(const T* values, size_t count) {
+    if (count == 0) return Empty;
+
+    // Everything after the last full leaf goes into the tail
+    size_t tailoff = ((count - 1) >> LeafBits) << LeafBits;
+    Leaf* tail = Leaf::create(values + tailoff, count - tailoff, count - tailoff);
+    size_t nleaves = tailoff >> LeafBits;
+    if (nleaves == 0) {
+      return create(count, 5, Branch::Empty, RetainReference, tail, TransferReference);
+    }
+
+    // Build the trie bottom-up, one level at a time
+    void** nodes = new void*[nleaves];
+    for (size_t i = 0; i < nleaves; ++i) {
+      nodes[i] = Leaf::create(values + (i << LeafBits), LeafCap, LeafCap);
+    }
+    size_t n = nleaves;
+    uint32_t shift = 0;
+    bool leaves = true;
+    do {
+      size_t parents = (n + 31) / 32;
+      for (size_t p = 0; p < parents; ++p) {
+        uint8_t length = (uint8_t)std::min((size_t)32, n - (p * 32));
+        Branch* branch = Branch::create(length, leaves);
+        memcpy(branch->children, nodes + (p * 32), sizeof(void*) * length);
+        nodes[p] = branch;
+      }
+      n = parents;
+      shift += 5;
+      leaves = false;
+    } while (n > 1);
+    Branch* root = (Branch*)nodes[0];
+    delete[] nodes;
+
+    return create(count, shift, root, TransferReference, tail, TransferReference);
+  }
+
+  inline size_t count() const { return count_; }
+
+  // Returns a new vector with value appended
+  TypedVector* append(T value) const {
+    if (tail_->length < LeafCap) {
+      // There's room in the tail
+      Leaf* tail = Leaf::create(*tail_, value);
+      return create(count_ + 1, shift_, root_, RetainReference, tail, TransferReference);
+    }
+
+    // Push the full tail into the trie
+    size_t li = tailoff() >> LeafBits; // index of the tail among leaves
+    Branch* root;
+    uint32_t shift = shift_;
+    if (li == ((size_t)1 << shift_)) {
+      // Overflow root
+      root = Branch::create(2, false);
+      root->children[0] = root_->retain();
+      root->children[1] = newPath(shift_, tail_);
+      shift += 5;
+    } else {
+      root = pushTail(shift_, root_, li, tail_);
+    }
+    Leaf* tail = Leaf::create(&value, 1, 1);
+    return create(count_ + 1, shift, root, TransferReference, tail, TransferReference);
+  }
+
+  inline T itemAt(size_t i) const throw(std::out_of_range) {
+    if (i >= count_) throw std::out_of_range("index out of range");
+    size_t off = tailoff();
+    if (i >= off) return tail_->data[i - off];
+    return leafFor(i)->data[i & (LeafCap - 1)];
+  }
+
+  // Returns a new vector with the value at index i replaced by value
+  TypedVector* assoc(size_t i, T value) const throw(std::out_of_range) {
+    if (i >= count_) throw std::out_of_range("index out of range");
+    size_t off = tailoff();
+    if (i >= off) {
+      Leaf* tail = Leaf::create(tail_->data, tail_->length, tail_->length);
+      tail->data[i - off] = value;
+      return create(count_, shift_, root_, RetainReference, tail, TransferReference);
+    }
+    Branch* root = doAssoc(shift_, root_, i, value);
+    return create(count_, shift_, root, TransferReference, tail_, RetainReference);
+  }
+
+  // Returns a new vector without the last value
+  TypedVector* pop() const throw(std::out_of_range) {
+    if (count_ == 0) throw std::out_of_range("can't pop empty vector");
+    if (count_ == 1) return Empty;
+    if (tail_->length > 1) {
+      Leaf* tail = Leaf::create(tail_->data, tail_->length - 1, tail_->length - 1);
+      return create(count_ - 1, shift_, root_, RetainReference, tail, TransferReference);
+    }
+
+    // The last leaf of the trie becomes the tail
+    Leaf* tail = leafFor(count_ - 2);
+    size_t li = (count_ - 2) >> LeafBits;
+    Branch* root = popTail(shift_, root_, li);
+    uint32_t shift = shift_;
+    if (root == 0) {
+      root = Branch::Empty;
+    } else if (shift > 5 && root->length == 1) {
+      Branch* child = root->branch(0)->retain();
+      root->release();
+      root = child;
+      shift -= 5;
+    }
+    return create(count_ - 1, shift, root, TransferReference, tail, RetainReference);
+  }
+
+  // Calls fn(const T* values, size_t n) for each leaf, in order. Values are contiguous
+  // within a leaf, which makes this the fastest way to scan a vector.
+  template <typename F> void forEachChunk(F fn) const {
+    forEachChunk(root_, fn);
+    if (tail_->length != 0) fn((const T*)tail_->data, (size_t)tail_->length);
+  }
+
+  // -- Searching and aggregating --
+  // Ints and Floats are scanned with the SIMD kernels of simd.h and other types with
+  // plain loops. Min and max throw std::out_of_range for the empty vector.
+
+  static const size_t NotFound = SIZE_MAX;
+
+  // Index of the first value equal to *value*, or NotFound
+  size_t find(T value) const {
+    size_t offset = 0;
+    if (findIn(root_, value, offset)) return offset;
+    size_t i = simd_find((const T*)tail_->data, (size_t)tail_->length, value);
+    return (i != tail_->length) ? offset + i : NotFound;
+  }
+
+  // Number of values equal to *value*
+  size_t countOf(T value) const {
+    size_t count = 0;
+    forEachChunk([&](const T* values, size_t n) { count += simd_count(values, n, value); });
+    return count;
+  }
+
+  // Sum of the values, in the arithmetic of T
+  T sum() const {
+    T sum = T();
+    forEachChunk([&](const T* values, size_t n) { sum += simd_sum(values, n); });
+    return sum;
+  }
+
+  // For Floats, NaN if any value is NaN
+  T min() const throw(std::out_of_range) {
+    if (count_ == 0) throw std::out_of_range("min of the empty vector");
+    T results[2] = { itemAt(0), T() };
+    forEachChunk([&](const T* values, size_t n) {
+      results[1] = simd_min(values, n);
+      results[0] = simd_min((const T*)results, 2);
+    });
+    return results[0];
+  }
+  T max() const throw(std::out_of_range) {
+    if (count_ == 0) throw std::out_of_range("max of the empty vector");
+    T results[2] = { itemAt(0), T() };
+    forEachChunk([&](const T* values, size_t n) {
+      results[1] = simd_max(values, n);
+      results[0] = simd_max((const T*)results, 2);
+    });
+    return results[0];
+  }
+
+  // Returns a new vector with the values sorted in ascending order. Ints and Floats are
+  // sorted in parallel on *pool* (see sort.h).
+  TypedVector* sorted(ThreadPool& pool = ThreadPool::shared()) const {
+    T* values = new T[count_];
+    T* dst = values;
+    forEachChunk([&](const T* chunk, size_t n) {
+      memcpy(dst, chunk, sizeof(T) * n);
+      dst += n;
+    });
+    sort_values(values, count_, pool);
+    TypedVector* v = create(values, count_);
+    delete[] values;
+    return v;
+  }
+
+  TypedVector() : refcount_(Unretainable), count_(0), shift_(5),
+                  root_(Branch::Empty), tail_(Leaf::Empty) {}
+
+  void dealloc() {
+    root_->release();
+    tail_->release();
+  }
+
+protected:
+  static TypedVector* create(size_t count, uint32_t shift,
+                             Branch* root, RefRule root_refrule,
+                             Leaf* tail, RefRule tail_refrule) {
+    TypedVector* v = __alloc();
+    v->count_ = count;
+    v->shift_ = shift;
+    v->root_ = (root_refrule == TransferReference) ? root : root->retain();
+    v->tail_ = (tail_refrule == TransferReference) ? tail : tail->retain();
+    return v;
+  }
+
+  inline size_t tailoff() const { return count_ - tail_->length; }
+
+  // Leaf holding index i, which must be below tailoff()
+  inline Leaf* leafFor(size_t i) const {
+    size_t li = i >> LeafBits;
+    const Branch* node = root_;
+    for (uint32_t level = shift_; level > 5; level -= 5) {
+      node = node->branch((li >> (level - 5)) & 31);
+    }
+    return node->leaf(li & 31);
+  }
+
+  // Copy of parent with leaf number li added. Returns a branch with a +1 refcount.
+  static Branch* pushTail(uint32_t level, const Branch* parent, size_t li, Leaf* leaf) {
+    uint8_t subidx = (li >> (level - 5)) & 31;
+    Branch* node = Branch::create(*parent, std::max(parent->length, (uint8_t)(subidx + 1)));
+    if (level == 5) {
+      node->children[subidx] = leaf->retain();
+    } else if (subidx < parent->length) {
+      node->branch(subidx)->release();
+      node->children[subidx] = pushTail(level - 5, parent->branch(subidx), li, leaf);
+    } else {
+      node->children[subidx] = newPath(level - 5, leaf);
+    }
+    return node;
+  }
+
+  // Path of branches from level down to leaf. Returns a node with a +1 refcount.
+  static void* newPath(uint32_t level, Leaf* leaf) {
+    if (level == 0) return leaf->retain();
+    Branch* node = Branch::create(1, level == 5);
+    node->children[0] = newPath(level - 5, leaf);
+    return node;
+  }
+
+  // Copy of node with index i set to value. Returns a branch with a +1 refcount.
+  static Branch* doAssoc(uint32_t level, const Branch* node, size_t i, T value) {
+    Branch* copy = Branch::create(*node, node->length);
+    uint8_t subidx = ((i >> LeafBits) >> (level - 5)) & 31;
+    if (level == 5) {
+      const Leaf* leaf = node->leaf(subidx);
+      Leaf* leafCopy = Leaf::create(leaf->data, leaf->length, leaf->length);
+      leafCopy->data[i & (LeafCap - 1)] = value;
+      copy->leaf(subidx)->release();
+      copy->children[subidx] = leafCopy;
+    } else {
+      copy->branch(subidx)->release();
+      copy->children[subidx] = doAssoc(level - 5, node->branch(subidx), i, value);
+    }
+    return copy;
+  }
+
+  // Copy of node without leaf number li, which must be its last leaf. Returns a
+  // branch with a +1 refcount, or 0 if the branch would be empty.
+  static Branch* popTail(uint32_t level, const Branch* node, size_t li) {
+    uint8_t subidx = (li >> (level - 5)) & 31;
+    if (level > 5) {
+      Branch* child = popTail(level - 5, node->branch(subidx), li);
+      if (child == 0 && subidx == 0) return 0;
+      Branch* copy = Branch::create(*node, child ? subidx + 1 : subidx);
+      if (child) {
+        copy->branch(subidx)->release();
+        copy->children[subidx] = child;
+      }
+      return copy;
+    }
+    if (subidx == 0) return 0;
+    return Branch::create(*node, subidx);
+  }
+
+  template <typename F> static void forEachChunk(const Branch* node, F& fn) {
+    for (uint8_t i = 0; i < node->length; ++i) {
+      if (node->leaves) {
+        const Leaf* leaf = node->leaf(i);
+        fn((const T*)leaf->data, (size_t)leaf->length);
+      } else {
+        forEachChunk(node->branch(i), fn);
+      }
+    }
+  }
+
+  // Adds the number of values before the first one equal to *value* to *offset*.
+  // Returns true if found.
+  static bool findIn(const Branch* node, T value, size_t& offset) {
+    for (uint8_t i = 0; i < node->length; ++i) {
+      if (node->leaves) {
+        const Leaf* leaf = node->leaf(i);
+        size_t j = simd_find((const T*)leaf->data, (size_t)leaf->length, value);
+        offset += j;
+        if (j != leaf->length) return true;
+      } else if (findIn(node->branch(i), value, offset)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+private:
+  size_t count_;
+  uint32_t shift_; // level of root_, where leaves are at level 0
+  Branch* root_;
+  Leaf* tail_;
+};
+
+template <typename T> const typename TypedVector<T>::Leaf TypedVector<T>::Leaf::_Empty;
+template <typename T> typename TypedVector<T>::Leaf* TypedVector<T>::Leaf::Empty =
+  (typename TypedVector<T>::Leaf*)&TypedVector<T>::Leaf::_Empty;
+
+template <typename T> const typename TypedVector<T>::Branch TypedVector<T>::Branch::_Empty;
+template <typename T> typename TypedVector<T>::Branch* TypedVector<T>::Branch::Empty =
+  (typename TypedVector<T>::Branch*)&TypedVector<T>::Branch::_Empty;
+
+template <typename T> const TypedVector<T> TypedVector<T>::_Empty;
+template <typename T> TypedVector<T>* TypedVector<T>::Empty =
+  (TypedVector<T>*)&TypedVector<T>::_Empty;
+
+typedef TypedVector<int64_t> IntVector;
+typedef TypedVector<double>  FloatVector;
+typedef TypedVector<uint8_t> ByteVector;
+
+} // namespace hue
+#endif // _HUE_RUNTIME_TYPED_VECTOR_INCLUDED
@@ -2,6 +2,15 @@
 // code is governed by a MIT-style license that can be found in the LICENSE file.
 #include "Vector.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <unordered_map>
+
 namespace hue {
 
 const Vector Vector::_Empty;
@@ -29,4 +38,217 @@ std::string Vector::Node::repr() const {
   return ss.str();
 }
 
+
+// ------------------------------------------------------
+// Vector files
+//
+// A vector file is a memory image of a vector and its nodes, written for a preferred
+// base address at which the file is mapped. The first page holds a header followed by
+// the Vector object. Nodes follow from the second page, children before their
+// parents, each aligned to 16 bytes. All objects are marked Unretainable and pointers
+// between them hold preferred addresses.
+
+struct VectorFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t objectHeaderSize; // ObjectHeaderSize of the writer
+  uint64_t base;             // preferred address of the mapping
+  uint64_t size;             // file size
+  uint64_t count;            // number of values
+};
+
+static const char VectorFileMagic[8] = { 'h', 'u', 'e', 'v', 'e', 'c', 't', 0 };
+static const uint32_t VectorFileVersion = 2;
+static const size_t VectorFileVectorOffset = 64;
+static const size_t VectorFileNodesOffset = 4096;
+
+static inline size_t align16(size_t n) { return (n + 15) & ~(size_t)15; }
+
+// Picks a preferred base address for a new file. Spreading files over 1 GB slots of
+// a range that's usually free makes it unlikely that two files want the same address.
+static uint64_t pickBaseAddress() {
+  uint64_t h = ((uint64_t)time(0) << 20) ^ (uint64_t)getpid() ^ (uint64_t)&h;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return 0x100000000000ULL + ((h % 8192) << 30);
+}
+
+
+bool Vector::writeFile(const char* path) const {
+  struct VectorFileWriter {
+    FILE* f;
+    uint64_t base;
+    uint64_t offset;
+    std::unordered_map<const Node*, uint64_t> offsets;
+    std::vector<uint8_t> buf;
+
+    // Writes the first *length* values of node and its descendants unless already
+    // written. Returns the address of node in the file, or 0 on failure.
+    uint64_t write(const Node* node, uint8_t length) {
+      bool whole = length == node->length;
+      if (whole) {
+        std::unordered_map<const Node*, uint64_t>::iterator it = offsets.find(node);
+        if (it != offsets.end()) return base + it->second;
+      }
+
+      uint64_t children[32];
+      for (uint8_t i = 0; i < length; ++i) {
+        if (node->objectBitset[i]) {
+          const Node* child = node->getNode(i);
+          if ((children[i] = write(child, child->length)) == 0) return 0;
+        }
+      }
+
+      size_t size = node->allocsize();
+      buf.assign(align16(size), 0);
+      memcpy(buf.data(), (const void*)node, size);
+      Node* image = (Node*)buf.data();
+      memset((void*)image, 0, ObjectHeaderSize);
+      image->refcount_ = Unretainable;
+      image->length = length;
+      image->flags &= ~Node::Appendable; // mapped files are read-only
+      if (!whole) image->hashCache = 0;
+      for (uint8_t i = 0; i < length; ++i) {
+        if (node->objectBitset[i]) image->data[i] = (void*)children[i];
+      }
+      if (fwrite(buf.data(), 1, buf.size(), f) != buf.size()) return 0;
+      if (whole) offsets[node] = offset;
+      uint64_t addr = base + offset;
+      offset += buf.size();
+      return addr;
+    }
+  };
+
+  assert(sizeof(void*) == 8);
+  FILE* f = fopen(path, "wb");
+  if (!f) return false;
+
+  VectorFileWriter w;
+  w.f = f;
+  w.base = pickBaseAddress();
+  w.offset = VectorFileNodesOffset;
+
+  std::vector<uint8_t> page(VectorFileNodesOffset, 0);
+  bool ok = fwrite(page.data(), 1, page.size(), f) == page.size();
+
+  uint64_t root = 0, tail = 0;
+  if (ok && count_ != 0) {
+    // The empty root is a static of this process, so it's written as a new node
+    ok = (root = w.write(root_, root_->length)) != 0 &&
+         (tail = w.write(tail_, tailLength_)) != 0;
+  }
+
+  if (ok) {
+    VectorFileHeader* header = (VectorFileHeader*)page.data();
+    memcpy(header->magic, VectorFileMagic, sizeof(VectorFileMagic));
+    header->version = VectorFileVersion;
+    header->objectHeaderSize = ObjectHeaderSize;
+    header->base = w.base;
+    header->size = w.offset;
+    header->count = count_;
+
+    Vector* image = (Vector*)(page.data() + VectorFileVectorOffset);
+    memcpy((void*)image, (const void*)this, sizeof(Vector));
+    memset((void*)image, 0, ObjectHeaderSize);
+    image->refcount_ = Unretainable;
+    image->root_ = (Node*)root;
+    image->tail_ = (Node*)tail;
+
+    ok = fseek(f, 0, SEEK_SET) == 0 &&
+         fwrite(page.data(), 1, page.size(), f) == page.size();
+  }
+
+  int e = errno;
+  if (fclose(f) != 0) ok = false; else errno = e;
+  return ok;
+}
+
+Vector* Vector::mapFile(const char* path) {
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) return 0;
+
+  VectorFileHeader header;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    int e = errno;
+    close(fd);
+    errno = e;
+    return 0;
+  }
+  if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+      memcmp(header.magic, VectorFileMagic, sizeof(VectorFileMagic)) != 0 ||
+      header.version != VectorFileVersion ||
+      header.objectHeaderSize != ObjectHeaderSize ||
+      header.size != (uint64_t)st.st_size ||
+      header.size < VectorFileNodesOffset) {
+    close(fd);
+    errno = EINVAL;
+    return 0;
+  }
+  if (header.count == 0) {
+    close(fd);
+    return Empty;
+  }
+
+  // Map the file at its preferred address if possible
+  uint8_t* p = (uint8_t*)mmap((void*)header.base, header.size, PROT_READ, MAP_PRIVATE,
+                              fd, 0);
+  if (p != MAP_FAILED && p != (uint8_t*)header.base) {
+    munmap(p, header.size);
+
+    // Relocate all pointers in a private, writable mapping. Node headers are checked
+    // as they're read, and pointers must lead to an earlier node, since children are
+    // written before their parents.
+    p = (uint8_t*)mmap(0, header.size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (p != MAP_FAILED) {
+      bool valid = true;
+      for (size_t off = VectorFileNodesOffset; valid && off < header.size; ) {
+        Node* node = (Node*)(p + off);
+        if (header.size - off < sizeof(Node) || node->length > node->capacity ||
+            node->capacity > 32 || header.size - off < node->allocsize()) {
+          valid = false;
+          break;
+        }
+        for (uint8_t i = 0; i < node->length; ++i) {
+          if (!node->objectBitset[i]) continue;
+          uint64_t child = (uint64_t)node->data[i] - header.base;
+          if (child < VectorFileNodesOffset || child >= off || (child & 15) != 0) {
+            valid = false;
+            break;
+          }
+          node->data[i] = (void*)(p + child);
+        }
+        off += align16(node->allocsize());
+      }
+      Vector* v = (Vector*)(p + VectorFileVectorOffset);
+      uint64_t root = (uint64_t)v->root_ - header.base;
+      uint64_t tail = (uint64_t)v->tail_ - header.base;
+      if (!valid || root < VectorFileNodesOffset || root >= header.size ||
+          tail < VectorFileNodesOffset || tail >= header.size) {
+        munmap(p, header.size);
+        p = (uint8_t*)MAP_FAILED;
+        errno = EINVAL;
+      } else {
+        v->root_ = (Node*)(p + root);
+        v->tail_ = (Node*)(p + tail);
+        mprotect(p, header.size, PROT_READ);
+      }
+    }
+  }
+  int e = errno;
+  close(fd);
+  if (p == MAP_FAILED) {
+    errno = e;
+    return 0;
+  }
+  return (Vector*)(p + VectorFileVectorOffset);
+}
+
+void Vector::unmapFile(Vector* v) {
+  if (v == Empty) return;
+  uint8_t* p = ((uint8_t*)v) - VectorFileVectorOffset;
+  munmap(p, ((VectorFileHeader*)p)->size);
+}
+
 } // namespace hue
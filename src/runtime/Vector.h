@@ -14,6 +14,9 @@
 #define _HUE_RUNTIME_VECTOR_INCLUDED
 
 #include <hue/runtime/object.h>
+#include <hue/runtime/ThreadPool.h>
+#include <hue/runtime/simd.h>
+#include <hue/runtime/sort.h>
 
 #include <stdio.h>
 #include <assert.h>
@@ -26,44 +29,30 @@
 #include <sstream>
 #include <stdexcept>
 #include <bitset>
-
-#ifdef DEBUG_Node_refcount
-static size_t live_node_count = 0;
-#define DEBUG_LIVECOUNT_Node live_node_count
-#define DEBUG_LIVECOUNT_Node_INC HUE_DEBUG_COUNT_INC(DEBUG_LIVECOUNT_Node);
-#define DEBUG_LIVECOUNT_Node_DEC HUE_DEBUG_COUNT_DEC(DEBUG_LIVECOUNT_Node);
-#else
-#define DEBUG_LIVECOUNT_Node_INC
-#define DEBUG_LIVECOUNT_Node_DEC
-#endif
-
-#ifdef DEBUG_Vector_refcount
-static size_t live_vector_count = 0;
-#define DEBUG_LIVECOUNT_Vector live_vector_count
-#define DEBUG_LIVECOUNT_Vector_INC HUE_DEBUG_COUNT_INC(DEBUG_LIVECOUNT_Vector);
-#define DEBUG_LIVECOUNT_Vector_DEC HUE_DEBUG_COUNT_DEC(DEBUG_LIVECOUNT_Vector);
-#else
-#define DEBUG_LIVECOUNT_Vector_INC
-#define DEBUG_LIVECOUNT_Vector_DEC
-#endif
+#include <vector>
+#include <algorithm>
 
 namespace hue {
 
 
-class Vector { HUE_OBJECT(Vector)
+class Vector { HUE_VAR_OBJECT(Vector)
 
   
   
   // Rudimentary fixed-size copyable array
-  class Node { HUE_OBJECT(Node)
+  class Node { HUE_VAR_OBJECT(Node)
   public:
     static const Node _Empty;
     static Node* Empty;
     typedef void* V;
   
+    enum { Relaxed = 1, Appendable = 2 }; // flags
+
     uint8_t length; // <= 32 = 100000 (only 6-bits are used)
-    uint8_t unused;
+    uint8_t capacity; // number of slots allocated for data (>= length)
+    uint8_t flags;
     std::bitset<32> objectBitset; // each bit is a flag which if set means that index is an object
+    uint64_t hashCache; // hash(level) | HashKnown once computed, otherwise 0
     // Note: Object superclass is 32-bit wide, meaning we align on 64-bit boundaries.
   
     // Note: We could use bit-fields of 6 and 58 bits here, so we align
@@ -84,9 +73,16 @@ class Vector { HUE_OBJECT(Vector)
     //static Node* create(const V value);
     //static Node* create(const Node& other, V tailValue);
     //static Node* create(const Node& other, uint8_t length);
+    //static Node* create(const Node& other, uint8_t length, uint8_t capacity);
   
     static Node* create(uint8_t length) {
-      Node* node = alloc(length);
+      return create(length, length);
+    }
+
+    // Creates a node with room for *capacity* values, of which *length* are in use
+    static Node* create(uint8_t length, uint8_t capacity) {
+      assert(capacity >= length);
+      Node* node = alloc(capacity);
       node->length = length;
       node->objectBitset = 0;
       return node;
@@ -100,24 +96,53 @@ class Vector { HUE_OBJECT(Vector)
       return node;
     }
 
-    static Node* create(const Node& other, V tailValue) {
-      Node* node = alloc(other.length+1);
-      __copy(node, &other);
-
-      // Increase refcount of any shallow-copied objects
-      if (node->objectBitset.any()) for (size_t i = 0; i < node->objectBitset.size(); ++i) {
-        if (node->objectBitset[i]) node->getNode(i)->retain();
-      }
+    // Creates a leaf holding a copy of *length* values
+    static Node* createLeaf(const V* values, uint8_t length) {
+      Node* node = create(length);
+      memcpy(node->data, values, sizeof(V) * length);
+      return node;
+    }
 
-      ((V*)&node->data)[other.length] = tailValue;
-      ++node->length;
+    // Creates an appendable tail with room for 32 values, holding a copy of the first
+    // *length* values of other (if any) followed by value
+    static Node* createTail(const Node* other, uint8_t length, V value) {
+      Node* node = create(length + 1, 32);
+      node->flags = Appendable;
+      if (other) memcpy(node->data, other->data, sizeof(V) * length);
+      node->data[length] = value;
       return node;
     }
 
+    // Vectors share their tail with the vectors appended to them. A tail records in
+    // length how many of its slots have been claimed, and each vector sharing it holds
+    // how many it uses. The first vector to append to a tail whose slots it uses all of
+    // claims the next slot and may write it; others see only the slots they use, so
+    // nothing they can see changes. Returns true if the slot after the first *used*
+    // slots was claimed.
+    inline bool claim(uint8_t used) {
+      if (!(flags & Appendable) || used >= capacity) return false;
+      return __atomic_compare_exchange_n(&length, &used, (uint8_t)(used + 1), false,
+                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    }
+
     static Node* create(const Node& other, uint8_t length) {
-      assert(length >= other.length);
-      Node* node = alloc(length);
-      __copy(node, &other);
+      return create(other, length, length);
+    }
+
+    // Copies other into a new node of *length* values. If length is less than the
+    // length of other, the copy is truncated.
+    static Node* create(const Node& other, uint8_t length, uint8_t capacity) {
+      assert(capacity >= length);
+      assert(!other.isRelaxed() || length <= other.length);
+      Node* node = alloc(capacity, other.isRelaxed());
+      __copy(node, &other, std::min(length, other.length));
+      node->capacity = capacity;
+      if (other.isRelaxed()) {
+        memcpy(node->sizeTable(), other.sizeTable(), sizeof(size_t) * length);
+      }
+      for (uint8_t i = length; i < other.length; ++i) {
+        node->objectBitset[i] = false;
+      }
 
       // Increase refcount of any shallow-copied objects
       if (node->objectBitset.any()) for (size_t i = 0; i < node->objectBitset.size(); ++i) {
@@ -150,34 +175,146 @@ class Vector { HUE_OBJECT(Vector)
       assert(objectBitset[i] == true);
       return ((Node**)&data)[i];
     }
+
+    // Relaxed branches have children holding less than the maximum number of values,
+    // which is what makes concatenation and slicing possible without copying. The
+    // size table of a relaxed branch lists the number of values held by each child
+    // plus the values of all children before it. It's stored right after data.
+    inline bool isRelaxed() const { return flags & Relaxed; }
+    inline size_t* sizeTable() const { return (size_t*)&data[capacity]; }
+
+    // Creates a branch at *level* (leaves being at level 0) holding *length* children.
+    // The branch is relaxed unless the children form a regular subtree, that is one
+    // where all leaves are full and all but the last child hold as many values as
+    // they can.
+    static Node* createBranch(Node* const* children, uint8_t length, uint32_t level,
+                              RefRule refrule) {
+      size_t sizes[32];
+      size_t total = 0;
+      bool regular = true;
+      for (uint8_t i = 0; i < length; ++i) {
+        const Node* child = children[i];
+        size_t n = child->count(level - 5);
+        total += n;
+        sizes[i] = total;
+        bool childRegular = (level == 5) ? (child->length == 32) : !child->isRelaxed();
+        if (!childRegular || (i + 1 < length && n != ((size_t)1 << level))) {
+          regular = false;
+        }
+      }
+      Node* node = alloc(length, !regular);
+      node->length = length;
+      node->objectBitset = 0;
+      for (uint8_t i = 0; i < length; ++i) {
+        node->setNode(i, children[i], refrule);
+      }
+      if (!regular) {
+        memcpy(node->sizeTable(), sizes, sizeof(size_t) * length);
+      }
+      return node;
+    }
+
+    // Number of values in the subtree of this node at *level*
+    size_t count(uint32_t level) const {
+      if (level == 0 || length == 0) return length;
+      if (isRelaxed()) return sizeTable()[length - 1];
+      return ((size_t)(length - 1) << level) + getNode(length - 1)->count(level - 5);
+    }
+
+    // Returns the index of the child of this branch at *level* which holds value i,
+    // and makes i relative to that child.
+    inline uint8_t childIndex(size_t& i, uint32_t level) const {
+      uint8_t idx;
+      if (isRelaxed()) {
+        const size_t* sizes = sizeTable();
+        idx = i >> level;
+        while (sizes[idx] <= i) ++idx;
+        if (idx != 0) i -= sizes[idx - 1];
+      } else {
+        idx = (i >> level) & 0x1f;
+        i &= ((size_t)1 << level) - 1;
+      }
+      return idx;
+    }
+
+    // Creates a branch shaped like other: same length, and the same size table if
+    // other is relaxed. The caller must fill in all children and their objectBitset
+    // bits.
+    static Node* createShape(const Node& other) {
+      Node* node = alloc(other.length, other.isRelaxed());
+      node->length = other.length;
+      node->objectBitset = 0;
+      if (other.isRelaxed()) {
+        memcpy(node->sizeTable(), other.sizeTable(), sizeof(size_t) * other.length);
+      }
+      return node;
+    }
   
+    // Hash of the values in the subtree of this node at *level*. The hash only
+    // depends on the values, not on how the subtree is shaped, and is cached in the
+    // node the first time it's computed (unless the node is Unretainable, in which
+    // case it might live in read-only memory).
+    uint64_t hash(uint32_t level) const {
+      uint64_t h = __atomic_load_n(&hashCache, __ATOMIC_RELAXED);
+      if (h != 0) return h & HashPrime;
+      if (level == 0) {
+        h = hashValues(0, data, length);
+      } else for (uint8_t i = 0; i < length; ++i) {
+        const Node* child = getNode(i);
+        h = hashConcat(h, child->hash(level - 5), child->count(level - 5));
+      }
+      if (__atomic_load_n(&refcount_, __ATOMIC_RELAXED) != Unretainable) {
+        __atomic_store_n(const_cast<uint64_t*>(&hashCache), h | HashKnown, __ATOMIC_RELAXED);
+      }
+      return h;
+    }
+
+    // Hash of this node's subtree if it has already been computed, otherwise 0
+    inline uint64_t knownHash() const {
+      return __atomic_load_n(&hashCache, __ATOMIC_RELAXED);
+    }
+
     std::string repr() const;
 
   private:
-    Node() : refcount_(Unretainable), length(0), objectBitset(0) {}
+    friend class Vector;
+    Node() : refcount_(Unretainable), length(0), capacity(0), flags(0), objectBitset(0)
+           , hashCache(0) {}
   
-    inline static Node* alloc(uint8_t length) {
-      DEBUG_LIVECOUNT_Node_INC
-      return __alloc(sizeof(Node) + (sizeof(V) * length));
+    // Size of a node with room for *capacity* values
+    inline static size_t allocsize(uint8_t capacity, bool relaxed) {
+      size_t size = sizeof(Node) + (sizeof(V) * capacity);
+      if (relaxed) size += sizeof(size_t) * capacity;
+      return size;
     }
+    inline size_t allocsize() const { return allocsize(capacity, isRelaxed()); }
 
-    static Node* __copy(Node* dest, Node const* source) {
-      // This function performs a memcpy but leaves the reference count unchanged.
-      // Requirement: refcount_ (usually from HUE_OBJECT) must be the first member of the
-      // struct/class.
+    inline static Node* alloc(uint8_t capacity, bool relaxed = false) {
+      Node* node = __alloc(allocsize(capacity, relaxed));
+      node->capacity = capacity;
+      node->flags = relaxed ? Relaxed : 0;
+      node->hashCache = 0;
+      return node;
+    }
+
+    static void __copy(Node* dest, Node const* source, uint8_t length) {
+      // This function performs a memcpy of the first *length* values of source (and
+      // all other members), but leaves the reference count unchanged. The cached hash
+      // is not copied, as copies are made to be modified.
+      // Requirement: The HUE_OBJECT header must be at the start of the struct/class.
       //
       // TODO: If we can figure out how to communicate a class's intended size, we could
       // bundle this function into HUE_OBJECT.
       //
-      return (Node*)memcpy(
-        ((uint8_t*)dest) + sizeof(Ref), // start after refcount_ member
-        ((uint8_t*)source) + sizeof(Ref),      // start after refcount_ member
-        (sizeof(Node)-sizeof(Ref)) + (sizeof(void*) * source->length) // size - refcount_ member
+      memcpy(
+        ((uint8_t*)dest) + ObjectHeaderSize, // start after HUE_OBJECT header
+        ((uint8_t*)source) + ObjectHeaderSize,      // start after HUE_OBJECT header
+        (sizeof(Node)-ObjectHeaderSize) + (sizeof(void*) * length) // size - header
       );
+      dest->hashCache = 0;
     }
 
     void dealloc() {
-      DEBUG_LIVECOUNT_Node_DEC
       // Release any refs we own
       if (objectBitset.any()) for (size_t i = 0; i < objectBitset.size(); ++i) {
         if (objectBitset[i]) getNode(i)->release();
@@ -189,6 +326,59 @@ class Vector { HUE_OBJECT(Vector)
 public:
   // The empty vector
   static Vector *Empty;
+
+  // Vectors of up to this many values are "small": they have no trie, and their tail
+  // is embedded in the same allocation as the vector. The embedded tail is
+  // Unretainable and lives only as long as its vector, so operations which would
+  // otherwise share the tail of a small vector copy it instead.
+  static const size_t SmallMax = 8;
+  
+  // Returns a new vector containing the *count* values in *values*. The trie is
+  // built bottom-up from full leaves, making this O(n) with about n/32 allocations.
+  static Vector* create(const void* const* values, size_t count) {
+    if (count == 0) return Vector::Empty;
+    if (count <= SmallMax) {
+      Vector* v = createSmall(count);
+      memcpy(v->tail_->data, values, sizeof(void*) * count);
+      return v;
+    }
+
+    // The last 1-32 values goes into the tail
+    size_t tailoff = ((count - 1) >> 5) << 5;
+    Node* tail = Node::create((uint8_t)(count - tailoff));
+    memcpy(tail->data, values + tailoff, sizeof(void*) * tail->length);
+    if (tailoff == 0) {
+      return Vector::create(count, 5, Node::Empty,RetainReference, tail,TransferReference);
+    }
+
+    // Leaves
+    size_t n = tailoff >> 5;
+    std::vector<Node*> nodes(n);
+    for (size_t i = 0; i < n; ++i) {
+      nodes[i] = Node::create(32);
+      memcpy(nodes[i]->data, values + (i << 5), sizeof(void*) * 32);
+    }
+
+    // Branches, one level at a time until we are left with a single root
+    uint32_t shift = 5;
+    while (true) {
+      size_t parentCount = (n + 31) >> 5;
+      for (size_t p = 0; p < parentCount; ++p) {
+        size_t start = p << 5;
+        uint8_t length = (uint8_t)std::min((size_t)32, n - start);
+        Node* parent = Node::create(length);
+        for (uint8_t i = 0; i < length; ++i) {
+          parent->setNode(i, nodes[start + i], TransferReference);
+        }
+        nodes[p] = parent;
+      }
+      n = parentCount;
+      if (n == 1) break;
+      shift += 5;
+    }
+
+    return Vector::create(count, shift, nodes[0],TransferReference, tail,TransferReference);
+  }
   
   // Number of items contained by the receiver
 const size_t count() const { return count_; }
@@ -197,9 +387,23 @@ const size_t count() const { return count_; }
   Vector* append(void* val) const {
     // Note: Return value could be "Vector const*", but that would cause trouble for retain/release.
   
-    //room in tail?
+    //small? The values are copied into a new small vector.
+    if (count_ < SmallMax && root_->length == 0) {
+      Vector* v = createSmall(count_ + 1);
+      if (count_ != 0) memcpy(v->tail_->data, tail_->data, sizeof(void*) * count_);
+      v->tail_->data[count_] = val;
+      return v;
+    }
+
+    //room in tail? Write to a free slot of our tail if we can claim it, or else copy
+    //the tail into a new one with room to grow.
     if (tailLength() < 32) {
-      Node* newTail = (tail_ == 0) ? Node::create(val) : Node::create(*tail_, val);
+      if (tail_ && tail_->claim(tailLength_)) {
+        tail_->setValue(tailLength_, val);
+        return Vector::create(count_ + 1, shift_, root_,RetainReference,
+                              tail_,RetainReference, tailLength_ + 1);
+      }
+      Node* newTail = Node::createTail(tail_, tailLength_, val);
       return Vector::create(count_ + 1, shift_, root_,RetainReference, newTail,TransferReference);
     }
   
@@ -208,7 +412,9 @@ const size_t count() const { return count_; }
     uint32_t newshift = shift_;
   
     // Overflow root?
-    if ((count_ >> 5) > (1 << shift_)) {
+    if (root_->isRelaxed()) {
+      newroot = pushLeaf(root_, tail_, newshift);
+    } else if ((count_ >> 5) > ((size_t)1 << shift_)) {
       newroot = Node::create(2);
       newroot->setNode(0, root_);
       newroot->setNode(1, newPath(shift_, tail_), TransferReference);
@@ -217,35 +423,696 @@ const size_t count() const { return count_; }
       newroot = pushTail(shift_, root_, tail_);
     }
   
-    Node* newTail = Node::create(val);
+    Node* newTail = Node::createTail(0, 0, val);
     return Vector::create(count_ + 1, newshift, newroot,TransferReference, newTail,TransferReference);
   }
+
+  // Like append, but takes over the caller's reference to the receiver, which must not
+  // be used afterwards:
+  //
+  //   v = v->appendConsuming(val);
+  //
+  // When the caller holds the only reference, the receiver itself becomes the result
+  // and, like with a Transient, its tail and the path to it are modified in place
+  // wherever no other vector shares them. Appending n values this way takes about
+  // n/32 allocations rather than two per value.
+  Vector* appendConsuming(void* val) {
+    if (!isUniquelyReferenced() || isSmall()) {
+      Vector* v = append(val);
+      release();
+      return v;
+    }
+    // Room in an unshared tail? This is the case for 31 of 32 appends.
+    if (tail_ && tailLength_ < tail_->capacity && tail_->isUniquelyReferenced()) {
+      tail_->hashCache = 0;
+      tail_->setValue(tailLength_++, val);
+      tail_->length = tailLength_;
+      ++count_;
+      return this;
+    }
+    Transient t;
+    t.swapContents(this);
+    t.append(val);
+    t.swapContents(this);
+    return this;
+  }
   
   // Retrieve item at index i
   inline void* itemAt(size_t i) const throw(std::out_of_range) {
-    return nodeFor(i).getValue(i & 0x1f);
+    const Node& node = nodeFor(i);
+    return node.getValue(i);
+  }
+
+  // Returns a vector with the item at index i replaced by val. Only the path from the
+  // root to the affected leaf is copied; everything else is shared with the receiver.
+  Vector* assoc(size_t i, void* val) const throw(std::out_of_range) {
+    if (i >= count_)
+      throw std::out_of_range("index out of range");
+
+    if (i >= tailoff()) {
+      Node* newTail = Node::create(*tail_, tailLength_);
+      newTail->setValue(i - tailoff(), val);
+      return Vector::create(count_, shift_, root_,RetainReference, newTail,TransferReference);
+    }
+
+    Node* newroot = doAssoc(shift_, root_, i, val);
+    return Vector::create(count_, shift_, newroot,TransferReference,
+                          tail_,RetainReference, tailLength_);
+  }
+
+  // Returns a vector without the last item of the receiver
+  Vector* pop() const throw(std::out_of_range) {
+    if (count_ == 0)
+      throw std::out_of_range("can not pop the empty vector");
+    if (count_ == 1)
+      return Vector::Empty;
+
+    // More than one value in tail? The result shares it, using one value less.
+    if (tailLength() > 1) {
+      return Vector::create(count_ - 1, shift_, root_,RetainReference,
+                            tail_,RetainReference, tailLength_ - 1);
+    }
+
+    // The last leaf of the trie becomes the new tail
+    Node* newTail;
+    Node* newroot;
+    uint32_t newshift = shift_;
+    if (root_->isRelaxed()) {
+      newroot = popLeaf(shift_, root_, newTail);
+    } else {
+      size_t i = count_ - 2;
+      newTail = const_cast<Node*>(&nodeFor(i))->retain();
+      newroot = popTail(shift_, root_);
+    }
+    if (newroot == 0) {
+      newroot = Node::Empty;
+      newshift = 5;
+    } else {
+      newroot = collapse(newroot, newshift);
+    }
+    return Vector::create(count_ - 1, newshift, newroot,TransferReference, newTail,TransferReference);
+  }
+
+  // Returns a vector of the items in the range [start, end) of the receiver. The
+  // result shares all but the nodes along its left and right edges with the receiver
+  // and is created in O(log32 n).
+  Vector* subvec(size_t start, size_t end) const throw(std::out_of_range) {
+    if (start > end || end > count_)
+      throw std::out_of_range("range out of bounds");
+    if (start == end)
+      return Vector::Empty;
+    if (start == 0 && end == count_)
+      return const_cast<Vector*>(this)->retain();
+
+    size_t toff = tailoff();
+    Node* root = 0;
+    Node* tail;
+    uint32_t shift = shift_;
+
+    if (end > toff) {
+      // Ends in the tail
+      if (start >= toff) {
+        tail = Node::createLeaf(tail_->data + (start - toff), end - start);
+      } else {
+        tail = Node::create(*tail_, end - toff);
+        root = sliceLeft(shift, root_, start);
+      }
+    } else {
+      // Ends in the trie. The last leaf of the slice becomes the new tail.
+      Node* right = sliceRight(shift, root_, end);
+      Node* slice = sliceLeft(shift, right, start);
+      right->release();
+      root = popLeaf(shift, slice, tail);
+      slice->release();
+    }
+
+    if (root == 0) {
+      root = Node::Empty;
+      shift = 5;
+    } else {
+      root = collapse(root, shift);
+    }
+    return Vector::create(end - start, shift, root,TransferReference, tail,TransferReference);
+  }
+
+  // Returns a vector of the items of the receiver followed by the items of other.
+  // The result shares all but the nodes along the seam with the two vectors and is
+  // created in O(log32 n).
+  Vector* concat(const Vector* other) const {
+    if (other->count_ == 0)
+      return const_cast<Vector*>(this)->retain();
+    if (count_ == 0)
+      return const_cast<Vector*>(other)->retain();
+
+    if (other->root_->length == 0) {
+      // Other has no trie, so its values can simply be appended to our tail
+      if (tailLength_ + other->count_ <= 32) {
+        Node* newTail = Node::create(*tail_, tailLength_ + other->count_);
+        memcpy(newTail->data + tailLength_, other->tail_->data, sizeof(void*) * other->count_);
+        return Vector::create(count_ + other->count_, shift_, root_,RetainReference,
+                              newTail,TransferReference);
+      }
+      Transient t(this);
+      for (size_t i = 0; i < other->count_; ++i) {
+        t.append(other->tail_->data[i]);
+      }
+      return t.persistent();
+    }
+
+    // Push our tail into our trie and join the two tries. A leaf in a trie must not
+    // change, so a tail others might still append to is copied.
+    uint32_t leftShift = shift_;
+    Node* leaf = (tailLength_ < tail_->capacity) ? Node::create(*tail_, tailLength_)
+                                                 : retainedTail();
+    Node* left = pushLeaf(root_, leaf, leftShift);
+    leaf->release();
+    uint32_t shift = std::max(leftShift, other->shift_) + 5;
+    Node* root = concatSubTree(left, leftShift, other->root_, other->shift_);
+    left->release();
+    root = collapse(root, shift);
+    return Vector::create(count_ + other->count_, shift, root,TransferReference,
+                          other->tail_,RetainReference, other->tailLength_);
   }
 
+  // Hash of the values of the receiver. Vectors holding the same values have the same
+  // hash, no matter how they were built. Hashes of subtrees are cached in their nodes,
+  // so hashing a modified version of a vector which has already been hashed only
+  // visits the nodes which aren't shared with the original.
+  uint64_t hash() const {
+    if (count_ == 0) return 0;
+    uint64_t h = (root_->length == 0) ? 0 : root_->hash(shift_);
+    return hashValues(h, tail_->data, tailLength_);
+  }
+
+  // True if the receiver and other hold the same values. Subtrees shared by the two
+  // vectors are skipped without being visited, so comparing two versions of a vector
+  // takes time proportional to the number of nodes that differ between them.
+  bool equals(const Vector* other) const {
+    if (other == this) return true;
+    if (count_ != other->count_) return false;
+    if (tailLength_ == other->tailLength_) {
+      // Tries holding the same values have the same hash
+      uint64_t h1 = root_->knownHash(), h2 = other->root_->knownHash();
+      if (h1 != 0 && h2 != 0 && h1 != h2) return false;
+    }
+    bool equal = true;
+    compare(other, [&](size_t start, size_t end) { equal = false; return false; });
+    return equal;
+  }
+
+  // Calls fn(size_t start, size_t end) for each range of indices [start, end) at which
+  // the receiver and other hold different values, in order. Adjacent ranges are merged,
+  // and indices past the end of the shorter vector are reported as changed. Like
+  // equals, this skips subtrees shared by the two vectors.
+  template <typename F>
+  void diff(const Vector* other, F fn) const {
+    size_t start = 0, end = 0;
+    compare(other, [&](size_t s, size_t e) {
+      if (s != end || start == end) {
+        if (start != end) fn(start, end);
+        start = s;
+      }
+      end = e;
+      return true;
+    });
+    if (start != end) fn(start, end);
+  }
+
+  // Iterates over the values of a vector one leaf at a time, handing out each leaf's
+  // data directly so that scans become a sequential read of up to 32 values at a
+  // time, rather than a trie lookup per value.
+  //
+  //   Vector::ChunkIterator it(v);
+  //   void* const* values;
+  //   while (size_t n = it.next(values)) {
+  //     for (size_t i = 0; i < n; ++i) use(values[i]);
+  //   }
+  //
+  // The iterator does not retain the vector, so the vector must outlive it.
+  class ChunkIterator {
+  public:
+    explicit ChunkIterator(const Vector* v)
+        : vector_(v), offset_(0), nextOffset_(0), atTail_(false), depth_(0) {
+      if (v->root_->length != 0) {
+        next_ = firstLeaf(v->root_, v->shift_);
+      } else {
+        next_ = v->tail_;
+        atTail_ = true;
+      }
+    }
+
+    // Sets *values* to the next chunk of values and returns the number of values in
+    // that chunk. Returns 0 when there are no more values.
+    size_t next(void* const*& values) {
+      Node* leaf = next_;
+      if (leaf == 0) return 0;
+      size_t length = atTail_ ? vector_->tailLength_ : leaf->length;
+      offset_ = nextOffset_;
+      nextOffset_ += length;
+      values = leaf->data;
+      if (atTail_) {
+        next_ = 0;
+      } else {
+        next_ = nextLeaf();
+        prefetch(next_);
+      }
+      return length;
+    }
+
+    // Index of the first value in the chunk most recently returned by next()
+    size_t offset() const { return offset_; }
+
+  private:
+    // Descends to the leftmost leaf of node, recording the path taken
+    Node* firstLeaf(Node* node, uint32_t level) {
+      for (; level > 0; level -= 5) {
+        path_[depth_] = node;
+        index_[depth_++] = 0;
+        node = node->getNode(0);
+      }
+      return node;
+    }
+
+    // Moves to the leaf following the current one, continuing with the tail once
+    // the trie is exhausted.
+    Node* nextLeaf() {
+      while (depth_ != 0) {
+        uint8_t d = depth_ - 1;
+        if (index_[d] + 1 < path_[d]->length) {
+          Node* child = path_[d]->getNode(++index_[d]);
+          return firstLeaf(child, (vector_->shift_ - (d * 5)) - 5);
+        }
+        --depth_;
+      }
+      atTail_ = true;
+      return vector_->tail_;
+    }
+
+    static inline void prefetch(const Node* node) {
+      if (node == 0) return;
+      const uint8_t* p = (const uint8_t*)node;
+      const uint8_t* end = (const uint8_t*)&node->data[node->length];
+      for (; p < end; p += 64) __builtin_prefetch(p);
+    }
+
+    const Vector* vector_;
+    size_t offset_;
+    size_t nextOffset_;
+    Node* next_;
+    bool atTail_; // true when next_ is the tail
+    uint8_t depth_;
+    Node* path_[13]; // 13 levels of 5 bits each covers a 64-bit index
+    uint8_t index_[13];
+  };
+
+  // Writes the receiver to the file at *path* in a format which can be mapped into
+  // memory by mapFile. Nodes shared within the vector are written once. Returns false
+  // and sets errno on failure. Values are written as they are, so this is only useful
+  // for vectors of plain values like Ints and Floats: values which point to memory,
+  // like TextS, DataS or other objects, point to garbage once the file is mapped.
+  bool writeFile(const char* path) const;
+
+  // Maps a file written by writeFile into memory and returns it as a read-only,
+  // Unretainable vector, or returns 0 and sets errno on failure. Pages of the file are
+  // read as they are first touched, so this takes constant time unless the address
+  // the file was written for is taken, in which case all nodes are relocated first.
+  // Relocation checks each node and fails with EINVAL if the file is corrupt, but a
+  // file mapped at its preferred address is used unchecked, so only map files written
+  // by writeFile. Vectors derived from the mapped vector share its nodes, so they must
+  // be released before calling unmapFile.
+  static Vector* mapFile(const char* path);
+  static void unmapFile(Vector* v);
+
+  // Calls fn(void* const* values, size_t count) for each leaf of the receiver, in order
+  template <typename F>
+  void forEachChunk(F fn) const {
+    ChunkIterator it(this);
+    void* const* values;
+    while (size_t n = it.next(values)) {
+      fn(values, n);
+    }
+  }
+
+  // -- Searching and aggregating --
+  // These treat the values of the receiver as Ints (int64_t) or Floats (double) stored
+  // in place of the pointers and scan the leaves with the SIMD kernels of simd.h.
+  // Min and max throw std::out_of_range for the empty vector.
+
+  static const size_t NotFound = SIZE_MAX;
+
+  // Index of the first value identical to *value*, or NotFound
+  size_t find(void* value) const {
+    ChunkIterator it(this);
+    void* const* values;
+    while (size_t n = it.next(values)) {
+      size_t i = simd().findInt((const int64_t*)values, n, (int64_t)value);
+      if (i != n) return it.offset() + i;
+    }
+    return NotFound;
+  }
+
+  // Index of the first Float equal to *value*, or NotFound
+  size_t findFloat(double value) const {
+    ChunkIterator it(this);
+    void* const* values;
+    while (size_t n = it.next(values)) {
+      size_t i = simd().findFloat((const double*)values, n, value);
+      if (i != n) return it.offset() + i;
+    }
+    return NotFound;
+  }
+
+  // Number of values identical to *value*
+  size_t countOf(void* value) const {
+    size_t count = 0;
+    forEachChunk([&](void* const* values, size_t n) {
+      count += simd().countInt((const int64_t*)values, n, (int64_t)value);
+    });
+    return count;
+  }
+
+  // Number of Floats equal to *value*
+  size_t countOfFloat(double value) const {
+    size_t count = 0;
+    forEachChunk([&](void* const* values, size_t n) {
+      count += simd().countFloat((const double*)values, n, value);
+    });
+    return count;
+  }
+
+  // Sum of the Ints, wrapping around on overflow
+  int64_t sumInt() const {
+    uint64_t sum = 0;
+    forEachChunk([&](void* const* values, size_t n) {
+      sum += (uint64_t)simd().sumInt((const int64_t*)values, n);
+    });
+    return (int64_t)sum;
+  }
+
+  double sumFloat() const {
+    double sum = 0;
+    forEachChunk([&](void* const* values, size_t n) {
+      sum += simd().sumFloat((const double*)values, n);
+    });
+    return sum;
+  }
+
+  int64_t minInt() const throw(std::out_of_range) {
+    return reduceLeaves<int64_t>(simd().minInt, "min of the empty vector");
+  }
+  int64_t maxInt() const throw(std::out_of_range) {
+    return reduceLeaves<int64_t>(simd().maxInt, "max of the empty vector");
+  }
+
+  // NaN if any value is NaN
+  double minFloat() const throw(std::out_of_range) {
+    return reduceLeaves<double>(simd().minFloat, "min of the empty vector");
+  }
+  double maxFloat() const throw(std::out_of_range) {
+    return reduceLeaves<double>(simd().maxFloat, "max of the empty vector");
+  }
+
+  // Returns a new vector with the values of the receiver sorted in ascending order as
+  // Ints or Floats, which the values must be rather than objects. The values are copied
+  // into a buffer, sorted there in parallel on *pool* (see sort.h) and built into a new
+  // trie in one go.
+  Vector* sortedInt(ThreadPool& pool = ThreadPool::shared()) const {
+    std::vector<void*> values(count_);
+    copyValues(values.data());
+    sort_ints((int64_t*)values.data(), count_, pool);
+    return create(values.data(), count_);
+  }
+  Vector* sortedFloat(ThreadPool& pool = ThreadPool::shared()) const {
+    std::vector<void*> values(count_);
+    copyValues(values.data());
+    sort_floats((double*)values.data(), count_, pool);
+    return create(values.data(), count_);
+  }
+
+  // Reduces the values of the receiver in parallel on *pool*. reduceChunk(V* const*
+  // values, size_t n) reduces a run of consecutive values to an R, and combine(R a,
+  // R b) merges the results of two adjacent runs, a holding the values before b.
+  // Subtrees are reduced as separate tasks, so combine must be associative (but
+  // needn't be commutative). R must be default-constructible.
+  //
+  //   int64_t sum = v->parallelReduce((int64_t)0,
+  //     [](void* const* values, size_t n) { ... return partialSum; },
+  //     [](int64_t a, int64_t b) { return a + b; });
+  //
+  template <typename R, typename ChunkF, typename CombineF>
+  R parallelReduce(R init, ChunkF reduceChunk, CombineF combine,
+                   ThreadPool& pool = ThreadPool::shared()) const {
+    R result = init;
+    if (root_->length != 0) {
+      result = combine(result, reduceSubTree<R>(shift_, root_, reduceChunk, combine, pool));
+    }
+    if (tailLength_ != 0) {
+      result = combine(result, reduceChunk((void* const*)tail_->data, (size_t)tailLength_));
+    }
+    return result;
+  }
+
+  // Returns a new vector with fn(value) for each value of the receiver, computed in
+  // parallel on *pool*. The new trie has the same shape as the receiver's and each of
+  // its nodes is written exactly once, by the task that maps that subtree.
+  template <typename F>
+  Vector* parallelMap(F fn, ThreadPool& pool = ThreadPool::shared()) const {
+    if (count_ == 0) return Empty;
+    Node* root = (root_->length == 0) ? Node::Empty : mapSubTree(shift_, root_, fn, pool);
+    Node* tail = mapLeaf(*tail_, tailLength_, fn);
+    return create(count_, shift_, root, TransferReference, tail, TransferReference);
+  }
+
+  // A transient is a mutable builder for vectors. It starts out as a vector and
+  // can then be appended to in place, finally producing a new persistent vector in
+  // constant time by calling persistent():
+  //
+  //   Vector::Transient t(Vector::Empty);
+  //   for (...) t.append(value);
+  //   Vector* v = t.persistent();
+  //
+  // Nodes are modified in place only when the transient holds the sole reference to
+  // them. Nodes shared with some other vector (like the one the transient was created
+  // from, or one returned by persistent()) are copied the first time they are touched,
+  // so the transient can safely keep being used after a call to persistent().
+  //
+  // A transient must only be used by one thread at a time.
+  class Transient {
+  public:
+    explicit Transient(const Vector* v = Vector::Empty)
+        : count_(v->count_), shift_(v->shift_), tailLength_(v->tailLength_)
+        , root_(v->root_->retain()), tail_(v->tail_ ? v->retainedTail() : 0) {}
+
+    ~Transient() {
+      root_->release();
+      if (tail_) tail_->release();
+    }
+
+    // Number of items contained by the receiver
+    size_t count() const { return count_; }
+
+    // Adds val to the end of the receiver. Returns *this.
+    Transient& append(void* val) {
+      if (tailLength_ < 32) {
+        Node* tail = editableTail();
+        tail->setValue(tailLength_++, val);
+        tail->length = tailLength_;
+        ++count_;
+        return *this;
+      }
+
+      // Full tail -- push into tree. The tree takes over our reference to the tail.
+      Node* tailnode = tail_;
+      tail_ = Node::createTail(0, 0, val);
+      tailLength_ = 1;
+
+      // Overflow root?
+      if (root_->isRelaxed()) {
+        // Relaxed tries are updated by path copying, like persistent vectors are
+        Node* newroot = Vector::pushLeaf(root_, tailnode, shift_);
+        root_->release();
+        tailnode->release();
+        root_ = newroot;
+      } else if ((count_ >> 5) > ((size_t)1 << shift_)) {
+        Node* newroot = Node::create(2, 32);
+        newroot->setNode(0, root_, TransferReference);
+        newroot->setNode(1, newPath(shift_, tailnode), TransferReference);
+        root_ = newroot;
+        shift_ += 5;
+      } else {
+        pushTail(shift_, editableRoot(), tailnode);
+      }
+
+      ++count_;
+      return *this;
+    }
+
+    // Returns a persistent vector with the current contents of the receiver
+    Vector* persistent() const {
+      if (count_ == 0) return Vector::Empty;
+      return Vector::create(count_, shift_, root_,RetainReference,
+                            tail_,RetainReference, tailLength_);
+    }
+
+  private:
+    friend class Vector;
+    Transient(const Transient&);
+    Transient& operator=(const Transient&);
+
+    // Exchanges the contents of the receiver and v, references included
+    void swapContents(Vector* v) {
+      std::swap(count_, v->count_);
+      std::swap(shift_, v->shift_);
+      std::swap(root_, v->root_);
+      std::swap(tail_, v->tail_);
+      std::swap(tailLength_, v->tailLength_);
+    }
+
+    // True if node can be modified in place by the receiver
+    static inline bool isEditable(const Node* node) {
+      return node->isUniquelyReferenced() && node->capacity == 32;
+    }
+
+    // Returns the tail, replacing it with an editable copy if needed. The tail is
+    // appendable, so that vectors made by persistent() may append to it once the
+    // receiver has moved on to another tail.
+    Node* editableTail() {
+      if (tail_ == 0) {
+        tail_ = Node::create(0, 32);
+      } else if (!isEditable(tail_)) {
+        Node* tail = Node::create(*tail_, tailLength_, 32);
+        tail_->release();
+        tail_ = tail;
+      }
+      tail_->flags |= Node::Appendable;
+      tail_->hashCache = 0; // about to be modified
+      return tail_;
+    }
+
+    Node* editableRoot() {
+      if (!isEditable(root_)) {
+        Node* root = Node::create(*root_, root_->length, 32);
+        root_->release();
+        root_ = root;
+      }
+      root_->hashCache = 0;
+      return root_;
+    }
+
+    // Returns the child at index i of the editable node parent, replacing it with an
+    // editable copy if needed.
+    static Node* editableChild(Node* parent, uint8_t i) {
+      Node* child = parent->getNode(i);
+      if (!isEditable(child)) {
+        child = Node::create(*child, child->length, 32);
+        parent->setNode(i, child, TransferReference);
+      }
+      child->hashCache = 0;
+      return child;
+    }
+
+    // Inserts tailnode into the editable node parent, transferring ownership of
+    // tailnode to the tree.
+    void pushTail(uint32_t level, Node* parent, Node* tailnode) {
+      uint8_t subidx = ((count_ - 1) >> level) & 0x1f;
+      if (level != 5 && subidx < parent->length) {
+        pushTail(level - 5, editableChild(parent, subidx), tailnode);
+        return;
+      }
+      assert(subidx == parent->length);
+      ++parent->length;
+      parent->setNode(subidx, (level == 5) ? tailnode : newPath(level - 5, tailnode),
+                      TransferReference);
+    }
+
+    // Creates a new path of editable nodes, ending in node. Ownership of node is
+    // transferred to the path. Returns a node with a +1 refcount.
+    static Node* newPath(uint32_t level, Node* node) {
+      if (level == 0) return node;
+      Node* newnode = Node::create(1, 32);
+      newnode->setNode(0, newPath(level - 5, node), TransferReference);
+      return newnode;
+    }
+
+    size_t count_;
+    uint32_t shift_;
+    uint32_t tailLength_; // number of items in tail_ used by the receiver
+    Node* root_;
+    Node* tail_;
+  };
+
 protected:
 
   // Used for the empty vector ::Empty
-  Vector() : refcount_(Unretainable), count_(0), shift_(5), root_(Node::Empty), tail_(0) {}
+  Vector() : refcount_(Unretainable), count_(0), shift_(5), tailLength_(0), root_(Node::Empty), tail_(0) {}
   
   static Vector* create(size_t count, uint32_t shift,
                         Node* root, RefRule root_refrule,
                         Node* tail, RefRule tail_refrule ) {
-    DEBUG_LIVECOUNT_Vector_INC
-    Vector* v = __alloc(sizeof(Vector));
+    return create(count, shift, root, root_refrule, tail, tail_refrule, tail->length);
+  }
+
+  // Creates a vector using the first *tailLength* values of tail. Must be used when
+  // tail is shared with other vectors, since they might have claimed more of it.
+  static Vector* create(size_t count, uint32_t shift,
+                        Node* root, RefRule root_refrule,
+                        Node* tail, RefRule tail_refrule, uint32_t tailLength) {
+    if (count <= SmallMax && root->length == 0) {
+      assert(tailLength == count);
+      Vector* v = createSmall(count);
+      memcpy(v->tail_->data, tail->data, sizeof(void*) * count);
+      if (root_refrule == TransferReference) root->release();
+      if (tail_refrule == TransferReference) tail->release();
+      return v;
+    }
+    Vector* v = __alloc();
     v->count_ = count;
     v->shift_ = shift;
     v->root_ = (root_refrule == TransferReference) ? root : root->retain();
     v->tail_ = (tail_refrule == TransferReference) ? tail : tail->retain();
+    v->tailLength_ = tailLength;
     assert(v->shift_ % 5 == 0);
     return v;
   }
   
+  // Creates a small vector of *count* values, which the caller must fill in
+  static Vector* createSmall(size_t count) {
+    assert(count <= SmallMax);
+    Vector* v = __alloc(sizeof(Vector) + Node::allocsize((uint8_t)count, false));
+    v->count_ = count;
+    v->shift_ = 5;
+    v->tailLength_ = (uint32_t)count;
+    v->root_ = Node::Empty;
+    Node* tail = v->tail_ = v->embeddedTail();
+    memset((void*)tail, 0, sizeof(Node));
+    tail->refcount_ = Unretainable;
+    tail->length = tail->capacity = (uint8_t)count;
+    return v;
+  }
+
+  // Where the tail of a small vector is
+  inline Node* embeddedTail() const {
+    return (Node*)((uint8_t*)this + sizeof(Vector));
+  }
+
+  // The tail of a larger vector might be allocated right after the vector, but such a
+  // tail is never Unretainable
+  inline bool isSmall() const {
+    return tail_ == embeddedTail() &&
+           __atomic_load_n(&tail_->refcount_, __ATOMIC_RELAXED) == Unretainable;
+  }
+
+  inline size_t allocsize() const {
+    return isSmall() ? sizeof(Vector) + tail_->allocsize() : sizeof(Vector);
+  }
+
+  // Returns a reference to a tail holding the receiver's values, which may be put in
+  // another vector: the tail itself, or a copy of it if it's the tail of a small vector
+  Node* retainedTail() const {
+    return isSmall() ? Node::create(*tail_, tailLength_) : tail_->retain();
+  }
+
   void dealloc() {
-    DEBUG_LIVECOUNT_Vector_DEC
     if (root_) root_->release();
     if (tail_) tail_->release();
   }
@@ -256,29 +1123,254 @@ protected:
 
   // Offset of tail (the start of tail relative to count)
   inline size_t tailoff() const {
-    if (tail_ == 0 || count_ < 32)
-      return 0;
-    return ((count_ - 1) >> 5) << 5;
+    return count_ - tailLength_;
   }
   
-  // Finds the node for index i
-  const Node& nodeFor(size_t i) const throw(std::out_of_range) {
+  // Finds the leaf for index i, and makes i relative to that leaf
+  const Node& nodeFor(size_t& i) const throw(std::out_of_range) {
     if (i >= count_)
       throw std::out_of_range("index out of range");
 
     // i is in tail?
-    if (i >= tailoff())
+    if (i >= tailoff()) {
+      i -= tailoff();
       return *tail_;
+    }
 
+    // Relaxed branches are only found above other relaxed branches, so once we reach
+    // a regular branch we can use plain radix indexing all the way down.
     Node* node = root_;
-    for (uint32_t level = shift_; level > 0; level -= 5) {
+    uint32_t level = shift_;
+    while (node->isRelaxed()) {
+      node = node->getNode(node->childIndex(i, level));
+      level -= 5;
+    }
+    for (; level > 0; level -= 5) {
       node = node->getNode( (i >> level) & 0x1f );
     }
     
     assert(node != 0);
+    i &= 0x1f;
     return *node;
   }
   
+  // Node of the trie at *level* whose first value is at index i, or 0 if there's none
+  const Node* nodeAt(uint32_t level, size_t i) const {
+    if (level > shift_ || i >= tailoff()) return 0;
+    const Node* node = root_;
+    for (uint32_t l = shift_; l > level; l -= 5) {
+      node = node->getNode(node->childIndex(i, l));
+    }
+    return (i == 0) ? node : 0;
+  }
+
+  // Calls report(start, end) for runs of indices at which the receiver and other hold
+  // different values, in order, until report returns false. Returns false if stopped.
+  template <typename F>
+  bool compare(const Vector* other, F report) const {
+    if (root_->length != 0 && !compareSubTree(shift_, root_, 0, other, report)) {
+      return false;
+    }
+    if (count_ != 0 && !compareValues(tailoff(), tail_->data, tailLength_, other, report)) {
+      return false;
+    }
+    return other->count_ <= count_ || report(count_, other->count_);
+  }
+
+  // Compares the subtree of node at level, which starts at index start, with other.
+  // Nothing is compared if other has the very same node at the same position.
+  template <typename F>
+  static bool compareSubTree(uint32_t level, const Node* node, size_t start,
+                             const Vector* other, F& report) {
+    if (other->nodeAt(level, start) == node) return true;
+    if (level == 0) return compareValues(start, node->data, node->length, other, report);
+    for (uint8_t i = 0; i < node->length; ++i) {
+      const Node* child = node->getNode(i);
+      if (!compareSubTree(level - 5, child, start, other, report)) return false;
+      start += child->count(level - 5);
+    }
+    return true;
+  }
+
+  // Compares the n values starting at index start with other, one leaf of other at a
+  // time
+  template <typename F>
+  static bool compareValues(size_t start, void* const* values, size_t n,
+                            const Vector* other, F& report) {
+    size_t i = 0;
+    while (i < n) {
+      size_t index = start + i;
+      if (index >= other->count_) return report(index, start + n);
+      size_t j = index;
+      const Node& leaf = other->nodeFor(j);
+      size_t length = (index >= other->tailoff()) ? other->tailLength_ : leaf.length;
+      size_t m = std::min(length - j, n - i);
+      for (size_t k = 0; k < m; ++k) {
+        if (values[i + k] == leaf.data[j + k]) continue;
+        size_t e = k + 1;
+        while (e < m && values[i + e] != leaf.data[j + e]) ++e;
+        if (!report(index + k, index + e)) return false;
+        k = e;
+      }
+      i += m;
+    }
+    return true;
+  }
+
+  // -- Hashing --
+  //
+  // A run of values v1..vn hashes to mix(v1)*B^(n-1) + ... + mix(vn) modulo the
+  // Mersenne prime 2^61-1. The hash of a run a followed by a run b can thus be
+  // computed from the hashes of a and b as hash(a) * B^count(b) + hash(b), which is
+  // what makes the hash independent of the shape of a trie.
+
+  static const uint64_t HashPrime = ((uint64_t)1 << 61) - 1;
+  static const uint64_t HashBase = 0x1a2b3c4d5e6f789ULL; // < HashPrime
+  static const uint64_t HashKnown = (uint64_t)1 << 63; // set in Node::hashCache
+
+  static inline uint64_t hashReduce(uint64_t x) {
+    x = (x & HashPrime) + (x >> 61);
+    return (x >= HashPrime) ? x - HashPrime : x;
+  }
+
+  static inline uint64_t hashMul(uint64_t a, uint64_t b) {
+    __uint128_t p = (__uint128_t)a * b;
+    uint64_t x = ((uint64_t)p & HashPrime) + (uint64_t)(p >> 61);
+    return (x >= HashPrime) ? x - HashPrime : x;
+  }
+
+  static inline uint64_t hashAdd(uint64_t a, uint64_t b) {
+    uint64_t x = a + b;
+    return (x >= HashPrime) ? x - HashPrime : x;
+  }
+
+  // HashBase^n
+  static uint64_t hashPow(size_t n) {
+    uint64_t result = 1, base = HashBase;
+    for (; n != 0; n >>= 1) {
+      if (n & 1) result = hashMul(result, base);
+      base = hashMul(base, base);
+    }
+    return result;
+  }
+
+  // MurmurHash3's finalizer, which spreads the bits of a value over the whole word
+  static inline uint64_t hashMix(void* value) {
+    uint64_t h = (uint64_t)value;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return hashReduce(h);
+  }
+
+  // Hash of the values hashed into h followed by the n values in values
+  static uint64_t hashValues(uint64_t h, void* const* values, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      h = hashAdd(hashMul(h, HashBase), hashMix(values[i]));
+    }
+    return h;
+  }
+
+  // Hash of the values hashed into a followed by the n values hashed into b
+  static inline uint64_t hashConcat(uint64_t a, uint64_t b, size_t n) {
+    return hashAdd(hashMul(a, hashPow(n)), b);
+  }
+
+  // Copies the values of the receiver to dst, in order
+  void copyValues(void** dst) const {
+    forEachChunk([&](void* const* values, size_t n) {
+      memcpy(dst, values, sizeof(void*) * n);
+      dst += n;
+    });
+  }
+
+  // Applies a min or max kernel to each leaf and then to the results of two leaves at
+  // a time, so Float NaNs carry over from one leaf to the next
+  template <typename T>
+  T reduceLeaves(T (*kernel)(const T*, size_t), const char* emptyError) const {
+    if (count_ == 0) throw std::out_of_range(emptyError);
+    T results[2];
+    bool first = true;
+    forEachChunk([&](void* const* values, size_t n) {
+      results[1] = kernel((const T*)values, n);
+      results[0] = first ? results[1] : kernel(results, 2);
+      first = false;
+    });
+    return results[0];
+  }
+
+  // Subtrees holding at most this many values are processed by a single task
+  static const size_t ParallelGrain = 4096;
+
+  template <typename R, typename ChunkF, typename CombineF>
+  static R reduceSubTree(uint32_t level, const Node* node, ChunkF& reduceChunk,
+                         CombineF& combine, ThreadPool& pool) {
+    if (level == 0) {
+      return reduceChunk((void* const*)node->data, (size_t)node->length);
+    }
+    if (node->count(level) <= ParallelGrain) {
+      R result = reduceSubTree<R>(level - 5, node->getNode(0), reduceChunk, combine, pool);
+      for (uint8_t i = 1; i < node->length; ++i) {
+        result = combine(result,
+          reduceSubTree<R>(level - 5, node->getNode(i), reduceChunk, combine, pool));
+      }
+      return result;
+    }
+    // The first child is reduced by the calling thread
+    R results[32];
+    ThreadPool::TaskGroup group(pool);
+    for (uint8_t i = 1; i < node->length; ++i) {
+      group.spawn([&, i]() {
+        results[i] = reduceSubTree<R>(level - 5, node->getNode(i), reduceChunk, combine, pool);
+      });
+    }
+    R result = reduceSubTree<R>(level - 5, node->getNode(0), reduceChunk, combine, pool);
+    group.wait();
+    for (uint8_t i = 1; i < node->length; ++i) {
+      result = combine(result, results[i]);
+    }
+    return result;
+  }
+
+  // Leaf with fn applied to the first *length* values of leaf. Returns a node with a
+  // +1 refcount.
+  template <typename F>
+  static Node* mapLeaf(const Node& leaf, uint8_t length, F& fn) {
+    Node* node = Node::create(length);
+    for (uint8_t i = 0; i < length; ++i) {
+      node->setValue(i, fn(leaf.getValue(i)));
+    }
+    return node;
+  }
+
+  // Copy of node with fn applied to its values. Returns a node with a +1 refcount.
+  template <typename F>
+  static Node* mapSubTree(uint32_t level, const Node* node, F& fn, ThreadPool& pool) {
+    if (level == 0) return mapLeaf(*node, node->length, fn);
+    Node* copy = Node::createShape(*node);
+    Node** children = (Node**)copy->data;
+    if (node->count(level) <= ParallelGrain) {
+      for (uint8_t i = 0; i < node->length; ++i) {
+        children[i] = mapSubTree(level - 5, node->getNode(i), fn, pool);
+      }
+    } else {
+      ThreadPool::TaskGroup group(pool);
+      for (uint8_t i = 1; i < node->length; ++i) {
+        group.spawn([&, i]() {
+          children[i] = mapSubTree(level - 5, node->getNode(i), fn, pool);
+        });
+      }
+      children[0] = mapSubTree(level - 5, node->getNode(0), fn, pool);
+      group.wait();
+    }
+    for (uint8_t i = 0; i < node->length; ++i) {
+      copy->objectBitset[i] = true;
+    }
+    return copy;
+  }
+
   // Create a new tail. Returns a node with a +1 refcount.
   Node* pushTail(size_t level, Node* parent, Node* tailnode) const {
     //if parent is leaf, insert node,
@@ -303,11 +1395,9 @@ protected:
     
     Node* node;
     if (parent != 0 && parent->length) {
-      if (parent->length <= subidx) {
-        node = Node::create(*parent, subidx+1);
-      } else {
-        node = parent->retain();
-      }
+      // Copy the parent even when it already has room, as it might be shared with
+      // other vectors (or other threads) and so must never be modified.
+      node = Node::create(*parent, std::max((size_t)parent->length, subidx+1));
     } else {
       node = Node::create(subidx+1);
     }
@@ -320,6 +1410,36 @@ protected:
     return node;
   }
   
+  // Copy of node with i set to val. Returns a node with a +1 refcount.
+  static Node* doAssoc(uint32_t level, Node* node, size_t i, void* val) {
+    Node* ret = Node::create(*node, node->length);
+    if (level == 0) {
+      ret->setValue(i, val);
+    } else {
+      uint8_t subidx = node->childIndex(i, level);
+      ret->setNode(subidx, doAssoc(level - 5, node->getNode(subidx), i, val), TransferReference);
+    }
+    return ret;
+  }
+
+  // Copy of node without its last leaf. Returns a node with a +1 refcount, or 0 if
+  // the resulting node would be empty.
+  Node* popTail(uint32_t level, Node* node) const {
+    uint8_t subidx = ((count_ - 2) >> level) & 0x1f;
+    if (level > 5) {
+      Node* newchild = popTail(level - 5, node->getNode(subidx));
+      if (newchild == 0 && subidx == 0) {
+        return 0;
+      }
+      Node* ret = Node::create(*node, newchild ? subidx + 1 : subidx);
+      if (newchild) ret->setNode(subidx, newchild, TransferReference);
+      return ret;
+    } else if (subidx == 0) {
+      return 0;
+    }
+    return Node::create(*node, subidx);
+  }
+
   // Create a new path. Returns a node with a +1 refcount.
   Node* newPath(uint32_t level, Node* node) const {
     if (level == 0) {
@@ -333,9 +1453,233 @@ protected:
     return newnode;
   }
 
+  // -- Relaxed tries --
+  //
+  // The following functions work on both regular and relaxed tries, as described by
+  // Bagwell and Rompf in "RRB-Trees: Efficient Immutable Vectors". Tries are rebuilt
+  // with Node::createBranch, which decides whether each new branch is relaxed.
+
+  // Copy of the trie *root* at level *shift* with *leaf* added as its last leaf. If the
+  // trie overflows, a new root is added and shift is updated. Returns a node with a +1
+  // refcount.
+  static Node* pushLeaf(Node* root, Node* leaf, uint32_t& shift) {
+    Node* newroot = pushLeaf(shift, root, leaf);
+    if (newroot == 0) {
+      Node* children[2] = { root, newBranchPath(shift, leaf) };
+      newroot = Node::createBranch(children, 2, shift + 5, RetainReference);
+      children[1]->release();
+      shift += 5;
+    }
+    return newroot;
+  }
+
+  // Copy of the branch node at level with leaf added as its last leaf. Returns a node
+  // with a +1 refcount, or 0 if there's no room for leaf in node.
+  static Node* pushLeaf(uint32_t level, Node* node, Node* leaf) {
+    Node* children[32];
+    uint8_t length = node->length;
+    for (uint8_t i = 0; i < length; ++i) {
+      children[i] = node->getNode(i);
+    }
+    Node* child = 0;
+    if (level > 5 && length != 0) {
+      child = pushLeaf(level - 5, children[length - 1], leaf);
+      if (child) children[length - 1] = child;
+    }
+    if (child == 0) {
+      if (length == 32) return 0;
+      child = newBranchPath(level - 5, leaf);
+      children[length++] = child;
+    }
+    Node* ret = Node::createBranch(children, length, level, RetainReference);
+    child->release();
+    return ret;
+  }
+
+  // Path of branches from level down to leaf. Returns a node with a +1 refcount.
+  static Node* newBranchPath(uint32_t level, Node* leaf) {
+    if (level == 0) return leaf->retain();
+    Node* child = newBranchPath(level - 5, leaf);
+    return Node::createBranch(&child, 1, level, TransferReference);
+  }
+
+  // Copy of node at level holding only the values before index end. Returns a node
+  // with a +1 refcount.
+  static Node* sliceRight(uint32_t level, Node* node, size_t end) {
+    if (level == 0) {
+      return (end == node->length) ? node->retain() : Node::create(*node, end);
+    }
+    size_t i = end - 1;
+    uint8_t idx = node->childIndex(i, level);
+    Node* child = sliceRight(level - 5, node->getNode(idx), i + 1);
+    if (child == node->getNode(idx) && idx + 1 == node->length) {
+      child->release();
+      return node->retain();
+    }
+    Node* children[32];
+    for (uint8_t j = 0; j < idx; ++j) {
+      children[j] = node->getNode(j);
+    }
+    children[idx] = child;
+    Node* ret = Node::createBranch(children, idx + 1, level, RetainReference);
+    child->release();
+    return ret;
+  }
+
+  // Copy of node at level holding only the values from index start and on. Returns a
+  // node with a +1 refcount.
+  static Node* sliceLeft(uint32_t level, Node* node, size_t start) {
+    if (start == 0) return node->retain();
+    if (level == 0) {
+      return Node::createLeaf(node->data + start, node->length - start);
+    }
+    size_t i = start;
+    uint8_t idx = node->childIndex(i, level);
+    Node* children[32];
+    Node* child = children[0] = sliceLeft(level - 5, node->getNode(idx), i);
+    uint8_t length = 1;
+    for (uint8_t j = idx + 1; j < node->length; ++j) {
+      children[length++] = node->getNode(j);
+    }
+    Node* ret = Node::createBranch(children, length, level, RetainReference);
+    child->release();
+    return ret;
+  }
+
+  // Copy of node at level without its last leaf, which is returned in leaf with a +1
+  // refcount. Returns a node with a +1 refcount, or 0 if the resulting node would be
+  // empty.
+  static Node* popLeaf(uint32_t level, Node* node, Node*& leaf) {
+    Node* children[32];
+    uint8_t length = node->length - 1;
+    for (uint8_t i = 0; i < length; ++i) {
+      children[i] = node->getNode(i);
+    }
+    Node* child = 0;
+    if (level == 5) {
+      leaf = node->getNode(length)->retain();
+    } else {
+      child = popLeaf(level - 5, node->getNode(length), leaf);
+      if (child) children[length++] = child;
+    }
+    if (length == 0) return 0;
+    Node* ret = Node::createBranch(children, length, level, RetainReference);
+    if (child) child->release();
+    return ret;
+  }
+
+  // Removes any single-child branches from the top of a trie. Takes over the
+  // reference to root and returns the new root with a +1 refcount.
+  static Node* collapse(Node* root, uint32_t& shift) {
+    while (shift > 5 && root->length == 1) {
+      Node* child = root->getNode(0)->retain();
+      root->release();
+      root = child;
+      shift -= 5;
+    }
+    return root;
+  }
+
+  // Joins the trie left at level leftLevel with the trie right at level rightLevel.
+  // Returns a node one level above the higher of the two, with a +1 refcount.
+  static Node* concatSubTree(Node* left, uint32_t leftLevel, Node* right, uint32_t rightLevel) {
+    if (leftLevel > rightLevel) {
+      Node* centre = concatSubTree(left->getNode(left->length - 1), leftLevel - 5,
+                                   right, rightLevel);
+      return rebalance(left, centre, 0, leftLevel);
+    } else if (leftLevel < rightLevel) {
+      Node* centre = concatSubTree(left, leftLevel, right->getNode(0), rightLevel - 5);
+      return rebalance(0, centre, right, rightLevel);
+    } else if (leftLevel == 0) {
+      Node* children[2] = { left, right };
+      return Node::createBranch(children, 2, 5, RetainReference);
+    }
+    Node* centre = concatSubTree(left->getNode(left->length - 1), leftLevel - 5,
+                                 right->getNode(0), rightLevel - 5);
+    return rebalance(left, centre, right, leftLevel);
+  }
+
+  // Merges the children of left (but its last), centre and right (but its first), all
+  // at level, redistributing their contents so that the search step invariant holds:
+  // the merged nodes may use at most two more slots than what is optimal. Takes over
+  // the reference to centre. Returns a node one level above level, with a +1 refcount.
+  static Node* rebalance(Node* left, Node* centre, Node* right, uint32_t level) {
+    Node* all[96];
+    size_t count = 0;
+    if (left) for (uint8_t i = 0; i + 1 < left->length; ++i) all[count++] = left->getNode(i);
+    for (uint8_t i = 0; i < centre->length; ++i) all[count++] = centre->getNode(i);
+    if (right) for (uint8_t i = 1; i < right->length; ++i) all[count++] = right->getNode(i);
+
+    // Plan the length of each merged node
+    size_t plan[96];
+    size_t total = 0;
+    for (size_t i = 0; i < count; ++i) {
+      plan[i] = all[i]->length;
+      total += plan[i];
+    }
+    size_t optimal = ((total - 1) >> 5) + 1;
+    size_t planLength = count;
+    size_t i = 0;
+    while (optimal + 2 < planLength) {
+      // Skip nodes which are full enough, then spread the short node found over the
+      // nodes following it.
+      while (plan[i] > 31) ++i;
+      size_t remaining = plan[i];
+      do {
+        size_t n = std::min(remaining + plan[i + 1], (size_t)32);
+        remaining = remaining + plan[i + 1] - n;
+        plan[i++] = n;
+      } while (remaining > 0);
+      for (size_t j = i; j + 1 < planLength; ++j) {
+        plan[j] = plan[j + 1];
+      }
+      --planLength;
+      --i;
+    }
+
+    // Execute the plan
+    Node* merged[96];
+    size_t src = 0, offset = 0;
+    for (size_t k = 0; k < planLength; ++k) {
+      size_t length = plan[k];
+      if (offset == 0 && all[src]->length == length) {
+        merged[k] = all[src++]->retain();
+        continue;
+      }
+      void* items[32];
+      size_t n = 0;
+      while (n < length) {
+        const Node* node = all[src];
+        size_t take = std::min(length - n, (size_t)(node->length - offset));
+        memcpy(items + n, node->data + offset, sizeof(void*) * take);
+        n += take;
+        offset += take;
+        if (offset == node->length) {
+          ++src;
+          offset = 0;
+        }
+      }
+      merged[k] = (level == 5) ? Node::createLeaf(items, length)
+                               : Node::createBranch((Node**)items, length, level - 5, RetainReference);
+    }
+
+    Node* nodes[2];
+    uint8_t length = 1;
+    if (planLength <= 32) {
+      nodes[0] = Node::createBranch(merged, planLength, level, TransferReference);
+    } else {
+      nodes[0] = Node::createBranch(merged, 32, level, TransferReference);
+      nodes[1] = Node::createBranch(merged + 32, planLength - 32, level, TransferReference);
+      length = 2;
+    }
+    centre->release();
+    return Node::createBranch(nodes, length, level + 5, TransferReference);
+  }
+
 private:
   size_t count_; // number of items in this vector
   uint32_t shift_;
+  uint32_t tailLength_; // number of items in tail_
   Node* root_;
   Node* tail_;
   
@@ -0,0 +1,41 @@
+// Copyright (c) 2012, Rasmus Andersson. All rights reserved. Use of this source
+// code is governed by a MIT-style license that can be found in the LICENSE file.
+//
+// Locale-free formatting of numbers, used by stdout_write to format values straight
+// into its output buffer.
+//
+// Each function writes to *buf*, which must have room for the longest result as given
+// by the matching constant, and returns the number of bytes written. No terminating
+// NUL is written.
+//
+// Floats are written with the fewest digits which parse back to the same value, found
+// with the Ryu algorithm (Ulf Adams, "Ryū: fast float-to-string conversion", PLDI
+// 2018). Values whose decimal exponent is in [-4, 16) are written in positional
+// notation with at least one fractional digit, like 2.0 or 0.0001, and others in
+// scientific notation, like 1e+16 or 1.5e-07. Infinities are written as inf and -inf,
+// and NaN as nan.
+//
+#ifndef _HUE_RUNTIME_FORMAT_INCLUDED
+#define _HUE_RUNTIME_FORMAT_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace hue {
+
+static const size_t FormatIntMax = 20;   // -9223372036854775808
+static const size_t FormatHexMax = 16;   // ffffffffffffffff
+static const size_t FormatFloatMax = 24; // -2.2250738585072014e-308
+
+// Decimal, with a leading minus sign for negative values
+size_t format_int(char* buf, int64_t value);
+size_t format_uint(char* buf, uint64_t value);
+
+// Lowercase hexadecimal without leading zeros or prefix, like ff
+size_t format_hex(char* buf, uint64_t value);
+
+// Shortest representation which parses back to *value*
+size_t format_float(char* buf, double value);
+
+} // namespace hue
+#endif // _HUE_RUNTIME_FORMAT_INCLUDED
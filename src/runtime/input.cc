@@ -0,0 +1,120 @@
+// Copyright (c) 2012, Rasmus Andersson. All rights reserved. Use of this source
+// code is governed by a MIT-style license that can be found in the LICENSE file.
+#include "runtime.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace hue {
+
+// -- Mapped files --
+//
+// The length of the data is stored at the end of an anonymous page mapped right
+// before the pages of the file, so that the file's contents directly follow it as
+// DataS requires.
+
+static DataS_ EmptyData; // length 0
+
+static size_t pageSize() {
+  static const size_t size = (size_t)sysconf(_SC_PAGESIZE);
+  return size;
+}
+
+DataS file_map(const char* path) {
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) return 0;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    int e = errno;
+    close(fd);
+    errno = e;
+    return 0;
+  }
+  if (!S_ISREG(st.st_mode)) {
+    close(fd);
+    errno = S_ISDIR(st.st_mode) ? EISDIR : ENODEV;
+    return 0;
+  }
+  if (st.st_size == 0) {
+    close(fd);
+    return &EmptyData;
+  }
+
+  const size_t page = pageSize();
+  const size_t size = (size_t)st.st_size;
+  uint8_t* p = (uint8_t*)mmap(0, page + size, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p != MAP_FAILED &&
+      mmap(p + page, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+    int e = errno;
+    munmap(p, page + size);
+    errno = e;
+    p = (uint8_t*)MAP_FAILED;
+  }
+  int e = errno;
+  close(fd);
+  if (p == MAP_FAILED) {
+    errno = e;
+    return 0;
+  }
+
+  DataS data = (DataS)(p + page - sizeof(DataS_));
+  data->length = (Int)size;
+  mprotect(p, page, PROT_READ);
+  return data;
+}
+
+void file_unmap(DataS data) {
+  if (data == &EmptyData) return;
+  const size_t page = pageSize();
+  munmap(((uint8_t*)data) + sizeof(DataS_) - page, page + (size_t)data->length);
+}
+
+// -- Streaming input --
+
+struct InputS_ {
+  int fd;
+  bool ownsFD;
+  DataS chunk; // follows the reader in the same allocation
+};
+
+static InputS newInput(int fd, bool ownsFD) {
+  InputS in = (InputS)malloc(sizeof(InputS_) + sizeof(DataS_) + InputChunkSize);
+  in->fd = fd;
+  in->ownsFD = ownsFD;
+  in->chunk = (DataS)(in + 1);
+  in->chunk->length = 0;
+  return in;
+}
+
+InputS input_open(const char* path) {
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) return 0;
+  return newInput(fd, true);
+}
+
+InputS input_stdin() {
+  return newInput(STDIN_FILENO, false);
+}
+
+DataS input_read(InputS in) {
+  for (;;) {
+    ssize_t n = read(in->fd, in->chunk->data, InputChunkSize);
+    if (n >= 0) {
+      in->chunk->length = (Int)n;
+      return in->chunk;
+    }
+    if (errno != EINTR) return 0;
+  }
+}
+
+void input_close(InputS in) {
+  if (in->ownsFD) close(in->fd);
+  free(in);
+}
+
+} // namespace hue
@@ -0,0 +1,374 @@
+// Copyright (c) 2012, Rasmus Andersson. All rights reserved. Use of this source
+// code is governed by a MIT-style license that can be found in the LICENSE file.
+#include "object.h"
+
+#include <pthread.h>
+#include <sys/time.h>
+
+#include <thread>
+
+#if HUE_BIASED_REFCOUNT
+namespace hue {
+
+// An object queued with its owner by another thread
+struct RefQueueEntry {
+  RefQueueEntry* next;
+  void* obj;
+  void (*merge)(void*);
+};
+
+struct RefQueue {
+  pthread_mutex_t lock;
+  RefQueueEntry* head;
+  bool alive;
+  RefThread* nextFree; // next in freeThreads, once the thread has exited
+};
+
+__thread RefThread* ref_thread_ = 0;
+
+// Threads are looked up by ID when queueing objects. Thread IDs are never reused, so
+// that objects owned by a thread which has exited can still be told apart, but the
+// state of an exited thread is recycled for new threads. A thread looked up by ID may
+// thus have exited, and its state been taken by another thread, by the time its queue
+// is locked, so the ID is checked again under the lock.
+//
+// Once all IDs are taken, new threads share unownedThread, whose ID is 0. Objects they
+// create start out merged and only use the shared counter, like those of threads in
+// ReleaseBackground mode.
+static const uint32_t ThreadTableChunkSize = 1024;
+static const uint32_t ThreadTableChunkCount = 1024;
+static RefThread** threadTable[ThreadTableChunkCount];
+static uint32_t nextThreadID = 0;
+// Exited threads, linked through their queues. This is never torn down, since threads
+// may still exit while the process does.
+static RefThread* freeThreads = 0;
+static RefThread unownedThread = { 0, 0, 0, 0 };
+static pthread_mutex_t threadTableLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t threadKey;
+static pthread_once_t threadKeyOnce = PTHREAD_ONCE_INIT;
+
+static inline int64_t countOf(Ref refcount) {
+  // Sign-extend the count field
+  return ((int64_t)(refcount << 3)) >> 3;
+}
+
+static inline Ref withCount(Ref refcount, int64_t count) {
+  return (refcount & ~RefCountMask) | ((Ref)count & RefCountMask);
+}
+
+static inline RefThread** threadSlot(uint32_t id) {
+  RefThread** chunk = __atomic_load_n(&threadTable[id / ThreadTableChunkSize],
+                                      __ATOMIC_ACQUIRE);
+  return &chunk[id % ThreadTableChunkSize];
+}
+
+// Returns 0 if the thread has exited
+static RefThread* lookupThread(uint32_t id) {
+  return __atomic_load_n(threadSlot(id), __ATOMIC_ACQUIRE);
+}
+
+static RefQueueEntry* takeQueue(RefThread* thread, bool exiting) {
+  RefQueue* queue = (RefQueue*)thread->opaque;
+  pthread_mutex_lock(&queue->lock);
+  RefQueueEntry* entry = queue->head;
+  queue->head = 0;
+  __atomic_store_n(&thread->pending, 0, __ATOMIC_RELAXED);
+  if (exiting) queue->alive = false;
+  pthread_mutex_unlock(&queue->lock);
+  return entry;
+}
+
+static void mergeEntries(RefQueueEntry* entry) {
+  while (entry) {
+    RefQueueEntry* next = entry->next;
+    entry->merge(entry->obj);
+    slab_dealloc(entry, sizeof(RefQueueEntry));
+    entry = next;
+  }
+}
+
+static void threadExited(void* arg) {
+  RefThread* thread = (RefThread*)arg;
+  mergeEntries(takeQueue(thread, true));
+  ref_thread_ = 0;
+  pthread_mutex_lock(&threadTableLock);
+  __atomic_store_n(threadSlot(thread->id), (RefThread*)0, __ATOMIC_RELEASE);
+  ((RefQueue*)thread->opaque)->nextFree = freeThreads;
+  freeThreads = thread;
+  pthread_mutex_unlock(&threadTableLock);
+}
+
+static void makeThreadKey() {
+  pthread_key_create(&threadKey, threadExited);
+}
+
+RefThread* ref_register_thread() {
+  pthread_once(&threadKeyOnce, makeThreadKey);
+
+  pthread_mutex_lock(&threadTableLock);
+  if (nextThreadID + 1 >= ThreadTableChunkSize * ThreadTableChunkCount) {
+    pthread_mutex_unlock(&threadTableLock);
+    ref_thread_ = &unownedThread;
+    return ref_thread_;
+  }
+  uint32_t id = ++nextThreadID; // 0 means "no owner"
+  RefThread** chunk = threadTable[id / ThreadTableChunkSize];
+  if (chunk == 0) {
+    chunk = new RefThread*[ThreadTableChunkSize]();
+    __atomic_store_n(&threadTable[id / ThreadTableChunkSize], chunk, __ATOMIC_RELEASE);
+  }
+
+  RefThread* thread;
+  if (freeThreads) {
+    thread = freeThreads;
+    freeThreads = ((RefQueue*)thread->opaque)->nextFree;
+  } else {
+    RefQueue* queue = new RefQueue;
+    pthread_mutex_init(&queue->lock, 0);
+    queue->head = 0;
+    thread = new RefThread;
+    thread->opaque = queue;
+  }
+  RefQueue* queue = (RefQueue*)thread->opaque;
+  pthread_mutex_lock(&queue->lock);
+  thread->id = id;
+  thread->objectOwner = id;
+  thread->pending = 0;
+  queue->alive = true;
+  pthread_mutex_unlock(&queue->lock);
+  __atomic_store_n(&chunk[id % ThreadTableChunkSize], thread, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&threadTableLock);
+
+  pthread_setspecific(threadKey, thread);
+  ref_thread_ = thread;
+  return thread;
+}
+
+void ref_merge_queued() {
+  RefThread* thread = ref_thread_;
+  if (thread && thread->opaque) mergeEntries(takeQueue(thread, false));
+}
+
+void ref_shared_retain(Ref* refcount) {
+  Ref old = __atomic_load_n(refcount, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(refcount, &old, withCount(old, countOf(old) + 1),
+                                      true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
+
+bool ref_shared_release(Ref* refcount, uint32_t* owner, void* obj, void(*merge)(void*)) {
+  // The owner only changes when the counters are merged, which sets RefMerged. If we
+  // see the counters unmerged when decrementing, this is the owner.
+  uint32_t ownerID = __atomic_load_n(owner, __ATOMIC_ACQUIRE);
+  Ref old = __atomic_load_n(refcount, __ATOMIC_RELAXED);
+  Ref rc;
+  bool enqueue;
+  do {
+    int64_t count = countOf(old) - 1;
+    rc = withCount(old, count);
+    enqueue = count < 0 && (old & (RefMerged | RefQueued)) == 0;
+    if (enqueue) rc |= RefQueued;
+  } while (!__atomic_compare_exchange_n(refcount, &old, rc, true,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+  if (enqueue) {
+    RefThread* thread = lookupThread(ownerID);
+    if (thread) {
+      RefQueue* queue = (RefQueue*)thread->opaque;
+      pthread_mutex_lock(&queue->lock);
+      if (queue->alive && thread->id == ownerID) {
+        RefQueueEntry* entry = (RefQueueEntry*)slab_alloc(sizeof(RefQueueEntry));
+        entry->obj = obj;
+        entry->merge = merge;
+        entry->next = queue->head;
+        queue->head = entry;
+        __atomic_store_n(&thread->pending, 1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&queue->lock);
+        return false;
+      }
+      pthread_mutex_unlock(&queue->lock);
+    }
+    // The owner has exited and won't touch its counter again
+    merge(obj);
+    return false;
+  }
+
+  return countOf(rc) == 0 && (rc & (RefMerged | RefQueued)) == RefMerged;
+}
+
+bool ref_merge(Ref* refcount, uint32_t* owner, uint32_t* biased, bool dequeue) {
+  Ref old = __atomic_load_n(refcount, __ATOMIC_RELAXED);
+  Ref rc;
+  do {
+    int64_t count = countOf(old);
+    if ((old & RefMerged) == 0) count += *biased;
+    rc = withCount(old, count) | RefMerged;
+    if (dequeue) rc &= ~RefQueued;
+  } while (!__atomic_compare_exchange_n(refcount, &old, rc, true,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+  if ((old & RefMerged) == 0) {
+    *biased = 0;
+    __atomic_store_n(owner, 0, __ATOMIC_RELEASE);
+  }
+  // A queued object is deallocated when it's dequeued
+  return countOf(rc) == 0 && (rc & RefQueued) == 0;
+}
+
+} // namespace hue
+#endif // HUE_BIASED_REFCOUNT
+
+// ------------------------------------------------------
+// Deferred release
+
+namespace hue {
+
+__thread ReleaseState release_state_ __attribute__((tls_model("initial-exec"))) =
+  { ReleaseImmediate, false, 0, 0 };
+
+// A queued object. With biased reference counting, the header of a dead object is
+// large enough to hold the entry, so queueing an object allocates nothing.
+struct ReleaseEntry {
+  ReleaseEntry* next;
+  void (*free)(void*);
+  #if !HUE_BIASED_REFCOUNT
+  void* obj;
+  #endif
+};
+
+#if HUE_BIASED_REFCOUNT
+static inline ReleaseEntry* entryFor(void* obj) { return (ReleaseEntry*)obj; }
+static inline void* objectOf(ReleaseEntry* entry) { return entry; }
+static inline void freeEntry(ReleaseEntry* entry) {}
+#else
+static inline ReleaseEntry* entryFor(void* obj) {
+  ReleaseEntry* entry = (ReleaseEntry*)slab_alloc(sizeof(ReleaseEntry));
+  entry->obj = obj;
+  return entry;
+}
+static inline void* objectOf(ReleaseEntry* entry) { return entry->obj; }
+static inline void freeEntry(ReleaseEntry* entry) {
+  slab_dealloc(entry, sizeof(ReleaseEntry));
+}
+#endif
+
+static pthread_key_t releaseKey;
+static pthread_once_t releaseKeyOnce = PTHREAD_ONCE_INIT;
+
+static void releaseThreadExited(void*) {
+  release_drain();
+  release_state_.mode = ReleaseImmediate;
+}
+
+static void makeReleaseKey() {
+  pthread_key_create(&releaseKey, releaseThreadExited);
+}
+
+// Objects handed to the background thread. Pushed by any thread and taken all at once
+// by the background thread, so a plain lock-free stack will do.
+static ReleaseEntry* backgroundHead = 0;
+static pthread_mutex_t backgroundLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t backgroundWakeup = PTHREAD_COND_INITIALIZER;
+static pthread_once_t backgroundOnce = PTHREAD_ONCE_INIT;
+
+static void backgroundMain() {
+  // Objects freed by the background thread are queued with it too, so that freeing a
+  // large graph never recurses
+  release_state_.mode = ReleaseDeferred;
+  while (true) {
+    ReleaseEntry* entry = __atomic_exchange_n(&backgroundHead, (ReleaseEntry*)0,
+                                              __ATOMIC_ACQUIRE);
+    if (entry == 0) {
+      // Pushers signal without taking the lock, so don't wait for long
+      struct timeval now;
+      gettimeofday(&now, 0);
+      struct timespec deadline;
+      deadline.tv_sec = now.tv_sec;
+      deadline.tv_nsec = (now.tv_usec * 1000) + 10000000;
+      if (deadline.tv_nsec >= 1000000000) {
+        ++deadline.tv_sec;
+        deadline.tv_nsec -= 1000000000;
+      }
+      pthread_mutex_lock(&backgroundLock);
+      if (__atomic_load_n(&backgroundHead, __ATOMIC_RELAXED) == 0) {
+        pthread_cond_timedwait(&backgroundWakeup, &backgroundLock, &deadline);
+      }
+      pthread_mutex_unlock(&backgroundLock);
+      continue;
+    }
+    release_state_.draining = true;
+    while (entry) {
+      ReleaseEntry* next = entry->next;
+      void* obj = objectOf(entry);
+      void (*free)(void*) = entry->free;
+      freeEntry(entry);
+      free(obj);
+      entry = next;
+    }
+    release_state_.draining = false;
+    release_drain();
+    #if HUE_BIASED_REFCOUNT
+    ref_merge_queued();
+    #endif
+  }
+}
+
+static void startBackground() {
+  std::thread(backgroundMain).detach();
+}
+
+void release_set_mode(ReleaseMode mode) {
+  if (mode != ReleaseImmediate) {
+    pthread_once(&releaseKeyOnce, makeReleaseKey);
+    pthread_setspecific(releaseKey, &release_state_);
+  }
+  if (mode == ReleaseBackground) {
+    pthread_once(&backgroundOnce, startBackground);
+  }
+  #if HUE_BIASED_REFCOUNT
+  // See ReleaseMode
+  RefThread* thread = ref_thread();
+  if (thread->id != 0) thread->objectOwner = (mode == ReleaseBackground) ? 0 : thread->id;
+  #endif
+  release_state_.mode = mode;
+}
+
+size_t release_drain(size_t budget) {
+  ReleaseState& state = release_state_;
+  if (state.draining) return state.count;
+  state.draining = true;
+  for (; budget != 0 && state.head; --budget) {
+    ReleaseEntry* entry = (ReleaseEntry*)state.head;
+    state.head = entry->next;
+    --state.count;
+    void* obj = objectOf(entry);
+    void (*free)(void*) = entry->free;
+    freeEntry(entry);
+    free(obj);
+  }
+  state.draining = false;
+  return state.count;
+}
+
+void release_defer(void* obj, void (*free)(void*)) {
+  ReleaseState& state = release_state_;
+  ReleaseEntry* entry = entryFor(obj);
+  entry->free = free;
+
+  if (state.mode == ReleaseBackground && !state.draining) {
+    ReleaseEntry* head = __atomic_load_n(&backgroundHead, __ATOMIC_RELAXED);
+    do {
+      entry->next = head;
+    } while (!__atomic_compare_exchange_n(&backgroundHead, &head, entry, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    if (head == 0) pthread_cond_signal(&backgroundWakeup);
+    return;
+  }
+
+  // Objects freed while draining are queued without draining any further, which is
+  // what keeps freeing a large graph from recursing
+  entry->next = (ReleaseEntry*)state.head;
+  state.head = entry;
+  ++state.count;
+  if (!state.draining) release_drain(ReleaseBudget);
+}
+
+} // namespace hue
@@ -6,11 +6,17 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <hue/runtime/slab.h>
+#include <hue/runtime/stats.h>
 
-// Memory
-#define hue_alloc malloc
-#define hue_realloc realloc
-#define hue_dealloc free
+// Biased reference counting. When enabled (the default), the thread that creates an
+// object counts its references with plain, non-atomic arithmetic, and only other
+// threads pay for atomic operations. Define as 0 to have all threads use atomic
+// operations on a single counter. The runtime library and all code using it must be
+// built with the same setting.
+#ifndef HUE_BIASED_REFCOUNT
+#define HUE_BIASED_REFCOUNT 1
+#endif
 
 namespace hue {
 
@@ -29,17 +35,216 @@ typedef enum {
   TransferReference,   // ownership is transfered ("steals" a reference)
 } RefRule;
 
-// Implements the functions and data needed for a class to become reference counted.
-// Messy, but it works...
-#define HUE_OBJECT(T) \
+// How objects are freed once the calling thread releases their last reference.
+// Freeing an object releases the objects it references, so with ReleaseImmediate,
+// releasing the last reference to a large graph of objects (like a big vector) frees
+// the whole graph before release() returns. The other modes bound that pause:
+//
+//   ReleaseDeferred    Dead objects are queued with the thread. Each release that
+//                      queues an object then frees at most ReleaseBudget queued
+//                      objects, and release_drain frees more on demand.
+//   ReleaseBackground  Dead objects are handed to a background thread which frees
+//                      them.
+//
+// Objects queued by a thread which exits are freed as it exits.
+//
+// With biased reference counting, only the thread which created an object can tell
+// when its last reference is dropped, unless its counters have been merged. So that the
+// background thread can free a whole graph on its own, a thread in ReleaseBackground
+// mode creates objects with merged counters, which are only counted atomically.
+// Objects it created in another mode, or which other threads created, are still
+// merged by their creators when the background thread drops their last reference,
+// next time those threads allocate, call ref_merge_queued or exit.
+enum ReleaseMode {
+  ReleaseImmediate = 0,
+  ReleaseDeferred,
+  ReleaseBackground,
+};
+
+// Objects freed per release() in ReleaseDeferred mode
+static const size_t ReleaseBudget = 64;
+
+struct ReleaseState {
+  ReleaseMode mode;
+  bool draining;
+  size_t count; // number of queued objects
+  void* head;   // queue, managed by object.cc
+};
+extern __thread ReleaseState release_state_ __attribute__((tls_model("initial-exec")));
+
+// Sets the release mode of the calling thread. Switching to ReleaseImmediate does not
+// free objects already queued.
+void release_set_mode(ReleaseMode mode);
+inline ReleaseMode release_mode() { return release_state_.mode; }
+
+// Frees up to *budget* objects queued by the calling thread. Returns the number of
+// objects still queued.
+size_t release_drain(size_t budget = SIZE_MAX);
+
+// Number of dead objects queued by the calling thread
+inline size_t release_pending() { return release_state_.count; }
+
+// Queues the dead object *obj*, which is freed by calling free(obj). Used by
+// HUE_OBJECT when the release mode isn't ReleaseImmediate.
+void release_defer(void* obj, void (*free)(void*));
+
+#define HUE_OBJECT_FREE_(T, SIZE) \
+  inline void __free() { \
+    if (hue::release_state_.mode != hue::ReleaseImmediate) { \
+      hue::release_defer(this, &__freeDeferred); \
+    } else { \
+      __freeNow(); \
+    } \
+  } \
+  static void __freeDeferred(void* obj) { ((T*)obj)->__freeNow(); } \
+  inline void __freeNow() { \
+    size_t size = SIZE; \
+    dealloc(); \
+    HUE_STATS_FREE_(size); \
+    hue::slab_dealloc(this, size); \
+  }
+
+#if HUE_BIASED_REFCOUNT
+// A biased object carries three fields:
+//
+//   refcount_  Shared counter, only modified atomically. Holds a signed count of the
+//              references taken (positive) or dropped (negative) by threads other
+//              than the owner, and the RefMerged and RefQueued flags.
+//   owner_     ID of the thread that owns the object, or 0 once the counters have
+//              been merged.
+//   biased_    References held by the owner. Only touched by the owner.
+//
+// When the owner drops its last reference, the two counters are merged and from then
+// on all threads use the shared counter. If another thread takes the shared counter
+// below zero, it can't know if the object is dead, so it queues the object with the
+// owner which merges the counters next time it allocates an object or calls
+// ref_merge_queued. Objects owned by a thread which has exited are merged right away.
+static const Ref RefMerged = (Ref)1 << 62;
+static const Ref RefQueued = (Ref)1 << 61;
+static const Ref RefCountMask = RefQueued - 1;
+
+// Size of the header HUE_OBJECT adds to the start of an object
+static const size_t ObjectHeaderSize = sizeof(Ref) + (sizeof(uint32_t) * 2);
+
+// Per-thread state of the biased reference counter. Threads registered after all
+// thread IDs have been taken get ID 0.
+struct RefThread {
+  uint32_t id;
+  uint32_t objectOwner; // owner of new objects: id, or 0 to create them merged
+  volatile int pending; // non-zero when objects are waiting in the queue
+  void* opaque;         // queue, managed by object.cc
+};
+extern __thread RefThread* ref_thread_;
+
+// Registers the calling thread, unless already registered
+RefThread* ref_register_thread();
+inline RefThread* ref_thread() {
+  RefThread* t = ref_thread_;
+  return t ? t : ref_register_thread();
+}
+
+// Merges the counters of objects owned by the calling thread that other threads have
+// queued. Called automatically when allocating objects.
+void ref_merge_queued();
+
+// Shared counter operations used by HUE_OBJECT. Release functions return true if the
+// object should be deallocated. *merge* is called with *obj* when the queued object
+// is merged and should merge the object's counters and deallocate it if it's dead.
+void ref_shared_retain(Ref* refcount);
+bool ref_shared_release(Ref* refcount, uint32_t* owner, void* obj, void(*merge)(void*));
+bool ref_merge(Ref* refcount, uint32_t* owner, uint32_t* biased, bool dequeue);
+
+// Signed count of the shared counter
+inline int64_t ref_shared_count(const Ref* refcount) {
+  return ((int64_t)(__atomic_load_n(refcount, __ATOMIC_ACQUIRE) << 3)) >> 3;
+}
+
+#define HUE_OBJECT_REFCOUNT_(T, SIZE) \
+public: \
+  Ref refcount_; \
+  uint32_t owner_; \
+  uint32_t biased_; \
+private: \
+  HUE_STATS_MEMBERS_ \
+  static T* __alloc(size_t size = sizeof(T)) { \
+    hue::RefThread* thread = hue::ref_thread(); \
+    if (__atomic_load_n(&thread->pending, __ATOMIC_RELAXED)) hue::ref_merge_queued(); \
+    HUE_STATS_ALLOC_(size); \
+    T* obj = (T*)hue::slab_alloc(size); \
+    obj->owner_ = thread->objectOwner; \
+    if (obj->owner_ != 0) { \
+      obj->refcount_ = 0; \
+      obj->biased_ = 1; \
+    } else { \
+      obj->refcount_ = hue::RefMerged | 1; \
+      obj->biased_ = 0; \
+    } \
+    return obj; \
+  } \
+  inline bool __isOwner() const { \
+    hue::RefThread* thread = hue::ref_thread_; \
+    uint32_t owner = __atomic_load_n(&owner_, __ATOMIC_RELAXED); \
+    return owner != 0 && thread && owner == thread->id; \
+  } \
+  static void __mergeQueued(void* p) { \
+    T* obj = (T*)p; \
+    if (hue::ref_merge(&obj->refcount_, &obj->owner_, &obj->biased_, true)) obj->__free(); \
+  } \
+  HUE_OBJECT_FREE_(T, SIZE) \
+public: \
+  inline T* retain() { \
+    if (__atomic_load_n(&refcount_, __ATOMIC_RELAXED) == hue::Unretainable) return this; \
+    if (__isOwner()) ++biased_; \
+    else hue::ref_shared_retain(&refcount_); \
+    return this; \
+  } \
+  inline void release() { \
+    if (__atomic_load_n(&refcount_, __ATOMIC_RELAXED) == hue::Unretainable) return; \
+    if (__isOwner()) { \
+      /* Nobody else can be using the object if the shared counter is untouched */ \
+      if (--biased_ == 0 && (__atomic_load_n(&refcount_, __ATOMIC_ACQUIRE) == 0 || \
+                             hue::ref_merge(&refcount_, &owner_, &biased_, false))) { \
+        __free(); \
+      } \
+    } else if (hue::ref_shared_release(&refcount_, &owner_, this, &__mergeQueued)) { \
+      __free(); \
+    } \
+  } \
+  /* True if the caller holds the only reference, which means the object can't be */ \
+  /* observed by anyone else and may be modified in place. Might return false for */ \
+  /* uniquely referenced objects owned by another thread. */ \
+  inline bool isUniquelyReferenced() const { \
+    if (__isOwner()) return biased_ + hue::ref_shared_count(&refcount_) == 1; \
+    return __atomic_load_n(&owner_, __ATOMIC_RELAXED) == 0 && \
+           hue::ref_shared_count(&refcount_) == 1; \
+  } \
+  /* Number of references. Only exact when no other thread is using the object. */ \
+  inline hue::Ref refcount() const { \
+    hue::Ref rc = __atomic_load_n(&refcount_, __ATOMIC_RELAXED); \
+    if (rc == hue::Unretainable) return rc; \
+    int64_t count = hue::ref_shared_count(&refcount_); \
+    if (__isOwner()) count += biased_; \
+    return (hue::Ref)count; \
+  } \
+protected:
+
+#else // HUE_BIASED_REFCOUNT
+
+// Size of the header HUE_OBJECT adds to the start of an object
+static const size_t ObjectHeaderSize = sizeof(Ref);
+
+#define HUE_OBJECT_REFCOUNT_(T, SIZE) \
 public: \
   Ref refcount_; \
 private: \
+  HUE_STATS_MEMBERS_ \
   static T* __alloc(size_t size = sizeof(T)) { \
-    T* obj = (T*)hue_alloc(size); \
+    HUE_STATS_ALLOC_(size); \
+    T* obj = (T*)hue::slab_alloc(size); \
     obj->refcount_ = 1; \
     return obj; \
   } \
+  HUE_OBJECT_FREE_(T, SIZE) \
 public: \
   inline T* retain() { \
     if (refcount_ != hue::Unretainable) __sync_add_and_fetch(&refcount_, 1); \
@@ -47,21 +252,35 @@ public: \
   } \
   inline void release() { \
     if (refcount_ != hue::Unretainable && __sync_sub_and_fetch(&refcount_, 1) == 0) { \
-      dealloc(); \
-      hue_dealloc(this); \
+      __free(); \
     } \
   } \
+  /* True if the caller holds the only reference, which means the object can't be */ \
+  /* observed by anyone else and may be modified in place. */ \
+  inline bool isUniquelyReferenced() const { \
+    return refcount_ == 1; \
+  } \
+  /* Number of references */ \
+  inline hue::Ref refcount() const { \
+    return __atomic_load_n(&refcount_, __ATOMIC_ACQUIRE); \
+  } \
 protected:
 
+#endif // HUE_BIASED_REFCOUNT
 
-//class Object { HUE_OBJECT(Object) void dealloc() {} };
+// Implements the functions and data needed for a class to become reference counted.
+// Objects are allocated from the slab allocator (see slab.h) and counted by type in
+// the runtime statistics (see stats.h).
+// Messy, but it works...
+#define HUE_OBJECT(T) HUE_OBJECT_REFCOUNT_(T, sizeof(T))
+
+// Like HUE_OBJECT, but for objects whose size varies from instance to instance, like
+// nodes with trailing data. T must implement `size_t allocsize() const` which returns
+// the size that was passed to __alloc.
+#define HUE_VAR_OBJECT(T) HUE_OBJECT_REFCOUNT_(T, allocsize())
 
-// -------------------------
-// Debugging
 
-// Increment or decrement a counter (*counter* must be a non-bit-field 32- or 64-bit integer)
-#define HUE_DEBUG_COUNT_INC(counter) __sync_add_and_fetch(&(counter), 1)
-#define HUE_DEBUG_COUNT_DEC(counter) __sync_sub_and_fetch(&(counter), 1)
+//class Object { HUE_OBJECT(Object) void dealloc() {} };
 
 } // namespace hue
 #endif // _HUE_OBJECT_INCLUDED
@@ -6,46 +6,159 @@
 
 #include "../utf8/unchecked.h"
 #include "runtime.h"
+#include "format.h"
+#include "simd.h"
 
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
 #include <unistd.h>
-#include <string>
 
-#define _writef(z, fmt, ...) do { \
-  char buf[z+1]; \
-  int len = snprintf(buf, z+1, fmt, __VA_ARGS__); \
-  write(STDOUT_FILENO, buf, len); \
-} while(0)
+#include <algorithm>
 
 namespace hue {
 
+// -- Output buffering --
+
+static const size_t OutputBufferSize = 64 * 1024;
+
+struct OutputBuffer {
+  char* data;
+  size_t length;
+};
+
+static __thread OutputBuffer* output_ = 0;
+static pthread_key_t outputKey;
+static pthread_once_t outputOnce = PTHREAD_ONCE_INIT;
+static bool outputIsTTY = false;
+
+// Errors are ignored, as there's nobody to report them to
+static void writeAll(const char* data, size_t length) {
+  while (length != 0) {
+    ssize_t n = write(STDOUT_FILENO, data, length);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return;
+    }
+    data += n;
+    length -= n;
+  }
+}
+
+static void flushBuffer(OutputBuffer* out) {
+  writeAll(out->data, out->length);
+  out->length = 0;
+}
+
+static void threadExited(void* arg) {
+  OutputBuffer* out = (OutputBuffer*)arg;
+  flushBuffer(out);
+  free(out->data);
+  delete out;
+  output_ = 0;
+}
+
+static void flushAtExit() {
+  stdout_flush();
+}
+
+static void initOutput() {
+  pthread_key_create(&outputKey, threadExited);
+  outputIsTTY = isatty(STDOUT_FILENO);
+  atexit(flushAtExit);
+}
+
+static OutputBuffer* outputBuffer() {
+  OutputBuffer* out = output_;
+  if (!out) {
+    pthread_once(&outputOnce, initOutput);
+    out = new OutputBuffer;
+    out->data = (char*)malloc(OutputBufferSize);
+    out->length = 0;
+    pthread_setspecific(outputKey, out);
+    output_ = out;
+  }
+  return out;
+}
+
+// Returns room for at least n bytes, at most OutputBufferSize, at the end of the buffer
+static inline char* reserve(size_t n) {
+  OutputBuffer* out = outputBuffer();
+  if (OutputBufferSize - out->length < n) flushBuffer(out);
+  return out->data + out->length;
+}
+
+// Adds n bytes written to the room returned by reserve to the buffer
+static inline void commit(size_t n) {
+  OutputBuffer* out = output_;
+  const char* start = out->data + out->length;
+  out->length += n;
+  if (outputIsTTY && memchr(start, '\n', n)) flushBuffer(out);
+}
+
+static void append(const void* data, size_t n) {
+  if (n >= OutputBufferSize) {
+    flushBuffer(outputBuffer());
+    writeAll((const char*)data, n);
+    return;
+  }
+  memcpy(reserve(n), data, n);
+  commit(n);
+}
+
+void stdout_flush() {
+  if (output_) flushBuffer(output_);
+}
+
+// -- Values --
+
 void stdout_write(const Bool v) {
-  if (v) write(STDOUT_FILENO, "true", 4);
-  else   write(STDOUT_FILENO, "false", 5);
+  if (v) append("true", 4);
+  else   append("false", 5);
 }
 
-void stdout_write(const Float v) { _writef(32, "%f", v); }
-void stdout_write(const Int   v) { _writef(32, "%lld", v); }
-void stdout_write(const Byte  v) { _writef(32, "%x", v); }
+void stdout_write(const Float v) { commit(format_float(reserve(FormatFloatMax), v)); }
+void stdout_write(const Int   v) { commit(format_int(reserve(FormatIntMax), v)); }
+void stdout_write(const Byte  v) { commit(format_hex(reserve(FormatHexMax), v)); }
 
+// Invalid code points are not written
 void stdout_write(const UChar v) {
-  std::string utf8string = Text::UCharToUTF8String(v);
-  write(STDOUT_FILENO, utf8string.data(), utf8string.size());
+  if (!utf8::internal::is_code_point_valid(v)) return;
+  char* buf = reserve(4);
+  commit(utf8::unchecked::append(v, buf) - buf);
 }
 
 void stdout_write(const DataS data) {
   RT_TRACE
-  write(STDOUT_FILENO, data->data, data->length);
+  append(data->data, data->length);
 }
 
+// Invalid code points are not written
 void stdout_write(const TextS text) {
   RT_TRACE
-  std::string utf8string;
-  std::back_insert_iterator<std::string> it = std::back_inserter(utf8string);
-  Int i = 0;
-  for (; i != text->length; ++i) {
-    utf8::unchecked::append(text->data[i], it);
+  // Encoded into the buffer a chunk at a time, each code point taking at most 4 bytes
+  static const Int ChunkSize = OutputBufferSize / 4;
+  const SIMDKernels& kernels = simd();
+  for (Int i = 0; i != text->length; ) {
+    Int n = std::min(ChunkSize, text->length - i);
+    commit(kernels.encodeUTF8(text->data + i, n, reserve(n * 4)));
+    i += n;
+  }
+}
+
+void stdout_write_values(const OutputValue* values, Int count) {
+  for (Int i = 0; i < count; ++i) {
+    const OutputValue& v = values[i];
+    switch (v.kind) {
+      case OutputBool:  stdout_write(v.b); break;
+      case OutputFloat: stdout_write(v.f); break;
+      case OutputInt:   stdout_write(v.i); break;
+      case OutputUChar: stdout_write(v.c); break;
+      case OutputByte:  stdout_write(v.byte); break;
+      case OutputData:  stdout_write(v.data); break;
+      case OutputText:  stdout_write(v.text); break;
+    }
   }
-  write(STDOUT_FILENO, utf8string.data(), utf8string.size());
 }
 
 } // namespace hue
@@ -21,6 +21,14 @@ typedef struct DataS_ { Int length; Byte data[0]; }* DataS;
 typedef struct TextS_ { Int length; UChar data[0]; }* TextS;
 
 // Write a value to stdout. Mostly for testing and debugging.
+//
+// Output is buffered per thread. A thread's buffer is written out when it's full, after
+// each newline when stdout is a terminal, when stdout_flush is called and when the
+// thread exits. The buffer of the thread calling exit() is written out at exit, but
+// other threads still running at that point must call stdout_flush themselves.
+//
+// Ints are written in decimal, Bytes in hexadecimal and Floats with the fewest digits
+// that read back as the same value, like 45.9 or 2.0. See format.h.
 void stdout_write(const Bool v);     // _ZN3hue12stdout_writeEb
 void stdout_write(const Float v);    // _ZN3hue12stdout_writeEd
 void stdout_write(const Int v);      // _ZN3hue12stdout_writeEx
@@ -29,5 +37,61 @@ void stdout_write(const Byte v);     // _ZN3hue12stdout_writeEh
 void stdout_write(const DataS data); // _ZN3hue12stdout_writeEPNS_6DataS_E
 void stdout_write(const TextS data); // _ZN3hue12stdout_writeEPNS_6TextS_E
 
+// Writes the calling thread's buffered output to stdout
+void stdout_flush();                 // _ZN3hue12stdout_flushEv
+
+// A value of any type stdout_write accepts, for writing several values in one call
+enum OutputKind {
+  OutputBool = 0,
+  OutputFloat,
+  OutputInt,
+  OutputUChar,
+  OutputByte,
+  OutputData,
+  OutputText,
+};
+struct OutputValue {
+  uint32_t kind; // OutputKind
+  union {
+    Bool b;
+    Float f;
+    Int i;
+    UChar c;
+    Byte byte;
+    DataS data;
+    TextS text;
+  };
+};
+
+// Writes *count* values as if by calling stdout_write for each of them, which saves
+// generated code a call per value.
+// _ZN3hue19stdout_write_valuesEPKNS_11OutputValueEx
+void stdout_write_values(const OutputValue* values, Int count);
+
+// Maps the regular file at *path* into memory read-only and returns its contents as
+// data, or returns 0 and sets errno on failure. Nothing is copied: the data lives in
+// the mapping and pages of the file are read as they are first touched, so this takes
+// constant time whatever the size of the file. The data stays valid until passed to
+// file_unmap, and the file must not be truncated while it's mapped. Use input_open to
+// read files which can't be mapped, like pipes.
+DataS file_map(const char* path);    // _ZN3hue8file_mapEPKc
+void file_unmap(DataS data);         // _ZN3hue10file_unmapEPNS_6DataS_E
+
+// Reads a file or stdin a chunk at a time, into a buffer owned by the reader
+typedef struct InputS_* InputS;
+static const Int InputChunkSize = 64 * 1024;
+
+// Opens the file at *path* for reading, or returns 0 and sets errno on failure
+InputS input_open(const char* path); // _ZN3hue10input_openEPKc
+// A new reader of stdin. Closing it doesn't close stdin.
+InputS input_stdin();                // _ZN3hue11input_stdinEv
+
+// Returns the next chunk of input, of at most InputChunkSize bytes, which is valid
+// until the next call with the same reader. Returns an empty chunk at the end of the
+// input, and 0 on failure with errno set. Reading from a pipe or terminal returns
+// whatever has arrived rather than waiting for a full chunk.
+DataS input_read(InputS in);         // _ZN3hue10input_readEPNS_7InputS_E
+void input_close(InputS in);         // _ZN3hue11input_closeEPNS_7InputS_E
+
 } // namespace hue
 #endif // _HUE_RUNTIME_INCLUDED
@@ -0,0 +1,617 @@
+// Copyright (c) 2012, Rasmus Andersson. All rights reserved. Use of this source
+// code is governed by a MIT-style license that can be found in the LICENSE file.
+#include "simd.h"
+
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HUE_SIMD_X86 1
+#include <immintrin.h>
+#else
+#define HUE_SIMD_X86 0
+#endif
+
+namespace hue {
+
+// Floats are summed in this many lanes, value i going to lane i % SumLanes
+static const size_t SumLanes = 16;
+
+static double addLanes(double* lanes) {
+  for (size_t width = SumLanes / 2; width != 0; width /= 2) {
+    for (size_t j = 0; j < width; ++j) lanes[j] += lanes[j + width];
+  }
+  return lanes[0];
+}
+
+// Adds values[i...n-1] to the lanes, where i is a multiple of SumLanes
+static double finishSum(double* lanes, const double* values, size_t i, size_t n) {
+  for (size_t j = 0; i + j < n; ++j) lanes[j] += values[i + j];
+  return addLanes(lanes);
+}
+
+// -- Scalar --
+
+static size_t findIntScalar(const int64_t* values, size_t n, int64_t value) {
+  return simd_find<int64_t>(values, n, value);
+}
+static size_t findFloatScalar(const double* values, size_t n, double value) {
+  return simd_find<double>(values, n, value);
+}
+static size_t countIntScalar(const int64_t* values, size_t n, int64_t value) {
+  return simd_count<int64_t>(values, n, value);
+}
+static size_t countFloatScalar(const double* values, size_t n, double value) {
+  return simd_count<double>(values, n, value);
+}
+
+static int64_t sumIntScalar(const int64_t* values, size_t n) {
+  return (int64_t)simd_sum<uint64_t>((const uint64_t*)values, n);
+}
+
+static double sumFloatScalar(const double* values, size_t n) {
+  double lanes[SumLanes];
+  for (size_t j = 0; j < SumLanes; ++j) lanes[j] = -0.0;
+  size_t i = 0;
+  for (; i + SumLanes <= n; i += SumLanes) {
+    for (size_t j = 0; j < SumLanes; ++j) lanes[j] += values[i + j];
+  }
+  return finishSum(lanes, values, i, n);
+}
+
+static int64_t minIntScalar(const int64_t* values, size_t n) {
+  return simd_min<int64_t>(values, n);
+}
+static int64_t maxIntScalar(const int64_t* values, size_t n) {
+  return simd_max<int64_t>(values, n);
+}
+
+static double minFloatScalar(const double* values, size_t n) {
+  double min = values[0];
+  bool nan = false;
+  for (size_t i = 0; i < n; ++i) {
+    nan |= (values[i] != values[i]);
+    if (values[i] < min) min = values[i];
+  }
+  return nan ? NAN : min;
+}
+
+static double maxFloatScalar(const double* values, size_t n) {
+  double max = values[0];
+  bool nan = false;
+  for (size_t i = 0; i < n; ++i) {
+    nan |= (values[i] != values[i]);
+    if (values[i] > max) max = values[i];
+  }
+  return nan ? NAN : max;
+}
+
+// Skips surrogates and values past U+10FFFF
+static inline char* encodeUTF8Char(uint32_t c, char* out) {
+  if (c < 0x80) {
+    *out++ = (char)c;
+  } else if (c < 0x800) {
+    *out++ = (char)(0xc0 | (c >> 6));
+    *out++ = (char)(0x80 | (c & 0x3f));
+  } else if (c < 0x10000) {
+    if (c - 0xd800 < 0x800) return out;
+    *out++ = (char)(0xe0 | (c >> 12));
+    *out++ = (char)(0x80 | ((c >> 6) & 0x3f));
+    *out++ = (char)(0x80 | (c & 0x3f));
+  } else if (c < 0x110000) {
+    *out++ = (char)(0xf0 | (c >> 18));
+    *out++ = (char)(0x80 | ((c >> 12) & 0x3f));
+    *out++ = (char)(0x80 | ((c >> 6) & 0x3f));
+    *out++ = (char)(0x80 | (c & 0x3f));
+  }
+  return out;
+}
+
+static size_t encodeUTF8Scalar(const uint32_t* chars, size_t n, char* out) {
+  char* start = out;
+  for (size_t i = 0; i < n; ++i) out = encodeUTF8Char(chars[i], out);
+  return out - start;
+}
+
+static const SIMDKernels scalarKernels = {
+  SIMDScalar, "scalar",
+  findIntScalar, findFloatScalar, countIntScalar, countFloatScalar,
+  sumIntScalar, sumFloatScalar, minIntScalar, maxIntScalar, minFloatScalar, maxFloatScalar,
+  encodeUTF8Scalar,
+};
+
+#if HUE_SIMD_X86
+
+// -- SSE4.2 --
+// Loops handle 8 values per iteration in four registers, leaving the remainder to
+// scalar code.
+
+#define SSE42 __attribute__((target("sse4.2")))
+
+SSE42 static size_t findIntSSE42(const int64_t* values, size_t n, int64_t value) {
+  __m128i x = _mm_set1_epi64x(value);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m128i* p = (const __m128i*)(values + i);
+    __m128i eq = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi64(_mm_loadu_si128(p), x),
+                   _mm_cmpeq_epi64(_mm_loadu_si128(p + 1), x)),
+      _mm_or_si128(_mm_cmpeq_epi64(_mm_loadu_si128(p + 2), x),
+                   _mm_cmpeq_epi64(_mm_loadu_si128(p + 3), x)));
+    if (!_mm_testz_si128(eq, eq)) break; // the scalar loop below finds it
+  }
+  while (i < n && values[i] != value) ++i;
+  return i;
+}
+
+SSE42 static size_t findFloatSSE42(const double* values, size_t n, double value) {
+  __m128d x = _mm_set1_pd(value);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const double* p = values + i;
+    __m128d eq = _mm_or_pd(
+      _mm_or_pd(_mm_cmpeq_pd(_mm_loadu_pd(p), x), _mm_cmpeq_pd(_mm_loadu_pd(p + 2), x)),
+      _mm_or_pd(_mm_cmpeq_pd(_mm_loadu_pd(p + 4), x), _mm_cmpeq_pd(_mm_loadu_pd(p + 6), x)));
+    if (_mm_movemask_pd(eq) != 0) break;
+  }
+  while (i < n && !(values[i] == value)) ++i;
+  return i;
+}
+
+// Equal lanes are all ones, that is -1, so subtracting them counts them
+SSE42 static size_t countIntSSE42(const int64_t* values, size_t n, int64_t value) {
+  __m128i x = _mm_set1_epi64x(value);
+  __m128i c0 = _mm_setzero_si128(), c1 = c0, c2 = c0, c3 = c0;
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m128i* p = (const __m128i*)(values + i);
+    c0 = _mm_sub_epi64(c0, _mm_cmpeq_epi64(_mm_loadu_si128(p), x));
+    c1 = _mm_sub_epi64(c1, _mm_cmpeq_epi64(_mm_loadu_si128(p + 1), x));
+    c2 = _mm_sub_epi64(c2, _mm_cmpeq_epi64(_mm_loadu_si128(p + 2), x));
+    c3 = _mm_sub_epi64(c3, _mm_cmpeq_epi64(_mm_loadu_si128(p + 3), x));
+  }
+  uint64_t lanes[2];
+  _mm_storeu_si128((__m128i*)lanes,
+                   _mm_add_epi64(_mm_add_epi64(c0, c1), _mm_add_epi64(c2, c3)));
+  return lanes[0] + lanes[1] + countIntScalar(values + i, n - i, value);
+}
+
+SSE42 static size_t countFloatSSE42(const double* values, size_t n, double value) {
+  __m128d x = _mm_set1_pd(value);
+  __m128i c0 = _mm_setzero_si128(), c1 = c0, c2 = c0, c3 = c0;
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const double* p = values + i;
+    c0 = _mm_sub_epi64(c0, _mm_castpd_si128(_mm_cmpeq_pd(_mm_loadu_pd(p), x)));
+    c1 = _mm_sub_epi64(c1, _mm_castpd_si128(_mm_cmpeq_pd(_mm_loadu_pd(p + 2), x)));
+    c2 = _mm_sub_epi64(c2, _mm_castpd_si128(_mm_cmpeq_pd(_mm_loadu_pd(p + 4), x)));
+    c3 = _mm_sub_epi64(c3, _mm_castpd_si128(_mm_cmpeq_pd(_mm_loadu_pd(p + 6), x)));
+  }
+  uint64_t lanes[2];
+  _mm_storeu_si128((__m128i*)lanes,
+                   _mm_add_epi64(_mm_add_epi64(c0, c1), _mm_add_epi64(c2, c3)));
+  return lanes[0] + lanes[1] + countFloatScalar(values + i, n - i, value);
+}
+
+SSE42 static int64_t sumIntSSE42(const int64_t* values, size_t n) {
+  __m128i s0 = _mm_setzero_si128(), s1 = s0, s2 = s0, s3 = s0;
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m128i* p = (const __m128i*)(values + i);
+    s0 = _mm_add_epi64(s0, _mm_loadu_si128(p));
+    s1 = _mm_add_epi64(s1, _mm_loadu_si128(p + 1));
+    s2 = _mm_add_epi64(s2, _mm_loadu_si128(p + 2));
+    s3 = _mm_add_epi64(s3, _mm_loadu_si128(p + 3));
+  }
+  uint64_t lanes[2];
+  _mm_storeu_si128((__m128i*)lanes,
+                   _mm_add_epi64(_mm_add_epi64(s0, s1), _mm_add_epi64(s2, s3)));
+  return (int64_t)(lanes[0] + lanes[1] + (uint64_t)sumIntScalar(values + i, n - i));
+}
+
+// Register k holds lanes 2k and 2k+1
+SSE42 static double sumFloatSSE42(const double* values, size_t n) {
+  __m128d s[SumLanes / 2];
+  for (size_t k = 0; k < SumLanes / 2; ++k) s[k] = _mm_set1_pd(-0.0);
+  size_t i = 0;
+  for (; i + SumLanes <= n; i += SumLanes) {
+    for (size_t k = 0; k < SumLanes / 2; ++k) {
+      s[k] = _mm_add_pd(s[k], _mm_loadu_pd(values + i + (k * 2)));
+    }
+  }
+  double lanes[SumLanes];
+  for (size_t k = 0; k < SumLanes / 2; ++k) _mm_storeu_pd(lanes + (k * 2), s[k]);
+  return finishSum(lanes, values, i, n);
+}
+
+SSE42 static int64_t minIntSSE42(const int64_t* values, size_t n) {
+  __m128i m0 = _mm_set1_epi64x(values[0]), m1 = m0;
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m128i* p = (const __m128i*)(values + i);
+    __m128i a = _mm_loadu_si128(p), b = _mm_loadu_si128(p + 1);
+    m0 = _mm_blendv_epi8(m0, a, _mm_cmpgt_epi64(m0, a));
+    m1 = _mm_blendv_epi8(m1, b, _mm_cmpgt_epi64(m1, b));
+  }
+  int64_t lanes[3];
+  _mm_storeu_si128((__m128i*)lanes, _mm_blendv_epi8(m0, m1, _mm_cmpgt_epi64(m0, m1)));
+  lanes[2] = (i < n) ? minIntScalar(values + i, n - i) : lanes[0];
+  return minIntScalar(lanes, 3);
+}
+
+SSE42 static int64_t maxIntSSE42(const int64_t* values, size_t n) {
+  __m128i m0 = _mm_set1_epi64x(values[0]), m1 = m0;
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m128i* p = (const __m128i*)(values + i);
+    __m128i a = _mm_loadu_si128(p), b = _mm_loadu_si128(p + 1);
+    m0 = _mm_blendv_epi8(m0, a, _mm_cmpgt_epi64(a, m0));
+    m1 = _mm_blendv_epi8(m1, b, _mm_cmpgt_epi64(b, m1));
+  }
+  int64_t lanes[3];
+  _mm_storeu_si128((__m128i*)lanes, _mm_blendv_epi8(m0, m1, _mm_cmpgt_epi64(m1, m0)));
+  lanes[2] = (i < n) ? maxIntScalar(values + i, n - i) : lanes[0];
+  return maxIntScalar(lanes, 3);
+}
+
+// NaNs are tracked separately since minpd/maxpd just return one of the operands
+SSE42 static double minFloatSSE42(const double* values, size_t n) {
+  __m128d m0 = _mm_set1_pd(values[0]), m1 = m0;
+  __m128d nan = _mm_setzero_pd();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128d a = _mm_loadu_pd(values + i), b = _mm_loadu_pd(values + i + 2);
+    nan = _mm_or_pd(nan, _mm_cmpunord_pd(a, b));
+    m0 = _mm_min_pd(m0, a);
+    m1 = _mm_min_pd(m1, b);
+  }
+  if (_mm_movemask_pd(nan) != 0) return NAN;
+  double lanes[3];
+  _mm_storeu_pd(lanes, _mm_min_pd(m0, m1));
+  lanes[2] = (i < n) ? minFloatScalar(values + i, n - i) : lanes[0];
+  return minFloatScalar(lanes, 3);
+}
+
+SSE42 static double maxFloatSSE42(const double* values, size_t n) {
+  __m128d m0 = _mm_set1_pd(values[0]), m1 = m0;
+  __m128d nan = _mm_setzero_pd();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128d a = _mm_loadu_pd(values + i), b = _mm_loadu_pd(values + i + 2);
+    nan = _mm_or_pd(nan, _mm_cmpunord_pd(a, b));
+    m0 = _mm_max_pd(m0, a);
+    m1 = _mm_max_pd(m1, b);
+  }
+  if (_mm_movemask_pd(nan) != 0) return NAN;
+  double lanes[3];
+  _mm_storeu_pd(lanes, _mm_max_pd(m0, m1));
+  lanes[2] = (i < n) ? maxFloatScalar(values + i, n - i) : lanes[0];
+  return maxFloatScalar(lanes, 3);
+}
+
+// Shuffles which pack eight 16-bit words, each holding one or two bytes of UTF-8, into
+// consecutive bytes. Indexed by a mask of the words which hold a single byte.
+struct UTF8PackTable {
+  uint8_t shuffle[256][16];
+  uint8_t length[256];
+  UTF8PackTable() {
+    for (unsigned mask = 0; mask < 256; ++mask) {
+      uint8_t n = 0;
+      for (uint8_t j = 0; j < 8; ++j) {
+        shuffle[mask][n++] = 2 * j;
+        if (!(mask & (1 << j))) shuffle[mask][n++] = (2 * j) + 1;
+      }
+      length[mask] = n;
+      while (n < 16) shuffle[mask][n++] = 0x80;
+    }
+  }
+};
+
+static const UTF8PackTable& utf8PackTable() {
+  static const UTF8PackTable table;
+  return table;
+}
+
+// Encodes eight code points below U+0800, given as 16-bit words, and returns the end
+// of the output. Writes 16 bytes to *out* whatever the length of the output.
+SSE42 static inline char* encodeUTF8TwoByteSSE42(__m128i v, char* out,
+                                                 const UTF8PackTable& table) {
+  __m128i ascii = _mm_cmplt_epi16(v, _mm_set1_epi16(0x80));
+  __m128i lead = _mm_or_si128(_mm_srli_epi16(v, 6), _mm_set1_epi16(0xc0));
+  __m128i cont = _mm_or_si128(_mm_and_si128(v, _mm_set1_epi16(0x3f)), _mm_set1_epi16(0x80));
+  __m128i words = _mm_blendv_epi8(_mm_or_si128(lead, _mm_slli_epi16(cont, 8)), v, ascii);
+  unsigned mask = _mm_movemask_epi8(_mm_packs_epi16(ascii, _mm_setzero_si128()));
+  __m128i shuffle = _mm_loadu_si128((const __m128i*)table.shuffle[mask]);
+  _mm_storeu_si128((__m128i*)out, _mm_shuffle_epi8(words, shuffle));
+  return out + table.length[mask];
+}
+
+// Output never runs ahead of 4 bytes per code point read, so while 16 code points
+// remain there's room for the 16-byte stores.
+SSE42 static size_t encodeUTF8SSE42(const uint32_t* chars, size_t n, char* out) {
+  const UTF8PackTable& table = utf8PackTable();
+  const __m128i notASCII = _mm_set1_epi32(~0x7f);
+  const __m128i notTwoByte = _mm_set1_epi32(~0x7ff);
+  char* start = out;
+  size_t i = 0;
+  while (i + 16 <= n) {
+    const __m128i* p = (const __m128i*)(chars + i);
+    __m128i a = _mm_loadu_si128(p), b = _mm_loadu_si128(p + 1);
+    __m128i c = _mm_loadu_si128(p + 2), d = _mm_loadu_si128(p + 3);
+    __m128i ab = _mm_or_si128(a, b);
+    if (_mm_testz_si128(_mm_or_si128(ab, _mm_or_si128(c, d)), notASCII)) {
+      __m128i bytes = _mm_packus_epi16(_mm_packus_epi32(a, b), _mm_packus_epi32(c, d));
+      _mm_storeu_si128((__m128i*)out, bytes);
+      out += 16;
+      i += 16;
+    } else if (_mm_testz_si128(ab, notTwoByte)) {
+      out = encodeUTF8TwoByteSSE42(_mm_packus_epi32(a, b), out, table);
+      i += 8;
+    } else {
+      for (size_t end = i + 8; i != end; ++i) out = encodeUTF8Char(chars[i], out);
+    }
+  }
+  for (; i < n; ++i) out = encodeUTF8Char(chars[i], out);
+  return out - start;
+}
+
+static const SIMDKernels sse42Kernels = {
+  SIMDSSE42, "sse4.2",
+  findIntSSE42, findFloatSSE42, countIntSSE42, countFloatSSE42,
+  sumIntSSE42, sumFloatSSE42, minIntSSE42, maxIntSSE42, minFloatSSE42, maxFloatSSE42,
+  encodeUTF8SSE42,
+};
+
+// -- AVX2 --
+// Like the SSE4.2 versions, with twice as many values per register
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static size_t findIntAVX2(const int64_t* values, size_t n, int64_t value) {
+  __m256i x = _mm256_set1_epi64x(value);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m256i* p = (const __m256i*)(values + i);
+    __m256i eq = _mm256_or_si256(
+      _mm256_or_si256(_mm256_cmpeq_epi64(_mm256_loadu_si256(p), x),
+                      _mm256_cmpeq_epi64(_mm256_loadu_si256(p + 1), x)),
+      _mm256_or_si256(_mm256_cmpeq_epi64(_mm256_loadu_si256(p + 2), x),
+                      _mm256_cmpeq_epi64(_mm256_loadu_si256(p + 3), x)));
+    if (!_mm256_testz_si256(eq, eq)) break;
+  }
+  while (i < n && values[i] != value) ++i;
+  return i;
+}
+
+AVX2 static size_t findFloatAVX2(const double* values, size_t n, double value) {
+  __m256d x = _mm256_set1_pd(value);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const double* p = values + i;
+    __m256d eq = _mm256_or_pd(
+      _mm256_or_pd(_mm256_cmp_pd(_mm256_loadu_pd(p), x, _CMP_EQ_OQ),
+                   _mm256_cmp_pd(_mm256_loadu_pd(p + 4), x, _CMP_EQ_OQ)),
+      _mm256_or_pd(_mm256_cmp_pd(_mm256_loadu_pd(p + 8), x, _CMP_EQ_OQ),
+                   _mm256_cmp_pd(_mm256_loadu_pd(p + 12), x, _CMP_EQ_OQ)));
+    if (_mm256_movemask_pd(eq) != 0) break;
+  }
+  while (i < n && !(values[i] == value)) ++i;
+  return i;
+}
+
+AVX2 static uint64_t addLanesAVX2(__m256i v) {
+  uint64_t lanes[4];
+  _mm256_storeu_si256((__m256i*)lanes, v);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+AVX2 static size_t countIntAVX2(const int64_t* values, size_t n, int64_t value) {
+  __m256i x = _mm256_set1_epi64x(value);
+  __m256i c0 = _mm256_setzero_si256(), c1 = c0, c2 = c0, c3 = c0;
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m256i* p = (const __m256i*)(values + i);
+    c0 = _mm256_sub_epi64(c0, _mm256_cmpeq_epi64(_mm256_loadu_si256(p), x));
+    c1 = _mm256_sub_epi64(c1, _mm256_cmpeq_epi64(_mm256_loadu_si256(p + 1), x));
+    c2 = _mm256_sub_epi64(c2, _mm256_cmpeq_epi64(_mm256_loadu_si256(p + 2), x));
+    c3 = _mm256_sub_epi64(c3, _mm256_cmpeq_epi64(_mm256_loadu_si256(p + 3), x));
+  }
+  __m256i c = _mm256_add_epi64(_mm256_add_epi64(c0, c1), _mm256_add_epi64(c2, c3));
+  return addLanesAVX2(c) + countIntScalar(values + i, n - i, value);
+}
+
+AVX2 static size_t countFloatAVX2(const double* values, size_t n, double value) {
+  __m256d x = _mm256_set1_pd(value);
+  __m256i c0 = _mm256_setzero_si256(), c1 = c0, c2 = c0, c3 = c0;
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const double* p = values + i;
+    c0 = _mm256_sub_epi64(c0, _mm256_castpd_si256(
+      _mm256_cmp_pd(_mm256_loadu_pd(p), x, _CMP_EQ_OQ)));
+    c1 = _mm256_sub_epi64(c1, _mm256_castpd_si256(
+      _mm256_cmp_pd(_mm256_loadu_pd(p + 4), x, _CMP_EQ_OQ)));
+    c2 = _mm256_sub_epi64(c2, _mm256_castpd_si256(
+      _mm256_cmp_pd(_mm256_loadu_pd(p + 8), x, _CMP_EQ_OQ)));
+    c3 = _mm256_sub_epi64(c3, _mm256_castpd_si256(
+      _mm256_cmp_pd(_mm256_loadu_pd(p + 12), x, _CMP_EQ_OQ)));
+  }
+  __m256i c = _mm256_add_epi64(_mm256_add_epi64(c0, c1), _mm256_add_epi64(c2, c3));
+  return addLanesAVX2(c) + countFloatScalar(values + i, n - i, value);
+}
+
+AVX2 static int64_t sumIntAVX2(const int64_t* values, size_t n) {
+  __m256i s0 = _mm256_setzero_si256(), s1 = s0, s2 = s0, s3 = s0;
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m256i* p = (const __m256i*)(values + i);
+    s0 = _mm256_add_epi64(s0, _mm256_loadu_si256(p));
+    s1 = _mm256_add_epi64(s1, _mm256_loadu_si256(p + 1));
+    s2 = _mm256_add_epi64(s2, _mm256_loadu_si256(p + 2));
+    s3 = _mm256_add_epi64(s3, _mm256_loadu_si256(p + 3));
+  }
+  __m256i s = _mm256_add_epi64(_mm256_add_epi64(s0, s1), _mm256_add_epi64(s2, s3));
+  return (int64_t)(addLanesAVX2(s) + (uint64_t)sumIntScalar(values + i, n - i));
+}
+
+// Register k holds lanes 4k...4k+3
+AVX2 static double sumFloatAVX2(const double* values, size_t n) {
+  __m256d s0 = _mm256_set1_pd(-0.0), s1 = s0, s2 = s0, s3 = s0;
+  size_t i = 0;
+  for (; i + SumLanes <= n; i += SumLanes) {
+    const double* p = values + i;
+    s0 = _mm256_add_pd(s0, _mm256_loadu_pd(p));
+    s1 = _mm256_add_pd(s1, _mm256_loadu_pd(p + 4));
+    s2 = _mm256_add_pd(s2, _mm256_loadu_pd(p + 8));
+    s3 = _mm256_add_pd(s3, _mm256_loadu_pd(p + 12));
+  }
+  double lanes[SumLanes];
+  _mm256_storeu_pd(lanes, s0);
+  _mm256_storeu_pd(lanes + 4, s1);
+  _mm256_storeu_pd(lanes + 8, s2);
+  _mm256_storeu_pd(lanes + 12, s3);
+  return finishSum(lanes, values, i, n);
+}
+
+AVX2 static int64_t minIntAVX2(const int64_t* values, size_t n) {
+  __m256i m0 = _mm256_set1_epi64x(values[0]), m1 = m0;
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256i* p = (const __m256i*)(values + i);
+    __m256i a = _mm256_loadu_si256(p), b = _mm256_loadu_si256(p + 1);
+    m0 = _mm256_blendv_epi8(m0, a, _mm256_cmpgt_epi64(m0, a));
+    m1 = _mm256_blendv_epi8(m1, b, _mm256_cmpgt_epi64(m1, b));
+  }
+  int64_t lanes[5];
+  _mm256_storeu_si256((__m256i*)lanes, _mm256_blendv_epi8(m0, m1, _mm256_cmpgt_epi64(m0, m1)));
+  lanes[4] = (i < n) ? minIntScalar(values + i, n - i) : lanes[0];
+  return minIntScalar(lanes, 5);
+}
+
+AVX2 static int64_t maxIntAVX2(const int64_t* values, size_t n) {
+  __m256i m0 = _mm256_set1_epi64x(values[0]), m1 = m0;
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256i* p = (const __m256i*)(values + i);
+    __m256i a = _mm256_loadu_si256(p), b = _mm256_loadu_si256(p + 1);
+    m0 = _mm256_blendv_epi8(m0, a, _mm256_cmpgt_epi64(a, m0));
+    m1 = _mm256_blendv_epi8(m1, b, _mm256_cmpgt_epi64(b, m1));
+  }
+  int64_t lanes[5];
+  _mm256_storeu_si256((__m256i*)lanes, _mm256_blendv_epi8(m0, m1, _mm256_cmpgt_epi64(m1, m0)));
+  lanes[4] = (i < n) ? maxIntScalar(values + i, n - i) : lanes[0];
+  return maxIntScalar(lanes, 5);
+}
+
+AVX2 static double minFloatAVX2(const double* values, size_t n) {
+  __m256d m0 = _mm256_set1_pd(values[0]), m1 = m0;
+  __m256d nan = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256d a = _mm256_loadu_pd(values + i), b = _mm256_loadu_pd(values + i + 4);
+    nan = _mm256_or_pd(nan, _mm256_cmp_pd(a, b, _CMP_UNORD_Q));
+    m0 = _mm256_min_pd(m0, a);
+    m1 = _mm256_min_pd(m1, b);
+  }
+  if (_mm256_movemask_pd(nan) != 0) return NAN;
+  double lanes[5];
+  _mm256_storeu_pd(lanes, _mm256_min_pd(m0, m1));
+  lanes[4] = (i < n) ? minFloatScalar(values + i, n - i) : lanes[0];
+  return minFloatScalar(lanes, 5);
+}
+
+AVX2 static double maxFloatAVX2(const double* values, size_t n) {
+  __m256d m0 = _mm256_set1_pd(values[0]), m1 = m0;
+  __m256d nan = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256d a = _mm256_loadu_pd(values + i), b = _mm256_loadu_pd(values + i + 4);
+    nan = _mm256_or_pd(nan, _mm256_cmp_pd(a, b, _CMP_UNORD_Q));
+    m0 = _mm256_max_pd(m0, a);
+    m1 = _mm256_max_pd(m1, b);
+  }
+  if (_mm256_movemask_pd(nan) != 0) return NAN;
+  double lanes[5];
+  _mm256_storeu_pd(lanes, _mm256_max_pd(m0, m1));
+  lanes[4] = (i < n) ? maxFloatScalar(values + i, n - i) : lanes[0];
+  return maxFloatScalar(lanes, 5);
+}
+
+// Handles 32 ASCII or 16 two-byte code points per iteration and leaves the last 31
+// code points to the SSE4.2 version
+AVX2 static size_t encodeUTF8AVX2(const uint32_t* chars, size_t n, char* out) {
+  const UTF8PackTable& table = utf8PackTable();
+  const __m256i notASCII = _mm256_set1_epi32(~0x7f);
+  const __m256i notTwoByte = _mm256_set1_epi32(~0x7ff);
+  char* start = out;
+  size_t i = 0;
+  while (i + 32 <= n) {
+    const __m256i* p = (const __m256i*)(chars + i);
+    __m256i a = _mm256_loadu_si256(p), b = _mm256_loadu_si256(p + 1);
+    __m256i c = _mm256_loadu_si256(p + 2), d = _mm256_loadu_si256(p + 3);
+    __m256i ab = _mm256_or_si256(a, b);
+    if (_mm256_testz_si256(_mm256_or_si256(ab, _mm256_or_si256(c, d)), notASCII)) {
+      // Packing works within 128-bit lanes, leaving groups of four bytes out of order
+      __m256i bytes = _mm256_packus_epi16(_mm256_packus_epi32(a, b),
+                                          _mm256_packus_epi32(c, d));
+      bytes = _mm256_permutevar8x32_epi32(bytes, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+      _mm256_storeu_si256((__m256i*)out, bytes);
+      out += 32;
+      i += 32;
+    } else if (_mm256_testz_si256(ab, notTwoByte)) {
+      __m256i v = _mm256_permute4x64_epi64(_mm256_packus_epi32(a, b), 0xd8);
+      __m256i ascii = _mm256_cmpgt_epi16(_mm256_set1_epi16(0x80), v);
+      __m256i lead = _mm256_or_si256(_mm256_srli_epi16(v, 6), _mm256_set1_epi16(0xc0));
+      __m256i cont = _mm256_or_si256(_mm256_and_si256(v, _mm256_set1_epi16(0x3f)),
+                                     _mm256_set1_epi16(0x80));
+      __m256i words = _mm256_blendv_epi8(
+        _mm256_or_si256(lead, _mm256_slli_epi16(cont, 8)), v, ascii);
+      unsigned mask = _mm256_movemask_epi8(_mm256_packs_epi16(ascii, _mm256_setzero_si256()));
+      unsigned mask0 = mask & 0xff, mask1 = (mask >> 16) & 0xff;
+      __m256i shuffle = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)table.shuffle[mask0])),
+        _mm_loadu_si128((const __m128i*)table.shuffle[mask1]), 1);
+      words = _mm256_shuffle_epi8(words, shuffle);
+      _mm_storeu_si128((__m128i*)out, _mm256_castsi256_si128(words));
+      out += table.length[mask0];
+      _mm_storeu_si128((__m128i*)out, _mm256_extracti128_si256(words, 1));
+      out += table.length[mask1];
+      i += 16;
+    } else {
+      for (size_t end = i + 8; i != end; ++i) out = encodeUTF8Char(chars[i], out);
+    }
+  }
+  out += encodeUTF8SSE42(chars + i, n - i, out);
+  return out - start;
+}
+
+static const SIMDKernels avx2Kernels = {
+  SIMDAVX2, "avx2",
+  findIntAVX2, findFloatAVX2, countIntAVX2, countFloatAVX2,
+  sumIntAVX2, sumFloatAVX2, minIntAVX2, maxIntAVX2, minFloatAVX2, maxFloatAVX2,
+  encodeUTF8AVX2,
+};
+
+#endif // HUE_SIMD_X86
+
+const SIMDKernels* simd_kernels(SIMDLevel level) {
+  #if HUE_SIMD_X86
+  __builtin_cpu_init();
+  if (level == SIMDAVX2) return __builtin_cpu_supports("avx2") ? &avx2Kernels : 0;
+  if (level == SIMDSSE42) return __builtin_cpu_supports("sse4.2") ? &sse42Kernels : 0;
+  #endif
+  return (level == SIMDScalar) ? &scalarKernels : 0;
+}
+
+static const SIMDKernels* bestKernels() {
+  for (int level = SIMDAVX2; level != SIMDScalar; --level) {
+    const SIMDKernels* kernels = simd_kernels((SIMDLevel)level);
+    if (kernels) return kernels;
+  }
+  return &scalarKernels;
+}
+
+const SIMDKernels& simd() {
+  static const SIMDKernels* kernels = bestKernels();
+  return *kernels;
+}
+
+} // namespace hue
@@ -0,0 +1,122 @@
+// Copyright (c) 2012, Rasmus Andersson. All rights reserved. Use of this source
+// code is governed by a MIT-style license that can be found in the LICENSE file.
+//
+// Search and reduction kernels over arrays of Ints (int64_t) and Floats (double),
+// used by Vector and TypedVector to process one leaf at a time, and a UTF-32 to UTF-8
+// encoder used by stdout_write for text.
+//
+// Each kernel comes in a scalar, an SSE4.2 and an AVX2 version. The best version the
+// CPU supports is picked the first time simd() is called, so the runtime library
+// needn't be built for a particular CPU.
+//
+// Floats are summed in 16 interleaved lanes which are added up pairwise at the end.
+// All versions use the same order, so they return identical sums, but a sum can differ
+// in the last bits from that of a plain loop.
+//
+#ifndef _HUE_RUNTIME_SIMD_INCLUDED
+#define _HUE_RUNTIME_SIMD_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace hue {
+
+enum SIMDLevel {
+  SIMDScalar = 0,
+  SIMDSSE42,
+  SIMDAVX2,
+};
+
+// Min and max require n > 0. The Float versions return NaN if any value is NaN, and
+// either zero if both -0.0 and 0.0 are present. Float search compares with ==, so it
+// never finds NaN and finds -0.0 and 0.0 alike.
+struct SIMDKernels {
+  SIMDLevel level;
+  const char* name;
+  // Index of the first value equal to *value*, or n if there is none
+  size_t (*findInt)(const int64_t* values, size_t n, int64_t value);
+  size_t (*findFloat)(const double* values, size_t n, double value);
+  // Number of values equal to *value*
+  size_t (*countInt)(const int64_t* values, size_t n, int64_t value);
+  size_t (*countFloat)(const double* values, size_t n, double value);
+  // Sum of the values. Int sums wrap around on overflow.
+  int64_t (*sumInt)(const int64_t* values, size_t n);
+  double (*sumFloat)(const double* values, size_t n);
+  int64_t (*minInt)(const int64_t* values, size_t n);
+  int64_t (*maxInt)(const int64_t* values, size_t n);
+  double (*minFloat)(const double* values, size_t n);
+  double (*maxFloat)(const double* values, size_t n);
+  // Encodes code points as UTF-8 into *out*, which must have room for 4 * n bytes, and
+  // returns the number of bytes written. Surrogates and values past U+10FFFF are
+  // skipped. Runs of ASCII and of code points below U+0800 are encoded 16 or 32 at a
+  // time, others one at a time.
+  size_t (*encodeUTF8)(const uint32_t* chars, size_t n, char* out);
+};
+
+// Kernels for *level*, or 0 if the CPU doesn't support that level
+const SIMDKernels* simd_kernels(SIMDLevel level);
+
+// Kernels for the best level the CPU supports
+const SIMDKernels& simd();
+
+// Overloads for the element types of TypedVector, so generic code can call the
+// kernels for Ints and Floats and fall back to plain loops for other types.
+template <typename T> inline size_t simd_find(const T* values, size_t n, T value) {
+  size_t i = 0;
+  while (i < n && !(values[i] == value)) ++i;
+  return i;
+}
+template <typename T> inline size_t simd_count(const T* values, size_t n, T value) {
+  size_t count = 0;
+  for (size_t i = 0; i < n; ++i) count += (values[i] == value);
+  return count;
+}
+template <typename T> inline T simd_sum(const T* values, size_t n) {
+  T sum = T();
+  for (size_t i = 0; i < n; ++i) sum += values[i];
+  return sum;
+}
+template <typename T> inline T simd_min(const T* values, size_t n) {
+  T min = values[0];
+  for (size_t i = 1; i < n; ++i) if (values[i] < min) min = values[i];
+  return min;
+}
+template <typename T> inline T simd_max(const T* values, size_t n) {
+  T max = values[0];
+  for (size_t i = 1; i < n; ++i) if (max < values[i]) max = values[i];
+  return max;
+}
+
+inline size_t simd_find(const int64_t* values, size_t n, int64_t value) {
+  return simd().findInt(values, n, value);
+}
+inline size_t simd_find(const double* values, size_t n, double value) {
+  return simd().findFloat(values, n, value);
+}
+inline size_t simd_count(const int64_t* values, size_t n, int64_t value) {
+  return simd().countInt(values, n, value);
+}
+inline size_t simd_count(const double* values, size_t n, double value) {
+  return simd().countFloat(values, n, value);
+}
+inline int64_t simd_sum(const int64_t* values, size_t n) {
+  return simd().sumInt(values, n);
+}
+inline double simd_sum(const double* values, size_t n) {
+  return simd().sumFloat(values, n);
+}
+inline int64_t simd_min(const int64_t* values, size_t n) {
+  return simd().minInt(values, n);
+}
+inline double simd_min(const double* values, size_t n) {
+  return simd().minFloat(values, n);
+}
+inline int64_t simd_max(const int64_t* values, size_t n) {
+  return simd().maxInt(values, n);
+}
+inline double simd_max(const double* values, size_t n) {
+  return simd().maxFloat(values, n);
+}
+
+} // namespace hue
+#endif // _HUE_RUNTIME_SIMD_INCLUDED
@@ -0,0 +1,186 @@
+// Copyright (c) 2012, Rasmus Andersson. All rights reserved. Use of this source
+// code is governed by a MIT-style license that can be found in the LICENSE file.
+#include "slab.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+// AddressSanitizer can't see use-after-free or leaks of blocks inside a slab, so
+// when it's enabled every block is allocated on its own.
+#if defined(__SANITIZE_ADDRESS__)
+#define SLAB_BYPASS 1
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define SLAB_BYPASS 1
+#endif
+#endif
+
+namespace hue {
+
+// Blocks allocated by the calling thread
+static __thread size_t thread_allocs __attribute__((tls_model("initial-exec"))) = 0;
+
+size_t slab_thread_allocs() { return thread_allocs; }
+
+#ifdef SLAB_BYPASS
+void* slab_alloc(size_t size) { ++thread_allocs; return malloc(size); }
+void slab_dealloc(void* ptr, size_t size) { free(ptr); }
+#else
+
+static const size_t Granularity = 16;
+static const size_t ClassCount = SlabMaxSize / Granularity;
+static const size_t SlabSize = 64 * 1024;
+static const uint32_t BatchSize = 64; // blocks moved to or from the depot at a time
+
+struct Block { Block* next; };
+
+struct FreeList {
+  Block* head;
+  uint32_t count;
+};
+
+struct ThreadCache {
+  FreeList lists[ClassCount];
+  bool registered;
+};
+
+// Blocks not cached by any thread
+struct Depot {
+  int lock;
+  Block* head;
+};
+
+static Depot depots[ClassCount];
+static __thread ThreadCache tcache __attribute__((tls_model("initial-exec")));
+static pthread_key_t tcacheKey;
+static pthread_once_t tcacheKeyOnce = PTHREAD_ONCE_INIT;
+
+static inline size_t classOf(size_t size) {
+  return (size == 0) ? 0 : (size - 1) / Granularity;
+}
+
+static inline void lock(Depot& depot) {
+  while (__sync_lock_test_and_set(&depot.lock, 1)) {
+    while (__atomic_load_n(&depot.lock, __ATOMIC_RELAXED)) {}
+  }
+}
+
+static inline void unlock(Depot& depot) {
+  __sync_lock_release(&depot.lock);
+}
+
+// Moves the list head...tail into the depot
+static void depositChain(size_t cls, Block* head, Block* tail) {
+  Depot& depot = depots[cls];
+  lock(depot);
+  tail->next = depot.head;
+  depot.head = head;
+  unlock(depot);
+}
+
+// Hands all blocks cached by an exiting thread over to the depot
+static void flushThreadCache(void* arg) {
+  ThreadCache* cache = (ThreadCache*)arg;
+  for (size_t cls = 0; cls < ClassCount; ++cls) {
+    FreeList& list = cache->lists[cls];
+    if (list.head == 0) continue;
+    Block* tail = list.head;
+    while (tail->next) tail = tail->next;
+    depositChain(cls, list.head, tail);
+    list.head = 0;
+    list.count = 0;
+  }
+  // Blocks freed by destructors that run after this one are cached again
+  cache->registered = false;
+}
+
+static void makeThreadCacheKey() {
+  pthread_key_create(&tcacheKey, flushThreadCache);
+}
+
+// Makes sure the blocks cached by this thread are returned to the depot when it exits
+static inline void registerThread() {
+  if (!tcache.registered) {
+    pthread_once(&tcacheKeyOnce, makeThreadCacheKey);
+    pthread_setspecific(tcacheKey, &tcache);
+    tcache.registered = true;
+  }
+}
+
+// Refills the free list of size class cls. Returns false if memory is exhausted.
+static bool refill(size_t cls) {
+  registerThread();
+  FreeList& list = tcache.lists[cls];
+
+  // Take a batch from the depot
+  Depot& depot = depots[cls];
+  lock(depot);
+  Block* head = depot.head;
+  Block* tail = head;
+  uint32_t count = 0;
+  if (head) {
+    for (count = 1; count < BatchSize && tail->next; ++count) tail = tail->next;
+    depot.head = tail->next;
+  }
+  unlock(depot);
+
+  if (head) {
+    tail->next = list.head;
+    list.head = head;
+    list.count += count;
+    return true;
+  }
+
+  // Carve a new slab
+  size_t blockSize = (cls + 1) * Granularity;
+  uint8_t* slab = (uint8_t*)malloc(SlabSize);
+  if (slab == 0) return false;
+  size_t n = SlabSize / blockSize;
+  for (size_t i = n; i != 0; --i) {
+    Block* block = (Block*)(slab + ((i - 1) * blockSize));
+    block->next = list.head;
+    list.head = block;
+  }
+  list.count += n;
+  return true;
+}
+
+void* slab_alloc(size_t size) {
+  ++thread_allocs;
+  if (size > SlabMaxSize) return malloc(size);
+  size_t cls = classOf(size);
+  FreeList& list = tcache.lists[cls];
+  if (list.head == 0 && !refill(cls)) return 0;
+  Block* block = list.head;
+  list.head = block->next;
+  --list.count;
+  return block;
+}
+
+void slab_dealloc(void* ptr, size_t size) {
+  if (size > SlabMaxSize) {
+    free(ptr);
+    return;
+  }
+  size_t cls = classOf(size);
+  FreeList& list = tcache.lists[cls];
+  Block* block = (Block*)ptr;
+  block->next = list.head;
+  list.head = block;
+
+  // Hand a batch over to the depot if this thread is hoarding blocks
+  if (++list.count > BatchSize * 2) {
+    registerThread();
+    Block* tail = list.head;
+    for (uint32_t i = 1; i < BatchSize; ++i) tail = tail->next;
+    Block* head = list.head;
+    list.head = tail->next;
+    list.count -= BatchSize;
+    depositChain(cls, head, tail);
+  }
+}
+
+#endif // SLAB_BYPASS
+
+} // namespace hue
@@ -0,0 +1,35 @@
+// Copyright (c) 2012, Rasmus Andersson. All rights reserved. Use of this source
+// code is governed by a MIT-style license that can be found in the LICENSE file.
+//
+// A size-class slab allocator for the many small objects the runtime creates and
+// destroys, like vector nodes.
+//
+// Blocks of up to SlabMaxSize bytes are carved out of 64 kB slabs, with one size
+// class per 16 bytes. Each thread keeps its own free list for every size class, so
+// allocating and freeing a block usually takes no locks at all. Free lists are topped
+// up from and drained into a shared depot in batches. Larger blocks are passed on to
+// malloc.
+//
+// Memory held by slabs is reused but never returned to the system.
+//
+#ifndef _HUE_RUNTIME_SLAB_INCLUDED
+#define _HUE_RUNTIME_SLAB_INCLUDED
+
+#include <stddef.h>
+
+namespace hue {
+
+// Largest block served from a slab
+static const size_t SlabMaxSize = 1024;
+
+// Allocates a block of at least *size* bytes, aligned to 16 bytes
+void* slab_alloc(size_t size);
+
+// Frees a block returned by slab_alloc. *size* must be the size passed to slab_alloc.
+void slab_dealloc(void* ptr, size_t size);
+
+// Number of blocks allocated by slab_alloc on the calling thread so far
+size_t slab_thread_allocs();
+
+} // namespace hue
+#endif // _HUE_RUNTIME_SLAB_INCLUDED
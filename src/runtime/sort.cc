@@ -0,0 +1,196 @@
+// Copyright (c) 2012, Rasmus Andersson. All rights reserved. Use of this source
+// code is governed by a MIT-style license that can be found in the LICENSE file.
+#include "sort.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace hue {
+
+// Inputs are split into about this many blocks per worker, so that a worker which
+// finishes early can steal some of the remaining work
+static const size_t BlocksPerWorker = 4;
+
+// Smallest block worth a task of its own
+static const size_t MinBlockSize = 4096;
+
+// Radix sort digits, in bits
+static const size_t RadixBits = 8;
+static const size_t Radix = 1 << RadixBits;
+static const size_t RadixPasses = 64 / RadixBits;
+
+// Number of sample values per bucket of the sample sort
+static const size_t Oversampling = 32;
+
+static size_t blockCount(size_t n, ThreadPool& pool) {
+  size_t blocks = std::min(pool.size() * BlocksPerWorker, n / MinBlockSize);
+  return blocks ? blocks : 1;
+}
+
+static inline size_t blockStart(size_t n, size_t blocks, size_t b) {
+  return (size_t)(((__uint128_t)n * b) / blocks);
+}
+
+// Calls fn(b) for each block b in [0, blocks), block 0 on the calling thread
+template <typename F>
+static void parallelFor(size_t blocks, F fn, ThreadPool& pool) {
+  ThreadPool::TaskGroup group(pool);
+  for (size_t b = 1; b < blocks; ++b) {
+    group.spawn([&fn, b]() { fn(b); });
+  }
+  fn(0);
+  group.wait();
+}
+
+// Splits [0, n) into *blocks* ranges and calls fn(b, start, end) for each block b
+template <typename F>
+static void parallelForBlocks(size_t n, size_t blocks, F fn, ThreadPool& pool) {
+  parallelFor(blocks, [&](size_t b) {
+    fn(b, blockStart(n, blocks, b), blockStart(n, blocks, b + 1));
+  }, pool);
+}
+
+// Copies src to dst in parallel
+template <typename T>
+static void parallelCopy(T* dst, const T* src, size_t n, size_t blocks, ThreadPool& pool) {
+  parallelForBlocks(n, blocks, [=](size_t, size_t start, size_t end) {
+    memcpy(dst + start, src + start, sizeof(T) * (end - start));
+  }, pool);
+}
+
+// -- Ints --
+
+// Flipping the sign bit makes the unsigned order of keys the signed order of values
+static inline size_t digit(int64_t value, size_t pass) {
+  return (((uint64_t)value ^ ((uint64_t)1 << 63)) >> (pass * RadixBits)) & (Radix - 1);
+}
+
+void sort_ints(int64_t* values, size_t n, ThreadPool& pool) {
+  if (n < SortParallelMin) {
+    std::sort(values, values + n);
+    return;
+  }
+  size_t blocks = blockCount(n, pool);
+  std::vector<size_t> counts(blocks * Radix); // counts[b * Radix + digit] of block b
+
+  // Counts of each digit over all values, for finding passes which can be skipped.
+  // These don't depend on the order of the values, so they're only computed once.
+  std::vector<size_t> totals(RadixPasses * Radix);
+  {
+    std::vector<size_t> blockTotals(blocks * RadixPasses * Radix);
+    parallelForBlocks(n, blocks, [&](size_t b, size_t start, size_t end) {
+      size_t* c = &blockTotals[b * totals.size()];
+      for (size_t i = start; i < end; ++i) {
+        for (size_t pass = 0; pass < RadixPasses; ++pass) {
+          ++c[(pass * Radix) + digit(values[i], pass)];
+        }
+      }
+    }, pool);
+    for (size_t j = 0; j < blockTotals.size(); ++j) totals[j % totals.size()] += blockTotals[j];
+  }
+
+  int64_t* scratch = new int64_t[n];
+  int64_t* src = values;
+  int64_t* dst = scratch;
+  for (size_t pass = 0; pass < RadixPasses; ++pass) {
+    if (totals[(pass * Radix) + digit(src[0], pass)] == n) continue; // all the same
+
+    parallelForBlocks(n, blocks, [&](size_t b, size_t start, size_t end) {
+      size_t* c = &counts[b * Radix];
+      memset(c, 0, sizeof(size_t) * Radix);
+      for (size_t i = start; i < end; ++i) ++c[digit(src[i], pass)];
+    }, pool);
+
+    // Turn the counts into offsets: values with a smaller digit come first, and among
+    // values with the same digit, those of earlier blocks
+    size_t offset = 0;
+    for (size_t d = 0; d < Radix; ++d) {
+      for (size_t b = 0; b < blocks; ++b) {
+        size_t count = counts[(b * Radix) + d];
+        counts[(b * Radix) + d] = offset;
+        offset += count;
+      }
+    }
+
+    parallelForBlocks(n, blocks, [&](size_t b, size_t start, size_t end) {
+      size_t* offsets = &counts[b * Radix];
+      for (size_t i = start; i < end; ++i) dst[offsets[digit(src[i], pass)]++] = src[i];
+    }, pool);
+    std::swap(src, dst);
+  }
+
+  if (src != values) parallelCopy(values, src, n, blocks, pool);
+  delete[] scratch;
+}
+
+// -- Floats --
+
+void sort_floats(double* values, size_t n, ThreadPool& pool) {
+  n = std::partition(values, values + n, [](double v) { return v == v; }) - values;
+  // Unlike the radix sort, this is only faster than std::sort when the buckets are
+  // sorted at the same time
+  size_t buckets = blockCount(n, pool);
+  if (n < SortParallelMin || buckets == 1 || pool.size() == 1) {
+    std::sort(values, values + n);
+    return;
+  }
+
+  // Pick buckets-1 splitters from a sorted sample. Bucket k holds the values v where
+  // splitters[k-1] <= v < splitters[k].
+  std::vector<double> sample(buckets * Oversampling);
+  uint64_t x = 88172645463325252ULL;
+  for (size_t i = 0; i < sample.size(); ++i) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    sample[i] = values[(size_t)(((__uint128_t)x * n) >> 64)];
+  }
+  std::sort(sample.begin(), sample.end());
+  std::vector<double> splitters(buckets - 1);
+  for (size_t k = 1; k < buckets; ++k) splitters[k - 1] = sample[k * Oversampling];
+  const double* splittersBegin = splitters.data();
+  const double* splittersEnd = splittersBegin + splitters.size();
+  auto bucketOf = [=](double v) {
+    return (size_t)(std::upper_bound(splittersBegin, splittersEnd, v) - splittersBegin);
+  };
+
+  // Values are split into blocks (the same number as buckets), each of which counts
+  // and then scatters its values into the buckets
+  size_t blocks = buckets;
+  std::vector<size_t> counts(blocks * buckets); // counts[b * buckets + k]
+  parallelForBlocks(n, blocks, [&](size_t b, size_t start, size_t end) {
+    size_t* c = &counts[b * buckets];
+    for (size_t i = start; i < end; ++i) ++c[bucketOf(values[i])];
+  }, pool);
+
+  std::vector<size_t> bucketStart(buckets + 1);
+  size_t offset = 0;
+  for (size_t k = 0; k < buckets; ++k) {
+    bucketStart[k] = offset;
+    for (size_t b = 0; b < blocks; ++b) {
+      size_t count = counts[(b * buckets) + k];
+      counts[(b * buckets) + k] = offset;
+      offset += count;
+    }
+  }
+  bucketStart[buckets] = n;
+
+  double* scratch = new double[n];
+  parallelForBlocks(n, blocks, [&](size_t b, size_t start, size_t end) {
+    size_t* offsets = &counts[b * buckets];
+    for (size_t i = start; i < end; ++i) scratch[offsets[bucketOf(values[i])]++] = values[i];
+  }, pool);
+
+  // Each bucket is sorted and copied back by a task of its own
+  parallelFor(buckets, [&](size_t k) {
+    double* begin = scratch + bucketStart[k];
+    double* end = scratch + bucketStart[k + 1];
+    std::sort(begin, end);
+    memcpy(values + bucketStart[k], begin, sizeof(double) * (end - begin));
+  }, pool);
+  delete[] scratch;
+}
+
+} // namespace hue
@@ -0,0 +1,53 @@
+// Copyright (c) 2012, Rasmus Andersson. All rights reserved. Use of this source
+// code is governed by a MIT-style license that can be found in the LICENSE file.
+//
+// Parallel in-place sorting of Ints (int64_t) and Floats (double), used by the
+// sorted() operations of Vector and TypedVector.
+//
+// Ints are sorted by a least-significant-digit radix sort, one byte per pass. Each
+// pass splits the values into blocks, one per task, which first count the bytes of
+// their block and then scatter their values to the offsets worked out from all counts.
+// Passes where every value has the same byte are skipped, so small ranges of values
+// take fewer passes.
+//
+// Floats are sorted by a sample sort: splitters picked from a sorted random sample
+// divide the values into buckets, which are filled in parallel like a radix sort pass
+// and then sorted as separate tasks. NaNs are placed last. The order of -0.0 and 0.0
+// relative to each other is unspecified.
+//
+// Both use a scratch buffer as large as the input. Small inputs, and Floats when the
+// pool has a single worker, are sorted by the calling thread with std::sort.
+//
+#ifndef _HUE_RUNTIME_SORT_INCLUDED
+#define _HUE_RUNTIME_SORT_INCLUDED
+
+#include <hue/runtime/ThreadPool.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+
+namespace hue {
+
+// Inputs with fewer values than this are sorted by the calling thread
+static const size_t SortParallelMin = 16384;
+
+// Sorts *values* in ascending order
+void sort_ints(int64_t* values, size_t n, ThreadPool& pool = ThreadPool::shared());
+void sort_floats(double* values, size_t n, ThreadPool& pool = ThreadPool::shared());
+
+// Overloads for the element types of TypedVector. Types other than Int and Float are
+// sorted with std::sort.
+template <typename T> inline void sort_values(T* values, size_t n, ThreadPool& pool) {
+  std::sort(values, values + n);
+}
+inline void sort_values(int64_t* values, size_t n, ThreadPool& pool) {
+  sort_ints(values, n, pool);
+}
+inline void sort_values(double* values, size_t n, ThreadPool& pool) {
+  sort_floats(values, n, pool);
+}
+
+} // namespace hue
+#endif // _HUE_RUNTIME_SORT_INCLUDED
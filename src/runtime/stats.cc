@@ -0,0 +1,185 @@
+// Copyright (c) 2012, Rasmus Andersson. All rights reserved. Use of this source
+// code is governed by a MIT-style license that can be found in the LICENSE file.
+#include "stats.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <string>
+
+namespace hue {
+
+__thread StatsShard* stats_shard_ __attribute__((tls_model("initial-exec"))) = 0;
+
+// Shards of running threads, and the sum of the shards of threads which have exited
+static StatsShard* shards = 0;
+static StatsShard retired;
+static uint32_t shardCount = 0;
+static pthread_mutex_t shardsLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t shardKey;
+static pthread_once_t shardKeyOnce = PTHREAD_ONCE_INIT;
+
+static const char* typeNames[StatsMaxTypes];
+static uint32_t typeCount = 0;
+static pthread_mutex_t typesLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Bytes of live objects, as flushed by threads, and the highest value seen
+static int64_t liveBytes = 0;
+static int64_t peakBytes = 0;
+
+static void updatePeak(int64_t live) {
+  int64_t peak = __atomic_load_n(&peakBytes, __ATOMIC_RELAXED);
+  while (live > peak &&
+         !__atomic_compare_exchange_n(&peakBytes, &peak, live, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
+
+void stats_flush(StatsShard* shard) {
+  int64_t n = shard->unflushed;
+  shard->unflushed = 0;
+  updatePeak(__atomic_add_fetch(&liveBytes, n, __ATOMIC_RELAXED));
+}
+
+static void threadExited(void* arg) {
+  StatsShard* shard = (StatsShard*)arg;
+  stats_flush(shard);
+  pthread_mutex_lock(&shardsLock);
+  for (uint32_t i = 0; i < StatsMaxTypes; ++i) {
+    retired.allocs[i] += shard->allocs[i];
+    retired.frees[i] += shard->frees[i];
+  }
+  retired.allocBytes += shard->allocBytes;
+  retired.freeBytes += shard->freeBytes;
+  if (shard->prev) shard->prev->next = shard->next; else shards = shard->next;
+  if (shard->next) shard->next->prev = shard->prev;
+  --shardCount;
+  pthread_mutex_unlock(&shardsLock);
+  free(shard);
+  // Objects freed by later thread-exit handlers register a new shard
+  stats_shard_ = 0;
+}
+
+static void makeShardKey() {
+  pthread_key_create(&shardKey, threadExited);
+}
+
+StatsShard* stats_register_thread() {
+  pthread_once(&shardKeyOnce, makeShardKey);
+  StatsShard* shard = (StatsShard*)calloc(1, sizeof(StatsShard));
+  pthread_mutex_lock(&shardsLock);
+  shard->next = shards;
+  if (shards) shards->prev = shard;
+  shards = shard;
+  ++shardCount;
+  pthread_mutex_unlock(&shardsLock);
+  pthread_setspecific(shardKey, shard);
+  stats_shard_ = shard;
+  return shard;
+}
+
+// Extracts "hue::Vector::Node" from "static uint32_t hue::Vector::Node::__statsType()",
+// keeping any template arguments listed after it, like " [with T = long int]".
+static std::string typeNameOf(const char* prettyFunction) {
+  std::string s(prettyFunction);
+  size_t end = s.find("::__statsType()");
+  if (end == std::string::npos) return s;
+  size_t start = s.rfind(' ', end);
+  start = (start == std::string::npos) ? 0 : start + 1;
+  std::string name = s.substr(start, end - start);
+  size_t args = s.find(" [", end);
+  if (args != std::string::npos) name += s.substr(args);
+  return name;
+}
+
+uint32_t stats_register_type(const char* prettyFunction) {
+  std::string name = typeNameOf(prettyFunction);
+  pthread_mutex_lock(&typesLock);
+  uint32_t type = 0;
+  while (type < typeCount && name != typeNames[type]) ++type;
+  if (type == StatsMaxTypes) {
+    type = StatsMaxTypes - 1; // "(other)"
+  } else if (type == typeCount) {
+    typeNames[type] = strdup((type == StatsMaxTypes - 1) ? "(other)" : name.c_str());
+    __atomic_store_n(&typeCount, typeCount + 1, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&typesLock);
+  return type;
+}
+
+// Sum of all shards. Must be called with shardsLock held.
+static void sumShards(StatsShard& sum) {
+  sum = retired;
+  for (StatsShard* shard = shards; shard; shard = shard->next) {
+    for (uint32_t i = 0; i < StatsMaxTypes; ++i) {
+      sum.allocs[i] += __atomic_load_n(&shard->allocs[i], __ATOMIC_RELAXED);
+      sum.frees[i] += __atomic_load_n(&shard->frees[i], __ATOMIC_RELAXED);
+    }
+    sum.allocBytes += __atomic_load_n(&shard->allocBytes, __ATOMIC_RELAXED);
+    sum.freeBytes += __atomic_load_n(&shard->freeBytes, __ATOMIC_RELAXED);
+  }
+}
+
+} // namespace hue
+
+using namespace hue;
+
+extern "C" {
+
+void hue_stats_read(hue_stats_t* stats) {
+  StatsShard sum;
+  pthread_mutex_lock(&shardsLock);
+  sumShards(sum);
+  stats->thread_count = shardCount;
+  pthread_mutex_unlock(&shardsLock);
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  stats->time_ns = ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+  stats->alloc_count = 0;
+  stats->free_count = 0;
+  for (uint32_t i = 0; i < StatsMaxTypes; ++i) {
+    stats->alloc_count += sum.allocs[i];
+    stats->free_count += sum.frees[i];
+  }
+  stats->alloc_bytes = sum.allocBytes;
+  stats->free_bytes = sum.freeBytes;
+  stats->live_count = (int64_t)(stats->alloc_count - stats->free_count);
+  stats->live_bytes = (int64_t)(sum.allocBytes - sum.freeBytes);
+  updatePeak(stats->live_bytes);
+  stats->peak_bytes = __atomic_load_n(&peakBytes, __ATOMIC_RELAXED);
+  stats->type_count = __atomic_load_n(&typeCount, __ATOMIC_ACQUIRE);
+}
+
+uint32_t hue_stats_read_types(hue_stats_type_t* types, uint32_t count) {
+  StatsShard sum;
+  pthread_mutex_lock(&shardsLock);
+  sumShards(sum);
+  pthread_mutex_unlock(&shardsLock);
+  uint32_t n = __atomic_load_n(&typeCount, __ATOMIC_ACQUIRE);
+  for (uint32_t i = 0; i < n && i < count; ++i) {
+    types[i].name = typeNames[i];
+    types[i].alloc_count = sum.allocs[i];
+    types[i].free_count = sum.frees[i];
+    types[i].live_count = (int64_t)(sum.allocs[i] - sum.frees[i]);
+  }
+  return n;
+}
+
+int64_t hue_stats_live_count(const char* name) {
+  hue_stats_type_t types[StatsMaxTypes];
+  uint32_t n = hue_stats_read_types(types, StatsMaxTypes);
+  for (uint32_t i = 0; i < n; ++i) {
+    if (strcmp(types[i].name, name) == 0) return types[i].live_count;
+  }
+  return 0;
+}
+
+double hue_stats_alloc_rate(const hue_stats_t* earlier, const hue_stats_t* later) {
+  if (later->time_ns <= earlier->time_ns) return 0.0;
+  double seconds = (double)(later->time_ns - earlier->time_ns) / 1e9;
+  return (double)(later->alloc_bytes - earlier->alloc_bytes) / seconds;
+}
+
+} // extern "C"
@@ -0,0 +1,146 @@
+// Copyright (c) 2012, Rasmus Andersson. All rights reserved. Use of this source
+// code is governed by a MIT-style license that can be found in the LICENSE file.
+//
+// Runtime statistics: live objects by type, bytes allocated for objects, and the
+// peak of those bytes.
+//
+// Counters are kept per thread, so counting an allocation is a few plain adds to
+// memory only the allocating thread writes to. Reading the statistics sums the
+// counters of all threads. Threads hand their counters over to a shared total as
+// they exit.
+//
+//   hue_stats_t before, after;
+//   hue_stats_read(&before);
+//   ...
+//   hue_stats_read(&after);
+//   printf("%lld objects alive, %.0f bytes/s\n", (long long)after.live_count,
+//          hue_stats_alloc_rate(&before, &after));
+//
+#ifndef _HUE_RUNTIME_STATS_INCLUDED
+#define _HUE_RUNTIME_STATS_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Object statistics are collected unless this is defined as 0. The runtime library
+// and all code using it should be built with the same setting.
+#ifndef HUE_STATS
+#define HUE_STATS 1
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct hue_stats {
+  uint64_t time_ns;      // time of the reading, from a monotonic clock
+  uint64_t alloc_count;  // objects allocated since the process started
+  uint64_t free_count;   // objects freed since the process started
+  uint64_t alloc_bytes;  // bytes allocated for objects since the process started
+  uint64_t free_bytes;   // bytes of objects freed since the process started
+  int64_t live_count;    // objects currently alive
+  int64_t live_bytes;    // bytes of objects currently alive
+  int64_t peak_bytes;    // highest live_bytes seen so far (see hue_stats_read)
+  uint32_t type_count;   // number of object types
+  uint32_t thread_count; // running threads which have allocated or freed objects
+} hue_stats_t;
+
+typedef struct hue_stats_type {
+  const char* name;     // C++ name of the type, like "hue::Vector::Node"
+  uint64_t alloc_count; // objects of the type allocated since the process started
+  uint64_t free_count;  // objects of the type freed since the process started
+  int64_t live_count;   // objects of the type currently alive
+} hue_stats_type_t;
+
+// Reads the current statistics. Counters of threads which are busy allocating may be
+// read a little out of step with each other. peak_bytes is exact to within 64 kB per
+// running thread.
+void hue_stats_read(hue_stats_t* stats);
+
+// Reads the statistics of up to *count* object types into *types*, in the order the
+// types were first allocated. Returns the number of types.
+uint32_t hue_stats_read_types(hue_stats_type_t* types, uint32_t count);
+
+// Number of live objects of the type named *name*, or 0 if there's no such type
+int64_t hue_stats_live_count(const char* name);
+
+// Bytes allocated per second between two readings
+double hue_stats_alloc_rate(const hue_stats_t* earlier, const hue_stats_t* later);
+
+#ifdef __cplusplus
+} // extern "C"
+
+namespace hue {
+
+// Types beyond this number are counted as one type named "(other)"
+static const uint32_t StatsMaxTypes = 64;
+
+// Bytes a thread may allocate or free before adding them to the shared count of live
+// bytes, which peak_bytes is tracked from
+static const int64_t StatsFlushBytes = 64 * 1024;
+
+// Counters of one thread. Only written by that thread.
+struct StatsShard {
+  uint64_t allocs[StatsMaxTypes];
+  uint64_t frees[StatsMaxTypes];
+  uint64_t allocBytes;
+  uint64_t freeBytes;
+  int64_t unflushed; // bytes allocated minus bytes freed not yet in the shared count
+  StatsShard* prev;
+  StatsShard* next;
+};
+// Initial-exec, so that finding the shard doesn't take a call when the runtime is a
+// shared library
+extern __thread StatsShard* stats_shard_ __attribute__((tls_model("initial-exec")));
+
+StatsShard* stats_register_thread();
+void stats_flush(StatsShard* shard);
+
+// Registers an object type, given the __PRETTY_FUNCTION__ of a static member function
+// of the type, and returns its index
+uint32_t stats_register_type(const char* prettyFunction);
+
+inline StatsShard* stats_shard() {
+  StatsShard* shard = stats_shard_;
+  return shard ? shard : stats_register_thread();
+}
+
+// Adds n to a counter of the calling thread's shard. Other threads only ever read
+// the counter, so the addition needn't be atomic as a whole.
+inline void stats_add(uint64_t* counter, uint64_t n) {
+  __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+inline void stats_alloc(uint32_t type, size_t size) {
+  StatsShard* shard = stats_shard();
+  stats_add(&shard->allocs[type], 1);
+  stats_add(&shard->allocBytes, size);
+  if ((shard->unflushed += size) > StatsFlushBytes) stats_flush(shard);
+}
+
+inline void stats_free(uint32_t type, size_t size) {
+  StatsShard* shard = stats_shard();
+  stats_add(&shard->frees[type], 1);
+  stats_add(&shard->freeBytes, size);
+  if ((shard->unflushed -= size) < -StatsFlushBytes) stats_flush(shard);
+}
+
+} // namespace hue
+
+#if HUE_STATS
+// Members HUE_OBJECT adds to a class to count its instances
+#define HUE_STATS_MEMBERS_ \
+  static uint32_t __statsType() { \
+    static const uint32_t type = hue::stats_register_type(__PRETTY_FUNCTION__); \
+    return type; \
+  }
+#define HUE_STATS_ALLOC_(size) hue::stats_alloc(__statsType(), (size))
+#define HUE_STATS_FREE_(size) hue::stats_free(__statsType(), (size))
+#else
+#define HUE_STATS_MEMBERS_
+#define HUE_STATS_ALLOC_(size) do {} while (0)
+#define HUE_STATS_FREE_(size) do {} while (0)
+#endif
+
+#endif // __cplusplus
+#endif // _HUE_RUNTIME_STATS_INCLUDED
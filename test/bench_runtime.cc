@@ -0,0 +1,609 @@
+// Benchmarks of the runtime's Vector, with std::vector (and std::shared_ptr for
+// reference counting) as the baseline.
+//
+//   bench_runtime [options] [size ...]
+//
+// Every benchmark is run for every size (1000, 100000 and 1000000 values unless sizes
+// are given), each in a process of its own so that its peak RSS can be measured.
+// Results are written to stdout as tab-separated values, one row per benchmark,
+// implementation and size, and as a table to stderr:
+//
+//   benchmark  impl  size  ns_per_op  allocs_per_op  peak_rss_kb
+//
+// Allocations are the blocks allocated through slab_alloc and operator new by the
+// thread running the benchmark (malloc is only counted through operator new).
+//
+// Options:
+//   --baseline FILE  Compares ns/op of hue rows with those in FILE, the output of an
+//                    earlier run, and exits with status 1 if any got slower by more
+//                    than the threshold
+//   --threshold F    Allowed slowdown as a fraction of the baseline (default 0.25)
+//   --threads N      Threads used by multi-threaded benchmarks (default 4)
+//
+#include "../src/runtime/Vector.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+
+using namespace hue;
+
+// -- Allocation counting --
+
+static __thread size_t new_count = 0;
+
+// Every form of operator new and delete is replaced, so that all of them pair malloc
+// with free
+void* operator new(size_t size) {
+  ++new_count;
+  void* p = malloc(size ? size : 1);
+  if (p == 0) throw std::bad_alloc();
+  return p;
+}
+void* operator new[](size_t size) { return operator new(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  ++new_count;
+  return malloc(size ? size : 1);
+}
+void* operator new[](size_t size, const std::nothrow_t& nt) noexcept {
+  return operator new(size, nt);
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { free(p); }
+
+static inline size_t allocCount() {
+  return new_count + slab_thread_allocs();
+}
+
+// -- Measurement --
+
+// Accumulates the time and allocations of the measured parts of a benchmark, which
+// are bracketed by start() and stop().
+class Meter {
+public:
+  Meter() : ns_(0), allocs_(0) {}
+
+  void start() {
+    allocs0_ = allocCount();
+    t0_ = std::chrono::steady_clock::now();
+  }
+
+  void stop() {
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0_).count();
+    allocs_ += allocCount() - allocs0_;
+  }
+
+  double ns() const { return (double)ns_; }
+  double allocs() const { return (double)allocs_; }
+
+private:
+  std::chrono::steady_clock::time_point t0_;
+  uint64_t ns_;
+  size_t allocs0_;
+  size_t allocs_;
+};
+
+// Keeps the compiler from optimizing away the values computed by a benchmark
+static volatile uint64_t sink;
+
+static size_t threadCount = 4;
+
+// Number of times a benchmark over n values is repeated, so that small sizes run for
+// long enough to be measured
+static size_t repsFor(size_t n) {
+  size_t reps = 2000000 / (n ? n : 1);
+  return reps ? reps : 1;
+}
+
+// Pseudo-random indices in [0, n)
+struct RandomIndex {
+  uint64_t x;
+  size_t n;
+  explicit RandomIndex(size_t n) : x(88172645463325252ULL), n(n) {}
+  inline size_t next() {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return (size_t)(((__uint128_t)x * n) >> 64);
+  }
+};
+
+static Vector* makeVector(size_t n) {
+  std::vector<void*> values(n);
+  for (size_t i = 0; i < n; ++i) values[i] = (void*)i;
+  return Vector::create(values.data(), n);
+}
+
+static std::vector<void*> makeStdVector(size_t n) {
+  std::vector<void*> v(n);
+  for (size_t i = 0; i < n; ++i) v[i] = (void*)i;
+  return v;
+}
+
+// -- Benchmarks --
+//
+// Each returns the number of operations performed while the meter was running.
+
+static uint64_t hueAppend(size_t n, Meter& m) {
+  size_t reps = repsFor(n);
+  for (size_t r = 0; r < reps; ++r) {
+    m.start();
+    Vector* v = Vector::Empty;
+    for (size_t i = 0; i < n; ++i) {
+      Vector* oldV = v;
+      v = v->append((void*)i);
+      oldV->release();
+    }
+    m.stop();
+    v->release();
+  }
+  return (uint64_t)n * reps;
+}
+
+static uint64_t hueAppendTransient(size_t n, Meter& m) {
+  size_t reps = repsFor(n);
+  for (size_t r = 0; r < reps; ++r) {
+    m.start();
+    Vector::Transient t;
+    for (size_t i = 0; i < n; ++i) t.append((void*)i);
+    Vector* v = t.persistent();
+    m.stop();
+    v->release();
+  }
+  return (uint64_t)n * reps;
+}
+
+static uint64_t hueAppendConsuming(size_t n, Meter& m) {
+  size_t reps = repsFor(n);
+  for (size_t r = 0; r < reps; ++r) {
+    m.start();
+    Vector* v = Vector::Empty;
+    for (size_t i = 0; i < n; ++i) v = v->appendConsuming((void*)i);
+    m.stop();
+    v->release();
+  }
+  return (uint64_t)n * reps;
+}
+
+static uint64_t stdAppend(size_t n, Meter& m) {
+  size_t reps = repsFor(n);
+  for (size_t r = 0; r < reps; ++r) {
+    m.start();
+    std::vector<void*>* v = new std::vector<void*>();
+    for (size_t i = 0; i < n; ++i) v->push_back((void*)i);
+    m.stop();
+    delete v;
+  }
+  return (uint64_t)n * reps;
+}
+
+static uint64_t hueGetSequential(size_t n, Meter& m) {
+  Vector* v = makeVector(n);
+  size_t reps = repsFor(n);
+  uint64_t sum = 0;
+  m.start();
+  for (size_t r = 0; r < reps; ++r) {
+    for (size_t i = 0; i < n; ++i) sum += (uint64_t)v->itemAt(i);
+  }
+  m.stop();
+  sink = sum;
+  v->release();
+  return (uint64_t)n * reps;
+}
+
+static uint64_t stdGetSequential(size_t n, Meter& m) {
+  std::vector<void*> v = makeStdVector(n);
+  size_t reps = repsFor(n);
+  uint64_t sum = 0;
+  m.start();
+  for (size_t r = 0; r < reps; ++r) {
+    for (size_t i = 0; i < n; ++i) sum += (uint64_t)v[i];
+  }
+  m.stop();
+  sink = sum;
+  return (uint64_t)n * reps;
+}
+
+static uint64_t hueGetRandom(size_t n, Meter& m) {
+  Vector* v = makeVector(n);
+  size_t ops = n * repsFor(n);
+  RandomIndex index(n);
+  uint64_t sum = 0;
+  m.start();
+  for (size_t i = 0; i < ops; ++i) sum += (uint64_t)v->itemAt(index.next());
+  m.stop();
+  sink = sum;
+  v->release();
+  return ops;
+}
+
+static uint64_t stdGetRandom(size_t n, Meter& m) {
+  std::vector<void*> v = makeStdVector(n);
+  size_t ops = n * repsFor(n);
+  RandomIndex index(n);
+  uint64_t sum = 0;
+  m.start();
+  for (size_t i = 0; i < ops; ++i) sum += (uint64_t)v[index.next()];
+  m.stop();
+  sink = sum;
+  return ops;
+}
+
+static uint64_t hueIterate(size_t n, Meter& m) {
+  Vector* v = makeVector(n);
+  size_t reps = repsFor(n);
+  uint64_t sum = 0;
+  m.start();
+  for (size_t r = 0; r < reps; ++r) {
+    v->forEachChunk([&](void* const* values, size_t count) {
+      for (size_t i = 0; i < count; ++i) sum += (uint64_t)values[i];
+    });
+  }
+  m.stop();
+  sink = sum;
+  v->release();
+  return (uint64_t)n * reps;
+}
+
+static uint64_t stdIterate(size_t n, Meter& m) {
+  std::vector<void*> v = makeStdVector(n);
+  size_t reps = repsFor(n);
+  uint64_t sum = 0;
+  m.start();
+  for (size_t r = 0; r < reps; ++r) {
+    for (std::vector<void*>::const_iterator it = v.begin(); it != v.end(); ++it) {
+      sum += (uint64_t)*it;
+    }
+  }
+  m.stop();
+  sink = sum;
+  return (uint64_t)n * reps;
+}
+
+// Summing the values as Ints
+static uint64_t hueSum(size_t n, Meter& m) {
+  Vector* v = makeVector(n);
+  size_t reps = repsFor(n);
+  uint64_t sum = 0;
+  m.start();
+  for (size_t r = 0; r < reps; ++r) sum += (uint64_t)v->sumInt();
+  m.stop();
+  sink = sum;
+  v->release();
+  return (uint64_t)n * reps;
+}
+
+static uint64_t stdSum(size_t n, Meter& m) {
+  std::vector<void*> v = makeStdVector(n);
+  size_t reps = repsFor(n);
+  uint64_t sum = 0;
+  m.start();
+  for (size_t r = 0; r < reps; ++r) {
+    for (size_t i = 0; i < n; ++i) sum += (uint64_t)v[i];
+  }
+  m.stop();
+  sink = sum;
+  return (uint64_t)n * reps;
+}
+
+// Searching for a value which isn't there. Operations are values compared.
+static uint64_t hueFind(size_t n, Meter& m) {
+  Vector* v = makeVector(n);
+  size_t reps = repsFor(n);
+  uint64_t found = 0;
+  m.start();
+  for (size_t r = 0; r < reps; ++r) found += v->find((void*)n);
+  m.stop();
+  sink = found;
+  v->release();
+  return (uint64_t)n * reps;
+}
+
+static uint64_t stdFind(size_t n, Meter& m) {
+  std::vector<void*> v = makeStdVector(n);
+  size_t reps = repsFor(n);
+  uint64_t found = 0;
+  m.start();
+  for (size_t r = 0; r < reps; ++r) found += std::find(v.begin(), v.end(), (void*)n) - v.begin();
+  m.stop();
+  sink = found;
+  return (uint64_t)n * reps;
+}
+
+// Releasing the last reference to a vector, freeing all of its nodes. Operations are
+// values, not vectors.
+static uint64_t hueTeardown(size_t n, Meter& m) {
+  size_t reps = repsFor(n);
+  for (size_t r = 0; r < reps; ++r) {
+    Vector* v = makeVector(n);
+    m.start();
+    v->release();
+    m.stop();
+  }
+  return (uint64_t)n * reps;
+}
+
+static uint64_t stdTeardown(size_t n, Meter& m) {
+  size_t reps = repsFor(n);
+  for (size_t r = 0; r < reps; ++r) {
+    std::vector<void*>* v = new std::vector<void*>(makeStdVector(n));
+    m.start();
+    delete v;
+    m.stop();
+  }
+  return (uint64_t)n * reps;
+}
+
+// Retaining and releasing a vector owned by the calling thread
+static uint64_t hueRetainRelease(size_t n, Meter& m) {
+  Vector* v = makeVector(n);
+  const size_t ops = 10000000;
+  m.start();
+  for (size_t i = 0; i < ops; ++i) {
+    v->retain();
+    v->release();
+  }
+  m.stop();
+  v->release();
+  return ops;
+}
+
+static uint64_t stdRetainRelease(size_t n, Meter& m) {
+  std::shared_ptr<std::vector<void*> > v(new std::vector<void*>(makeStdVector(n)));
+  const size_t ops = 10000000;
+  m.start();
+  for (size_t i = 0; i < ops; ++i) {
+    std::shared_ptr<std::vector<void*> > copy(v);
+    sink = (uint64_t)copy.get();
+  }
+  m.stop();
+  return ops;
+}
+
+// Retaining and releasing one vector from several threads at once
+static uint64_t hueRetainReleaseMT(size_t n, Meter& m) {
+  Vector* v = makeVector(n);
+  const size_t ops = 2000000;
+  std::vector<std::thread> threads;
+  m.start();
+  for (size_t t = 0; t < threadCount; ++t) {
+    threads.push_back(std::thread([v, ops]() {
+      for (size_t i = 0; i < ops; ++i) {
+        v->retain();
+        v->release();
+      }
+    }));
+  }
+  for (size_t t = 0; t < threadCount; ++t) threads[t].join();
+  m.stop();
+  v->release();
+  return ops * threadCount;
+}
+
+static uint64_t stdRetainReleaseMT(size_t n, Meter& m) {
+  std::shared_ptr<std::vector<void*> > v(new std::vector<void*>(makeStdVector(n)));
+  const size_t ops = 2000000;
+  std::vector<std::thread> threads;
+  m.start();
+  for (size_t t = 0; t < threadCount; ++t) {
+    threads.push_back(std::thread([&v, ops]() {
+      for (size_t i = 0; i < ops; ++i) {
+        std::shared_ptr<std::vector<void*> > copy(v);
+        sink = (uint64_t)copy.get();
+      }
+    }));
+  }
+  for (size_t t = 0; t < threadCount; ++t) threads[t].join();
+  m.stop();
+  return ops * threadCount;
+}
+
+// Allocating and freeing node-sized blocks, keeping a window of blocks alive
+template <bool Slab>
+static uint64_t allocBlocks(size_t n, Meter& m) {
+  static const size_t Window = 4096;
+  static void* live[Window];
+  static size_t sizes[Window];
+  const size_t ops = 10000000;
+  m.start();
+  for (size_t i = 0; i < ops; ++i) {
+    size_t slot = (i * 2654435761u) % Window;
+    if (live[slot]) {
+      if (Slab) slab_dealloc(live[slot], sizes[slot]); else free(live[slot]);
+    }
+    sizes[slot] = 32 + (8 * ((i >> 3) % 33)); // Node headers with 0-32 values
+    live[slot] = Slab ? slab_alloc(sizes[slot]) : malloc(sizes[slot]);
+  }
+  m.stop();
+  for (size_t slot = 0; slot < Window; ++slot) {
+    if (live[slot]) {
+      if (Slab) slab_dealloc(live[slot], sizes[slot]); else free(live[slot]);
+    }
+  }
+  return ops;
+}
+
+struct Benchmark {
+  const char* name;
+  const char* impl;
+  uint64_t (*run)(size_t n, Meter& m);
+  bool sized; // false if the size of the vector doesn't matter, so it's run once
+};
+
+static const Benchmark benchmarks[] = {
+  { "append",             "hue", hueAppend,          true },
+  { "append",             "std", stdAppend,          true },
+  { "append_transient",   "hue", hueAppendTransient, true },
+  { "append_consuming",   "hue", hueAppendConsuming, true },
+  { "get_sequential",     "hue", hueGetSequential,   true },
+  { "get_sequential",     "std", stdGetSequential,   true },
+  { "get_random",         "hue", hueGetRandom,       true },
+  { "get_random",         "std", stdGetRandom,       true },
+  { "iterate",            "hue", hueIterate,         true },
+  { "iterate",            "std", stdIterate,         true },
+  { "sum",                "hue", hueSum,             true },
+  { "sum",                "std", stdSum,             true },
+  { "find",               "hue", hueFind,            true },
+  { "find",               "std", stdFind,            true },
+  { "teardown",           "hue", hueTeardown,        true },
+  { "teardown",           "std", stdTeardown,        true },
+  { "retain_release",     "hue", hueRetainRelease,   false },
+  { "retain_release",     "std", stdRetainRelease,   false },
+  { "retain_release_mt",  "hue", hueRetainReleaseMT, false },
+  { "retain_release_mt",  "std", stdRetainReleaseMT, false },
+  { "alloc_node",         "hue", allocBlocks<true>,  false },
+  { "alloc_node",         "std", allocBlocks<false>, false },
+};
+
+struct Result {
+  double nsPerOp;
+  double allocsPerOp;
+  long peakRSS; // kB
+};
+
+// Runs a benchmark in a child process. Returns false if the child failed.
+static bool runIsolated(const Benchmark& b, size_t n, Result& result) {
+  int fds[2];
+  if (pipe(fds) != 0) return false;
+  pid_t pid = fork();
+  if (pid < 0) return false;
+  if (pid == 0) {
+    close(fds[0]);
+    Meter m;
+    uint64_t ops = b.run(n, m);
+    Result r = { m.ns() / ops, m.allocs() / ops, 0 };
+    ssize_t written = write(fds[1], &r, sizeof(r));
+    _exit(written == (ssize_t)sizeof(r) ? 0 : 1);
+  }
+  close(fds[1]);
+  ssize_t nread = read(fds[0], &result, sizeof(result));
+  close(fds[0]);
+  int status;
+  struct rusage usage;
+  if (wait4(pid, &status, 0, &usage) != pid) return false;
+  if (nread != (ssize_t)sizeof(result) || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    return false;
+  }
+  result.peakRSS = usage.ru_maxrss;
+  #ifdef __APPLE__
+  result.peakRSS /= 1024; // bytes rather than kB
+  #endif
+  return true;
+}
+
+typedef std::map<std::string, double> Baseline;
+
+static std::string baselineKey(const char* name, const char* impl, size_t n) {
+  char buf[128];
+  snprintf(buf, sizeof(buf), "%s/%s/%zu", name, impl, n);
+  return buf;
+}
+
+// Reads ns/op of each row of an earlier run's output
+static bool readBaseline(const char* path, Baseline& baseline) {
+  FILE* f = fopen(path, "r");
+  if (!f) return false;
+  char line[256], name[64], impl[16];
+  size_t n;
+  double nsPerOp;
+  while (fgets(line, sizeof(line), f)) {
+    if (line[0] == '#') continue;
+    if (sscanf(line, "%63s %15s %zu %lf", name, impl, &n, &nsPerOp) == 4) {
+      baseline[baselineKey(name, impl, n)] = nsPerOp;
+    }
+  }
+  fclose(f);
+  return true;
+}
+
+int main(int argc, char** argv) {
+  const char* baselinePath = 0;
+  double threshold = 0.25;
+  std::vector<size_t> sizes;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+      baselinePath = argv[++i];
+    } else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+      threshold = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      threadCount = (size_t)atoi(argv[++i]);
+    } else if (argv[i][0] != '-') {
+      sizes.push_back((size_t)atoll(argv[i]));
+    } else {
+      fprintf(stderr, "usage: %s [--baseline FILE] [--threshold F] [--threads N] "
+                      "[size ...]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (sizes.empty()) {
+    sizes.push_back(1000);
+    sizes.push_back(100000);
+    sizes.push_back(1000000);
+  }
+
+  Baseline baseline;
+  if (baselinePath && !readBaseline(baselinePath, baseline)) {
+    fprintf(stderr, "%s: can't read baseline %s\n", argv[0], baselinePath);
+    return 2;
+  }
+
+  printf("# benchmark\timpl\tsize\tns_per_op\tallocs_per_op\tpeak_rss_kb\n");
+  fflush(stdout);
+  fprintf(stderr, "%-20s %-4s %10s %12s %12s %12s\n",
+          "benchmark", "impl", "size", "ns/op", "allocs/op", "peak RSS kB");
+
+  int failures = 0, regressions = 0;
+  const size_t count = sizeof(benchmarks) / sizeof(benchmarks[0]);
+  for (size_t b = 0; b < count; ++b) {
+    const Benchmark& bench = benchmarks[b];
+    for (size_t s = 0; s < sizes.size(); ++s) {
+      size_t n = sizes[s];
+      if (!bench.sized && s != 0) break;
+      Result r;
+      if (!runIsolated(bench, n, r)) {
+        fprintf(stderr, "%-20s %-4s %10zu failed\n", bench.name, bench.impl, n);
+        ++failures;
+        continue;
+      }
+      printf("%s\t%s\t%zu\t%.3f\t%.4f\t%ld\n", bench.name, bench.impl, n,
+             r.nsPerOp, r.allocsPerOp, r.peakRSS);
+      fflush(stdout);
+      fprintf(stderr, "%-20s %-4s %10zu %12.3f %12.4f %12ld", bench.name, bench.impl, n,
+              r.nsPerOp, r.allocsPerOp, r.peakRSS);
+
+      Baseline::const_iterator it = baseline.find(baselineKey(bench.name, bench.impl, n));
+      if (it != baseline.end() && it->second > 0) {
+        double change = (r.nsPerOp / it->second) - 1.0;
+        fprintf(stderr, "  %+.1f%%", change * 100.0);
+        if (strcmp(bench.impl, "hue") == 0 && change > threshold) {
+          fprintf(stderr, " REGRESSION");
+          ++regressions;
+        }
+      }
+      fprintf(stderr, "\n");
+    }
+  }
+
+  if (regressions != 0) {
+    fprintf(stderr, "%d benchmarks regressed by more than %.0f%%\n", regressions,
+            threshold * 100.0);
+  }
+  return (failures != 0 || regressions != 0) ? 1 : 0;
+}
@@ -0,0 +1,121 @@
+#include "../src/runtime/Vector.h"
+#include "../src/runtime/Atom.h"
+
+using std::cerr;
+using std::endl;
+using namespace hue;
+
+// Every version published holds the values 0...count-1
+static void checkVersion(const Vector* v) {
+  size_t count = v->count();
+  if (count != 0) {
+    assert((size_t)v->itemAt(0) == 0);
+    assert((size_t)v->itemAt(count - 1) == count - 1);
+  }
+}
+
+static void waitForFreedNodes() {
+  for (int i = 0; i < 1000 && hue_stats_live_count("hue::Vector::Node") != 0; ++i) {
+    // Nodes released by other threads are queued with us, their owner
+    #if HUE_BIASED_REFCOUNT
+    ref_merge_queued();
+    #endif
+    std::this_thread::yield();
+  }
+}
+
+int main() {
+  // Single thread
+  {
+    Atom<Vector> atom(Vector::create(0, 0), TransferReference);
+    Vector* v = atom.deref();
+    assert(v->count() == 0);
+    Vector* v2 = atom.swap([](Vector* v) { return v->append((void*)0); });
+    assert(v2->count() == 1);
+    assert(v->count() == 0); // the old version is still ours
+    v->release();
+    // Leaving the value unchanged
+    Vector* v3 = atom.swap([](Vector* v) { return v; });
+    assert(v3 == v2);
+    v3->release();
+    bool set = atom.compareAndSet(v2, 0);
+    assert(set);
+    set = atom.compareAndSet(v2, 0);
+    assert(!set); // no longer v2
+    (void)set;
+    assert(atom.deref() == 0);
+    atom.reset(v2);
+    v = atom.deref();
+    assert(v == v2);
+    v->release();
+    v2->release();
+    assert(hazard_collect() == 0);
+  }
+  assert(hue_stats_live_count("hue::Vector") == 0);
+
+  // Readers keep reading while one thread publishes new versions
+  {
+    const size_t N = 20000;
+    const size_t R = 4;
+    Atom<Vector> latest(Vector::create(0, 0), TransferReference);
+    volatile bool done = false;
+    std::vector<std::thread> readers;
+    std::vector<size_t> reads(R);
+    for (size_t r = 0; r < R; ++r) {
+      readers.push_back(std::thread([&latest, &done, &reads, r]() {
+        size_t lastCount = 0;
+        while (!__atomic_load_n(&done, __ATOMIC_ACQUIRE)) {
+          Vector* v = latest.deref();
+          checkVersion(v);
+          assert(v->count() >= lastCount); // versions are seen in order
+          lastCount = v->count();
+          v->release();
+          ++reads[r];
+        }
+        (void)lastCount;
+      }));
+    }
+    for (size_t i = 0; i < N; ++i) {
+      latest.swap([i](Vector* v) { return v->append((void*)i); })->release();
+    }
+    __atomic_store_n(&done, true, __ATOMIC_RELEASE);
+    for (size_t r = 0; r < R; ++r) readers[r].join();
+    Vector* v = latest.deref();
+    assert(v->count() == N);
+    checkVersion(v);
+    v->release();
+    assert(hazard_collect() == 0);
+    size_t totalReads = 0;
+    for (size_t r = 0; r < R; ++r) totalReads += reads[r];
+    cerr << "Published " << N << " versions while reading " << totalReads << " times" << endl;
+  }
+  waitForFreedNodes();
+  assert(hue_stats_live_count("hue::Vector") == 0);
+  assert(hue_stats_live_count("hue::Vector::Node") == 0);
+
+  // Several threads updating at the same time lose no updates
+  {
+    const size_t N = 5000;
+    const size_t W = 4;
+    Atom<Vector> counter(Vector::create(0, 0), TransferReference);
+    std::vector<std::thread> writers;
+    for (size_t w = 0; w < W; ++w) {
+      writers.push_back(std::thread([&counter]() {
+        for (size_t i = 0; i < N; ++i) {
+          counter.swap([](Vector* v) { return v->append((void*)v->count()); })->release();
+        }
+      }));
+    }
+    for (size_t w = 0; w < W; ++w) writers[w].join();
+    Vector* v = counter.deref();
+    assert(v->count() == N * W);
+    checkVersion(v);
+    for (size_t i = 0; i < v->count(); ++i) assert((size_t)v->itemAt(i) == i);
+    v->release();
+  }
+  waitForFreedNodes();
+  assert(hue_stats_live_count("hue::Vector") == 0);
+  assert(hue_stats_live_count("hue::Vector::Node") == 0);
+
+  return 0;
+}
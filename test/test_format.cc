@@ -0,0 +1,134 @@
+#include <hue/runtime/format.h>
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+using namespace hue;
+
+static uint64_t randState = 88172645463325252ULL;
+static uint64_t random64() {
+  randState ^= randState << 13;
+  randState ^= randState >> 7;
+  randState ^= randState << 17;
+  return randState;
+}
+
+static void assertInt(int64_t v, const std::string& expected) {
+  char buf[FormatIntMax];
+  std::string s(buf, format_int(buf, v));
+  assert(s == expected);
+}
+
+static void assertHex(uint64_t v, const std::string& expected) {
+  char buf[FormatHexMax];
+  std::string s(buf, format_hex(buf, v));
+  assert(s == expected);
+}
+
+static std::string floatString(double v) {
+  char buf[FormatFloatMax];
+  return std::string(buf, format_float(buf, v));
+}
+
+// Number of significant digits in a formatted float
+static int significantDigits(const std::string& s) {
+  size_t end = s.find('e');
+  if (end == std::string::npos) end = s.size();
+  std::string digits;
+  for (size_t i = 0; i < end; ++i) {
+    if (s[i] >= '0' && s[i] <= '9') digits += s[i];
+  }
+  size_t first = digits.find_first_not_of('0');
+  size_t last = digits.find_last_not_of('0');
+  return (first == std::string::npos) ? 1 : (int)(last - first + 1);
+}
+
+// Checks that s reads back as v, and that no shorter %.*g representation does
+static void assertShortest(double v, const std::string& s) {
+  assert(s.size() <= FormatFloatMax);
+  assert(strtod(s.c_str(), 0) == v);
+  int digits = significantDigits(s);
+  if (digits > 1) {
+    char buf[400]; // more than %g ever writes, as GCC can't tell it's at most ~25
+    snprintf(buf, sizeof(buf), "%.*g", digits - 1, v);
+    assert(strtod(buf, 0) != v);
+  }
+}
+
+int main() {
+  // Ints
+  assertInt(0, "0");
+  assertInt(7, "7");
+  assertInt(-42, "-42");
+  assertInt(100, "100");
+  assertInt(1234567890123LL, "1234567890123");
+  assertInt(INT64_MAX, "9223372036854775807");
+  assertInt(INT64_MIN, "-9223372036854775808");
+  for (int i = 0; i < 100000; ++i) {
+    int64_t v = (int64_t)random64() >> (random64() % 64);
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%lld", (long long)v);
+    assertInt(v, buf);
+  }
+
+  // Hex
+  assertHex(0, "0");
+  assertHex(0xf, "f");
+  assertHex(0xff, "ff");
+  assertHex(0x100, "100");
+  assertHex(UINT64_MAX, "ffffffffffffffff");
+  for (int i = 0; i < 100000; ++i) {
+    uint64_t v = random64() >> (random64() % 64);
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%llx", (unsigned long long)v);
+    assertHex(v, buf);
+  }
+
+  // Floats
+  assert(floatString(0.0) == "0.0");
+  assert(floatString(-0.0) == "-0.0");
+  assert(floatString(2.0) == "2.0");
+  assert(floatString(45.9) == "45.9");
+  assert(floatString(-1.5) == "-1.5");
+  assert(floatString(0.1) == "0.1");
+  assert(floatString(0.3) == "0.3");
+  assert(floatString(0.1 + 0.2) == "0.30000000000000004");
+  assert(floatString(3628800.0) == "3628800.0");
+  assert(floatString(123456.789) == "123456.789");
+  assert(floatString(1e15) == "1000000000000000.0");
+  assert(floatString(1e16) == "1e+16");
+  assert(floatString(1.5e300) == "1.5e+300");
+  assert(floatString(0.0001) == "0.0001");
+  assert(floatString(0.00001) == "1e-05");
+  assert(floatString(1.5e-7) == "1.5e-07");
+  assert(floatString(INFINITY) == "inf");
+  assert(floatString(-INFINITY) == "-inf");
+  assert(floatString(NAN) == "nan");
+  assert(floatString(1.7976931348623157e308) == "1.7976931348623157e+308");
+  assert(floatString(2.2250738585072014e-308) == "2.2250738585072014e-308");
+  assert(floatString(5e-324) == "5e-324");
+  assert(floatString(-2.2250738585072009e-308) == "-2.225073858507201e-308");
+
+  // Random bit patterns cover all exponents, and small integers and decimals the
+  // common cases
+  for (int i = 0; i < 1000000; ++i) {
+    uint64_t bits = random64();
+    double v;
+    memcpy(&v, &bits, sizeof(v));
+    if (isnan(v) || isinf(v)) continue;
+    assertShortest(v, floatString(v));
+  }
+  for (int i = 0; i < 100000; ++i) {
+    double v = (double)(int64_t)(random64() % 2000001 - 1000000) / 1000;
+    assertShortest(v, floatString(v));
+    v = (double)(random64() % (1ULL << 53));
+    assertShortest(v, floatString(v));
+  }
+
+  return 0;
+}
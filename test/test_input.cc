@@ -0,0 +1,122 @@
+#include <hue/runtime/runtime.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+
+using namespace hue;
+
+static uint64_t randState = 88172645463325252ULL;
+static uint64_t random64() {
+  randState ^= randState << 13;
+  randState ^= randState >> 7;
+  randState ^= randState << 17;
+  return randState;
+}
+
+static std::string randomBytes(size_t n) {
+  std::string s(n, 0);
+  for (size_t i = 0; i < n; ++i) s[i] = (char)random64();
+  return s;
+}
+
+static void writeFile(const char* path, const std::string& contents) {
+  FILE* f = fopen(path, "wb");
+  assert(f != 0);
+  size_t n = fwrite(contents.data(), 1, contents.size(), f);
+  assert(n == contents.size());
+  (void)n;
+  fclose(f);
+}
+
+// Reads all of *in* and checks that chunks are no larger than InputChunkSize
+static std::string readAll(InputS in) {
+  std::string s;
+  for (;;) {
+    DataS chunk = input_read(in);
+    assert(chunk != 0);
+    assert(chunk->length <= InputChunkSize);
+    if (chunk->length == 0) return s;
+    s.append((const char*)chunk->data, chunk->length);
+  }
+}
+
+int main() {
+  char path[] = "/tmp/hue-test-input-XXXXXX";
+  int fd = mkstemp(path);
+  assert(fd != -1);
+  close(fd);
+
+  // Mapped files, of sizes around the page size
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t sizes[] = { 1, 100, page - 1, page, page + 1, (3 * page) + 17, 5000000 };
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+    std::string contents = randomBytes(sizes[i]);
+    writeFile(path, contents);
+    DataS data = file_map(path);
+    assert(data != 0);
+    assert(data->length == (Int)contents.size());
+    assert(((uintptr_t)data->data % page) == 0); // the file's pages aren't copied
+    assert(memcmp(data->data, contents.data(), contents.size()) == 0);
+    file_unmap(data);
+  }
+
+  writeFile(path, "");
+  DataS data = file_map(path);
+  assert(data != 0 && data->length == 0);
+  file_unmap(data);
+
+  // Failures
+  errno = 0;
+  assert(file_map("/tmp/hue-test-input-does-not-exist") == 0);
+  assert(errno == ENOENT);
+  assert(file_map("/tmp") == 0);
+  assert(errno == EISDIR);
+  int fds[2];
+  int rc = pipe(fds);
+  assert(rc == 0);
+  (void)rc;
+  std::string pipePath = "/dev/fd/" + std::to_string(fds[0]);
+  assert(file_map(pipePath.c_str()) == 0);
+  assert(errno == ENODEV);
+
+  // Streaming a file
+  std::string contents = randomBytes((InputChunkSize * 3) + 123);
+  writeFile(path, contents);
+  InputS in = input_open(path);
+  assert(in != 0);
+  std::string received = readAll(in);
+  assert(received == contents);
+  assert(input_read(in)->length == 0); // still at the end
+  input_close(in);
+  assert(input_open("/tmp/hue-test-input-does-not-exist") == 0);
+  assert(errno == ENOENT);
+
+  // Streaming stdin from a pipe, which is written to a little at a time
+  int savedStdin = dup(STDIN_FILENO);
+  dup2(fds[0], STDIN_FILENO);
+  close(fds[0]);
+  std::thread writer([&]() {
+    for (size_t i = 0; i < contents.size(); i += 1000) {
+      size_t n = std::min((size_t)1000, contents.size() - i);
+      ssize_t written = write(fds[1], contents.data() + i, n);
+      assert(written == (ssize_t)n);
+      (void)written;
+    }
+    close(fds[1]);
+  });
+  in = input_stdin();
+  received = readAll(in);
+  assert(received == contents);
+  input_close(in);
+  writer.join();
+  dup2(savedStdin, STDIN_FILENO);
+  close(savedStdin);
+
+  unlink(path);
+  return 0;
+}
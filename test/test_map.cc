@@ -0,0 +1,99 @@
+#include "../src/runtime/Map.h"
+
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+using std::cerr;
+using std::endl;
+using namespace hue;
+
+typedef std::unordered_map<void*, void*> Model;
+
+static void verify(const Map* m, const Model& model) {
+  assert(m->count() == model.size());
+  for (Model::const_iterator it = model.begin(); it != model.end(); ++it) {
+    void* value;
+    if (!m->find(it->first, value) || value != it->second) {
+      cerr << "find(" << it->first << ") failed" << endl;
+    }
+    assert(m->find(it->first, value) && value == it->second);
+  }
+  size_t visited = 0;
+  m->forEach([&](void* key, void* value) {
+    Model::const_iterator it = model.find(key);
+    assert(it != model.end() && it->second == value);
+    (void)it;
+    ++visited;
+  });
+  assert(visited == model.size());
+}
+
+int main() {
+  // Build a map of N keys, one assoc at a time
+  Map* m = Map::Empty;
+  Model model;
+  size_t N = 100000;
+  for (size_t i = 0; i < N; ++i) {
+    void* key = (void*)(i * 8);
+    Map* oldM = m;
+    m = m->assoc(key, (void*)(i + 1));
+    oldM->release();
+    model[key] = (void*)(i + 1);
+  }
+  verify(m, model);
+  assert(m->get((void*)1) == 0);
+  assert(m->get((void*)1, (void*)5) == (void*)5);
+  assert(!m->contains((void*)(N * 8)));
+
+  // Replacing a value leaves the original map intact
+  Map* m2 = m->assoc((void*)16, (void*)99);
+  assert(m2->count() == N);
+  assert(m2->get((void*)16) == (void*)99);
+  assert(m->get((void*)16) == (void*)3);
+  m2->release();
+
+  // Removing a key that isn't there returns the same map
+  m2 = m->dissoc((void*)3);
+  assert(m2 == m);
+  m2->release();
+
+  // Random mix of assoc and dissoc over a small key space, keeping every 100th
+  // version around to check that versions don't affect each other
+  srand(1);
+  std::vector<std::pair<Map*, Model> > versions;
+  for (size_t step = 0; step < 200000; ++step) {
+    void* key = (void*)(uintptr_t)(rand() % 5000);
+    Map* oldM = m;
+    if (rand() % 3 == 0) {
+      m = m->dissoc(key);
+      model.erase(key);
+    } else {
+      m = m->assoc(key, (void*)step);
+      model[key] = (void*)step;
+    }
+    oldM->release();
+    if (step % 10000 == 0) {
+      versions.push_back(std::make_pair(m->retain(), model));
+    }
+  }
+  verify(m, model);
+  for (size_t i = 0; i < versions.size(); ++i) {
+    verify(versions[i].first, versions[i].second);
+    versions[i].first->release();
+  }
+
+  // Remove all keys
+  for (Model::const_iterator it = model.begin(); it != model.end(); ++it) {
+    Map* oldM = m;
+    m = m->dissoc(it->first);
+    oldM->release();
+  }
+  assert(m == Map::Empty);
+  assert(m->count() == 0);
+
+  // Verify that there are no leaks
+  assert(hue_stats_live_count("hue::Map::Node") == 0);
+
+  return 0;
+}
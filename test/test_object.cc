@@ -16,6 +16,8 @@
 #include <iostream>
 #include <stdexcept>
 #include <bitset>
+#include <thread>
+#include <vector>
 
 using std::cerr;
 using std::endl;
@@ -40,8 +42,6 @@ public:
   void dealloc() {
     __sync_sub_and_fetch(&live_toy_count, 1);
   }
-  
-  inline Ref refcount() const { return __sync_fetch_and_add(&refcount_, 0); }
 };
 
 class Cat { HUE_OBJECT(Cat)
@@ -64,8 +64,6 @@ public:
     if (toy) toy->release();
     __sync_sub_and_fetch(&live_cat_count, 1);
   }
-  
-  inline Ref refcount() const { return __sync_fetch_and_add(&refcount_, 0); }
 };
 
 
@@ -102,6 +100,94 @@ int main() {
     assert(live_cat_count == 0);
   }
   
+  // References taken and dropped by other threads than the one that created an object
+  {
+    static const size_t M = 1000;
+    std::vector<Toy*> toys;
+    for (i = 0; i < M; ++i) toys.push_back(Toy::create(i, false));
+    assert(live_toy_count == M);
+  
+    // Each toy is retained by another thread, which then drops both its own reference
+    // and the one it was handed.
+    std::thread t1([&toys]() {
+      for (Toy* toy : toys) {
+        toy->retain();
+        assert(toy->refcount() >= 1);
+        toy->release();
+        toy->release();
+      }
+    });
+    t1.join();
+  
+    // Toys are queued with the main thread, which is still alive
+    Toy::create(0, false)->release();
+    assert(live_toy_count == 0);
+  
+    // Objects created by a thread that has exited
+    std::vector<Cat*> cats;
+    std::thread t2([&cats]() {
+      for (size_t i = 0; i < M; ++i) {
+        Toy* toy = Toy::create(i, true);
+        cats.push_back(Cat::create(1, "Zelda", toy));
+        toy->release();
+      }
+    });
+    t2.join();
+    assert(live_cat_count == M);
+    assert(live_toy_count == M);
+    for (Cat* cat : cats) {
+      assert(!cat->isUniquelyReferenced() || cat->refcount() == 1);
+      cat->release();
+    }
+    assert(live_cat_count == 0);
+    assert(live_toy_count == 0);
+  
+    // Objects shared by many threads
+    Toy* shared = Toy::create(1, true);
+    std::vector<std::thread> threads;
+    for (i = 0; i < 4; ++i) {
+      shared->retain();
+      threads.push_back(std::thread([shared]() {
+        for (size_t j = 0; j < 10000; ++j) {
+          shared->retain();
+          shared->release();
+        }
+        shared->release();
+      }));
+    }
+    for (std::thread& t : threads) t.join();
+    assert(shared->refcount() == 1);
+    assert(shared->isUniquelyReferenced());
+    shared->release();
+  #if HUE_BIASED_REFCOUNT
+    // The other threads dropped more references than they took, so the toy was queued
+    // with this thread which now has to merge its counters
+    hue::ref_merge_queued();
+  #endif
+    assert(live_toy_count == 0);
+
+    // Many short-lived threads, whose state is recycled as they exit. Objects they
+    // created are released once their owner is gone, both by this thread and by
+    // threads which may have taken over the state of the owner.
+    std::vector<Toy*> orphans;
+    for (i = 0; i < 2000; ++i) {
+      std::thread([&orphans, i]() {
+        Toy* toy = Toy::create(i, false);
+        if (i % 2) {
+          orphans.push_back(toy);
+        } else if (!orphans.empty()) {
+          orphans.back()->release();
+          orphans.pop_back();
+          toy->release();
+        } else {
+          toy->release();
+        }
+      }).join();
+    }
+    for (Toy* toy : orphans) toy->release();
+    assert(live_toy_count == 0);
+  }
+
   //ProfilerStop();
   //HeapProfilerStop();
     
@@ -0,0 +1,99 @@
+#include "../src/runtime/Vector.h"
+
+#include <sys/time.h>
+#include <unistd.h>
+
+using std::cerr;
+using std::endl;
+using namespace hue;
+
+static Vector* makeVector(size_t count) {
+  std::vector<void*> values(count);
+  for (size_t i = 0; i < count; ++i) values[i] = (void*)i;
+  return Vector::create(values.data(), count);
+}
+
+static uint64_t microtime() {
+  struct timeval tv;
+  gettimeofday(&tv, 0);
+  return ((uint64_t)tv.tv_sec * 1000000) + tv.tv_usec;
+}
+
+static int64_t liveNodes() {
+  return hue_stats_live_count("hue::Vector::Node");
+}
+
+int main() {
+  const size_t N = 4000000;
+  assert(release_mode() == ReleaseImmediate);
+
+  // Immediate: everything is freed by release()
+  Vector* v = makeVector(N);
+  int64_t nodes = liveNodes();
+  uint64_t t0 = microtime();
+  v->release();
+  uint64_t immediate = microtime() - t0;
+  assert(liveNodes() == 0);
+
+  // Deferred: release() frees at most ReleaseBudget objects
+  release_set_mode(ReleaseDeferred);
+  v = makeVector(N);
+  Vector* other = makeVector(10);
+  t0 = microtime();
+  v->release();
+  uint64_t deferred = microtime() - t0;
+  assert(release_pending() > 0);
+  assert(liveNodes() >= nodes - (int64_t)ReleaseBudget);
+  (void)nodes;
+
+  // Later releases chip away at the queue. Freeing a node queues its children, so
+  // it's the number of live objects which goes down rather than the queue.
+  int64_t before = liveNodes();
+  other->release();
+  #if HUE_STATS
+  assert(liveNodes() < before);
+  #endif
+  assert(liveNodes() >= before - (int64_t)ReleaseBudget);
+  (void)before;
+
+  // Draining with a budget
+  size_t drains = 0;
+  while (release_pending() != 0) {
+    before = liveNodes();
+    release_drain(1000);
+    assert(before - liveNodes() <= 1000);
+    ++drains;
+  }
+  assert(drains >= (size_t)(nodes / 1000));
+  assert(liveNodes() == 0);
+  assert(hue_stats_live_count("hue::Vector") == 0);
+  cerr << "Releasing " << N << " values: " << immediate << " us immediately, "
+       << deferred << " us deferred" << endl;
+
+  // Objects still queued when a thread exits are freed
+  std::thread([]() {
+    release_set_mode(ReleaseDeferred);
+    makeVector(100000)->release();
+    assert(release_pending() > 0);
+  }).join();
+  #if HUE_BIASED_REFCOUNT
+  ref_merge_queued();
+  #endif
+  assert(liveNodes() == 0);
+
+  // Background: release() hands the vector to another thread, which frees all of it
+  // while this thread sleeps
+  release_set_mode(ReleaseBackground);
+  v = makeVector(N);
+  t0 = microtime();
+  v->release();
+  uint64_t background = microtime() - t0;
+  assert(release_pending() == 0);
+  for (int i = 0; i < 1000 && liveNodes() != 0; ++i) usleep(10000);
+  assert(liveNodes() == 0);
+  cerr << "Releasing " << N << " values in the background: " << background << " us" << endl;
+
+  release_set_mode(ReleaseImmediate);
+  assert(hue_stats_live_count("hue::Vector") == 0);
+  return 0;
+}
@@ -0,0 +1,260 @@
+#include "../src/runtime/Vector.h"
+#include "../src/runtime/TypedVector.h"
+#include "../src/utf8/unchecked.h"
+
+#include <math.h>
+
+using std::cerr;
+using std::endl;
+using namespace hue;
+
+static uint64_t randState = 88172645463325252ULL;
+static uint64_t random64() {
+  randState ^= randState << 13;
+  randState ^= randState >> 7;
+  randState ^= randState << 17;
+  return randState;
+}
+
+// Runs every kernel of *k* over values[0...n-1] and compares the results with plain
+// loops. Values are biased towards a few small numbers so that find and count hit.
+static void testKernels(const SIMDKernels& k, size_t n, size_t misalign) {
+  std::vector<int64_t> ints(n + misalign);
+  std::vector<double> floats(n + misalign);
+  int64_t* iv = ints.data() + misalign;
+  double* fv = floats.data() + misalign;
+  for (size_t i = 0; i < n; ++i) {
+    uint64_t r = random64();
+    iv[i] = (r & 1) ? (int64_t)(r % 7) : (int64_t)r;
+    fv[i] = (r & 1) ? (double)(r % 7) : (double)(int64_t)r / 1e9;
+  }
+  if (n > 2) {
+    iv[n / 2] = INT64_MIN;
+    iv[n - 1] = INT64_MAX;
+  }
+
+  for (int64_t x = -1; x < 7; ++x) {
+    size_t find = 0, count = 0;
+    while (find < n && iv[find] != x) ++find;
+    for (size_t i = 0; i < n; ++i) count += (iv[i] == x);
+    assert(k.findInt(iv, n, x) == find);
+    assert(k.countInt(iv, n, x) == count);
+    find = 0, count = 0;
+    while (find < n && fv[find] != (double)x) ++find;
+    for (size_t i = 0; i < n; ++i) count += (fv[i] == (double)x);
+    assert(k.findFloat(fv, n, (double)x) == find);
+    assert(k.countFloat(fv, n, (double)x) == count);
+  }
+
+  uint64_t sum = 0;
+  for (size_t i = 0; i < n; ++i) sum += (uint64_t)iv[i];
+  assert(k.sumInt(iv, n) == (int64_t)sum);
+
+  // Float sums are identical for all levels and close to a plain sum
+  double fsum = 0;
+  for (size_t i = 0; i < n; ++i) fsum += fv[i];
+  double ksum = k.sumFloat(fv, n);
+  assert(ksum == simd_kernels(SIMDScalar)->sumFloat(fv, n));
+  assert(fabs(ksum - fsum) <= 1e-9 * fabs(fsum) + 1e-9);
+  (void)ksum;
+
+  if (n == 0) return;
+  assert(k.minInt(iv, n) == *std::min_element(iv, iv + n));
+  assert(k.maxInt(iv, n) == *std::max_element(iv, iv + n));
+  assert(k.minFloat(fv, n) == *std::min_element(fv, fv + n));
+  assert(k.maxFloat(fv, n) == *std::max_element(fv, fv + n));
+
+  // A NaN anywhere makes min and max NaN, and is never found
+  size_t nanIndex = random64() % n;
+  fv[nanIndex] = NAN;
+  assert(isnan(k.minFloat(fv, n)));
+  assert(isnan(k.maxFloat(fv, n)));
+  assert(k.findFloat(fv, n, NAN) == n);
+  assert(k.countFloat(fv, n, NAN) == 0);
+}
+
+static std::string encodeUTF8(const uint32_t* chars, size_t n) {
+  std::string s;
+  for (size_t i = 0; i < n; ++i) {
+    if (utf8::internal::is_code_point_valid(chars[i])) {
+      utf8::unchecked::append(chars[i], std::back_inserter(s));
+    }
+  }
+  return s;
+}
+
+// Code points from a mix of runs of ASCII, two-byte, three-byte and four-byte code
+// points, each run a *runLength* long on average, with a few invalid ones
+static void testEncodeUTF8(const SIMDKernels& k, size_t n, size_t runLength) {
+  static const uint32_t ranges[][2] = {
+    { 0, 0x80 }, { 0x80, 0x800 }, { 0x800, 0x10000 }, { 0x10000, 0x110000 },
+  };
+  std::vector<uint32_t> chars(n + 1);
+  size_t range = 0;
+  for (size_t i = 1; i <= n; ++i) {
+    uint64_t r = random64();
+    if (r % runLength == 0) range = (r >> 8) % 4;
+    if ((r >> 16) % 1000 == 0) {
+      chars[i] = ((r >> 32) & 1) ? 0xd800 + ((r >> 33) % 0x800) : 0x110000 + (r >> 40);
+    } else {
+      chars[i] = ranges[range][0] + ((r >> 32) % (ranges[range][1] - ranges[range][0]));
+    }
+  }
+  const uint32_t* p = chars.data() + 1; // misaligned
+  std::string expected = encodeUTF8(p, n);
+  std::vector<char> out((n * 4) + 1, '!');
+  size_t length = k.encodeUTF8(p, n, out.data());
+  assert(std::string(out.data(), length) == expected);
+  assert(out[n * 4] == '!');
+  (void)length;
+}
+
+int main() {
+  // Kernels, for every level the CPU supports
+  for (int level = SIMDScalar; level <= SIMDAVX2; ++level) {
+    const SIMDKernels* k = simd_kernels((SIMDLevel)level);
+    if (!k) {
+      cerr << "SIMD level " << level << " not supported" << endl;
+      continue;
+    }
+    assert(k->level == (SIMDLevel)level);
+    for (size_t n = 0; n <= 70; ++n) {
+      for (size_t misalign = 0; misalign < 4; ++misalign) testKernels(*k, n, misalign);
+    }
+    testKernels(*k, 1000, 1);
+    testKernels(*k, 4096, 0);
+
+    // -0.0 and 0.0 are equal
+    double zeros[20] = { 0 };
+    zeros[17] = -0.0;
+    assert(k->findFloat(zeros, 20, -0.0) == 0);
+    assert(k->countFloat(zeros, 20, 0.0) == 20);
+    (void)zeros;
+
+    for (size_t n = 0; n <= 100; ++n) {
+      testEncodeUTF8(*k, n, 1);
+      testEncodeUTF8(*k, n, 20);
+    }
+    testEncodeUTF8(*k, 10000, 3);
+    testEncodeUTF8(*k, 10000, 50);
+    testEncodeUTF8(*k, 10000, 1000);
+
+    // Pure ASCII, and two-byte code points mixed with ASCII
+    std::vector<uint32_t> chars(1000);
+    for (size_t i = 0; i < chars.size(); ++i) chars[i] = 0x20 + (i % 0x5f);
+    std::vector<char> out(chars.size() * 4);
+    size_t length = k->encodeUTF8(chars.data(), chars.size(), out.data());
+    assert(length == chars.size());
+    assert(std::string(out.data(), chars.size()) == encodeUTF8(chars.data(), chars.size()));
+    for (size_t i = 0; i < chars.size(); i += 3) chars[i] = 0x7f + i;
+    length = k->encodeUTF8(chars.data(), chars.size(), out.data());
+    assert(std::string(out.data(), length) == encodeUTF8(chars.data(), chars.size()));
+    (void)length;
+  }
+  cerr << "Using the " << simd().name << " kernels" << endl;
+
+  // Vector, across leaves and the tail
+  {
+    const size_t N = (32 * 40) + 5;
+    std::vector<void*> values(N);
+    for (size_t i = 0; i < N; ++i) values[i] = (void*)((int64_t)((i * 17) % 1001) - 500);
+    Vector* v = Vector::create(values.data(), N);
+    assert(v->find((void*)(int64_t)-500) == 0);
+    size_t find = std::find(values.begin(), values.end(), (void*)(int64_t)500) - values.begin();
+    assert(find != 0 && find < N);
+    assert(v->find((void*)(int64_t)500) == find);
+    (void)find;
+    assert(v->find((void*)(int64_t)1000) == Vector::NotFound);
+    int64_t sum = 0;
+    size_t count = 0;
+    for (size_t i = 0; i < N; ++i) {
+      sum += (int64_t)values[i];
+      count += ((int64_t)values[i] == 3);
+    }
+    assert(v->sumInt() == sum);
+    assert(v->countOf((void*)(int64_t)3) == count);
+    assert(v->minInt() == -500);
+    assert(v->maxInt() == 500);
+
+    // Values found in the tail are offset by the trie
+    Vector* v2 = v->append((void*)(int64_t)777);
+    assert(v2->find((void*)(int64_t)777) == N);
+    v2->release();
+    v->release();
+
+    // Floats stored in place of pointers
+    double floats[] = { 1.5, -2.25, 8, 0.5, 1.5 };
+    for (size_t i = 0; i < 5; ++i) memcpy(&values[i], &floats[i], sizeof(double));
+    v = Vector::create(values.data(), 5);
+    assert(v->findFloat(0.5) == 3);
+    assert(v->countOfFloat(1.5) == 2);
+    assert(v->sumFloat() == 9.25);
+    assert(v->minFloat() == -2.25);
+    assert(v->maxFloat() == 8);
+    v->release();
+
+    bool thrown = false;
+    try { Vector::Empty->minInt(); } catch (std::out_of_range&) { thrown = true; }
+    assert(thrown);
+    (void)thrown;
+    assert(Vector::Empty->find((void*)0) == Vector::NotFound);
+    assert(Vector::Empty->sumInt() == 0);
+  }
+
+  // TypedVector
+  {
+    const size_t N = (IntVector::LeafCap * 40) + 5;
+    std::vector<int64_t> ints(N);
+    std::vector<double> floats(N);
+    std::vector<uint8_t> bytes(N);
+    for (size_t i = 0; i < N; ++i) {
+      ints[i] = (int64_t)(random64() % 2000) - 1000;
+      floats[i] = (double)ints[i] / 4;
+      bytes[i] = (uint8_t)ints[i];
+    }
+    ints[N - 1] = 5000;
+    floats[N / 2] = -0.0;
+
+    IntVector* iv = IntVector::create(ints.data(), N);
+    size_t find = 0;
+    while (ints[find] != 17) ++find;
+    assert(iv->find(17) == find);
+    assert(iv->find(5000) == N - 1);
+    assert(iv->find(5001) == IntVector::NotFound);
+    assert(iv->countOf(17) == (size_t)std::count(ints.begin(), ints.end(), 17));
+    int64_t sum = 0;
+    for (size_t i = 0; i < N; ++i) sum += ints[i];
+    assert(iv->sum() == sum);
+    assert(iv->min() == *std::min_element(ints.begin(), ints.end()));
+    assert(iv->max() == 5000);
+    iv->release();
+
+    FloatVector* fv = FloatVector::create(floats.data(), N);
+    assert(fv->find(0.0) == (size_t)(std::find(floats.begin(), floats.end(), 0.0) - floats.begin()));
+    assert(fv->min() == *std::min_element(floats.begin(), floats.end()));
+    assert(fv->max() == *std::max_element(floats.begin(), floats.end()));
+    double fsum = 0;
+    for (size_t i = 0; i < N; ++i) fsum += floats[i];
+    assert(fabs(fv->sum() - fsum) < 1e-6);
+    FloatVector* fv2 = fv->assoc(3, NAN);
+    assert(isnan(fv2->min()));
+    assert(isnan(fv2->max()));
+    fv2->release();
+    fv->release();
+
+    ByteVector* bv = ByteVector::create(bytes.data(), N);
+    assert(bv->find(bytes[N - 1]) ==
+           (size_t)(std::find(bytes.begin(), bytes.end(), bytes[N - 1]) - bytes.begin()));
+    assert(bv->min() == *std::min_element(bytes.begin(), bytes.end()));
+    assert(bv->max() == *std::max_element(bytes.begin(), bytes.end()));
+    bv->release();
+
+    bool thrown = false;
+    try { FloatVector::Empty->max(); } catch (std::out_of_range&) { thrown = true; }
+    assert(thrown);
+    (void)thrown;
+  }
+
+  assert(hue_stats_live_count("hue::Vector") == 0);
+  return 0;
+}
@@ -0,0 +1,155 @@
+#include "../src/runtime/Vector.h"
+#include "../src/runtime/TypedVector.h"
+
+#include <math.h>
+
+using std::cerr;
+using std::endl;
+using namespace hue;
+
+static uint64_t randState = 88172645463325252ULL;
+static uint64_t random64() {
+  randState ^= randState << 13;
+  randState ^= randState >> 7;
+  randState ^= randState << 17;
+  return randState;
+}
+
+enum Distribution { Random, SmallRange, Equal, Ascending, Descending };
+
+static void testInts(size_t n, Distribution d, ThreadPool& pool) {
+  std::vector<int64_t> values(n);
+  for (size_t i = 0; i < n; ++i) {
+    switch (d) {
+      case Random:     values[i] = (int64_t)random64(); break;
+      case SmallRange: values[i] = (int64_t)(random64() % 100) - 50; break;
+      case Equal:      values[i] = -7; break;
+      case Ascending:  values[i] = (int64_t)i - (int64_t)(n / 2); break;
+      case Descending: values[i] = (int64_t)(n - i); break;
+    }
+  }
+  if (n > 2) {
+    values[0] = INT64_MAX;
+    values[n - 1] = INT64_MIN;
+  }
+  std::vector<int64_t> expected(values);
+  std::sort(expected.begin(), expected.end());
+  sort_ints(values.data(), n, pool);
+  assert(values == expected);
+}
+
+// Checks that values are expected sorted, except that -0.0 and 0.0 may come in any
+// order and NaNs come last
+static void assertSortedFloats(const double* values, std::vector<double> expected) {
+  size_t n = std::partition(expected.begin(), expected.end(),
+                            [](double v) { return v == v; }) - expected.begin();
+  std::sort(expected.begin(), expected.begin() + n);
+  for (size_t i = 0; i < n; ++i) assert(values[i] == expected[i]);
+  for (size_t i = n; i < expected.size(); ++i) assert(isnan(values[i]));
+}
+
+static void testFloats(size_t n, Distribution d, ThreadPool& pool) {
+  std::vector<double> values(n);
+  for (size_t i = 0; i < n; ++i) {
+    switch (d) {
+      case Random:     values[i] = ((double)(int64_t)random64()) / 1e6; break;
+      case SmallRange: values[i] = (double)(random64() % 10) - 5; break;
+      case Equal:      values[i] = 0.5; break;
+      case Ascending:  values[i] = (double)i; break;
+      case Descending: values[i] = -(double)i; break;
+    }
+  }
+  if (n > 10) {
+    values[1] = NAN;
+    values[n / 2] = -0.0;
+    values[n / 3] = 0.0;
+    values[n / 4] = -INFINITY;
+    values[n - 2] = INFINITY;
+    values[n - 1] = NAN;
+  }
+  std::vector<double> expected(values);
+  sort_floats(values.data(), n, pool);
+  assertSortedFloats(values.data(), expected);
+}
+
+int main() {
+  ThreadPool pool(4);
+  Distribution distributions[] = { Random, SmallRange, Equal, Ascending, Descending };
+  size_t sizes[] = { 0, 1, 2, 100, SortParallelMin - 1, SortParallelMin, 100000, 1000003 };
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+    for (size_t d = 0; d < sizeof(distributions) / sizeof(distributions[0]); ++d) {
+      testInts(sizes[s], distributions[d], pool);
+      testFloats(sizes[s], distributions[d], pool);
+    }
+  }
+
+  // The shared pool, whatever its size
+  testInts(200000, Random, ThreadPool::shared());
+  testFloats(200000, Random, ThreadPool::shared());
+
+  // Vector
+  {
+    const size_t N = 50000;
+    std::vector<void*> values(N);
+    for (size_t i = 0; i < N; ++i) values[i] = (void*)((int64_t)(random64() % 20000) - 10000);
+    Vector* v = Vector::create(values.data(), N);
+    void* first = values[0];
+    Vector* sorted = v->sortedInt(pool);
+    assert(sorted->count() == N);
+    std::sort(values.begin(), values.end(), [](void* a, void* b) {
+      return (int64_t)a < (int64_t)b;
+    });
+    for (size_t i = 0; i < N; ++i) assert(sorted->itemAt(i) == values[i]);
+    assert(v->itemAt(0) == first); // the receiver is unchanged
+    (void)first;
+    sorted->release();
+    v->release();
+
+    std::vector<double> floats(N);
+    for (size_t i = 0; i < N; ++i) {
+      floats[i] = (double)(random64() % 1000) / 8 - 60;
+      memcpy(&values[i], &floats[i], sizeof(double));
+    }
+    v = Vector::create(values.data(), N);
+    sorted = v->sortedFloat(pool);
+    std::vector<double> result(N);
+    for (size_t i = 0; i < N; ++i) {
+      void* value = sorted->itemAt(i);
+      memcpy(&result[i], &value, sizeof(double));
+    }
+    assertSortedFloats(result.data(), floats);
+    sorted->release();
+    v->release();
+
+    sorted = Vector::Empty->sortedInt();
+    assert(sorted->count() == 0);
+    sorted->release();
+  }
+
+  // TypedVector
+  {
+    const size_t N = 70000;
+    std::vector<int64_t> ints(N);
+    std::vector<uint8_t> bytes(N);
+    for (size_t i = 0; i < N; ++i) {
+      ints[i] = (int64_t)random64();
+      bytes[i] = (uint8_t)ints[i];
+    }
+    IntVector* iv = IntVector::create(ints.data(), N);
+    IntVector* sortedInts = iv->sorted(pool);
+    std::sort(ints.begin(), ints.end());
+    for (size_t i = 0; i < N; ++i) assert(sortedInts->itemAt(i) == ints[i]);
+    sortedInts->release();
+    iv->release();
+
+    ByteVector* bv = ByteVector::create(bytes.data(), N);
+    ByteVector* sortedBytes = bv->sorted();
+    std::sort(bytes.begin(), bytes.end());
+    for (size_t i = 0; i < N; ++i) assert(sortedBytes->itemAt(i) == bytes[i]);
+    sortedBytes->release();
+    bv->release();
+  }
+
+  assert(hue_stats_live_count("hue::Vector") == 0);
+  return 0;
+}
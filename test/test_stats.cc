@@ -0,0 +1,127 @@
+#include <hue/runtime/object.h>
+
+#include <assert.h>
+#include <string.h>
+
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using std::cerr;
+using std::endl;
+using namespace hue;
+
+class Toy { HUE_OBJECT(Toy)
+public:
+  int64_t value;
+  static Toy* create(int64_t value) {
+    Toy* obj = __alloc();
+    obj->value = value;
+    return obj;
+  }
+  void dealloc() {}
+};
+
+template <typename T>
+class Box { HUE_OBJECT(Box)
+public:
+  T value;
+  static Box* create(T value) {
+    Box* obj = __alloc();
+    obj->value = value;
+    return obj;
+  }
+  void dealloc() {}
+};
+
+static const hue_stats_type_t* findType(const std::vector<hue_stats_type_t>& types,
+                                        const char* prefix) {
+  for (size_t i = 0; i < types.size(); ++i) {
+    if (strncmp(types[i].name, prefix, strlen(prefix)) == 0) return &types[i];
+  }
+  return 0;
+}
+
+static std::vector<hue_stats_type_t> readTypes() {
+  std::vector<hue_stats_type_t> types(hue_stats_read_types(0, 0));
+  types.resize(hue_stats_read_types(types.data(), types.size()));
+  return types;
+}
+
+int main() {
+  #if !HUE_STATS
+  return 0; // nothing is counted
+  #endif
+  hue_stats_t s0, s1, s2;
+  hue_stats_read(&s0);
+  assert(s0.live_count == 0);
+  assert(hue_stats_live_count("Toy") == 0);
+
+  // Counting objects of one thread
+  const size_t N = 10000;
+  std::vector<Toy*> toys;
+  for (size_t i = 0; i < N; ++i) toys.push_back(Toy::create(i));
+  hue_stats_read(&s1);
+  assert(hue_stats_live_count("Toy") == (int64_t)N);
+  assert(s1.alloc_count - s0.alloc_count == N);
+  assert(s1.live_count == s0.live_count + (int64_t)N);
+  assert(s1.alloc_bytes - s0.alloc_bytes == N * sizeof(Toy));
+  assert(s1.live_bytes == s0.live_bytes + (int64_t)(N * sizeof(Toy)));
+  assert(s1.peak_bytes >= s1.live_bytes);
+  assert(s1.time_ns > s0.time_ns);
+  assert(hue_stats_alloc_rate(&s0, &s1) > 0.0);
+  for (size_t i = 0; i < N; ++i) toys[i]->release();
+  toys.clear();
+  hue_stats_read(&s2);
+  assert(hue_stats_live_count("Toy") == 0);
+  assert(s2.free_count - s1.free_count == N);
+  assert(s2.live_bytes == s0.live_bytes);
+  // The peak isn't forgotten when objects are freed
+  assert(s2.peak_bytes >= (int64_t)(N * sizeof(Toy)));
+
+  // Instances of a class template are told apart by their template arguments
+  Box<int>* intBox = Box<int>::create(1);
+  Box<double>* doubleBox = Box<double>::create(1.0);
+  std::vector<hue_stats_type_t> types = readTypes();
+  assert(types.size() == s2.type_count + 2);
+  const hue_stats_type_t* toyType = findType(types, "Toy");
+  assert(toyType && strcmp(toyType->name, "Toy") == 0);
+  assert(toyType->alloc_count == N && toyType->free_count == N && toyType->live_count == 0);
+  const hue_stats_type_t* box1 = &types[types.size() - 2];
+  const hue_stats_type_t* box2 = &types[types.size() - 1];
+  assert(strncmp(box1->name, "Box", 3) == 0 && strncmp(box2->name, "Box", 3) == 0);
+  assert(strcmp(box1->name, box2->name) != 0);
+  assert(box1->live_count == 1 && box2->live_count == 1);
+  (void)toyType; (void)box1; (void)box2;
+  intBox->release();
+  doubleBox->release();
+
+  // Objects allocated by threads which have exited and freed by another thread
+  const size_t T = 4;
+  std::vector<std::thread> threads;
+  std::vector<std::vector<Toy*> > made(T);
+  hue_stats_read(&s0);
+  for (size_t t = 0; t < T; ++t) {
+    threads.push_back(std::thread([&made, t, N]() {
+      for (size_t i = 0; i < N; ++i) {
+        Toy* toy = Toy::create(i);
+        if (i % 2 == 0) made[t].push_back(toy); else toy->release();
+      }
+    }));
+  }
+  for (size_t t = 0; t < T; ++t) threads[t].join();
+  hue_stats_read(&s1);
+  assert(s1.thread_count == s0.thread_count);
+  assert(s1.alloc_count - s0.alloc_count == T * N);
+  assert(hue_stats_live_count("Toy") == (int64_t)(T * N / 2));
+  for (size_t t = 0; t < T; ++t) {
+    for (size_t i = 0; i < made[t].size(); ++i) made[t][i]->release();
+  }
+  hue_stats_read(&s2);
+  assert(hue_stats_live_count("Toy") == 0);
+  assert(s2.live_count == s0.live_count);
+  assert(s2.live_bytes == s0.live_bytes);
+  assert(s2.peak_bytes >= (int64_t)(T * N / 2 * sizeof(Toy)));
+
+  return 0;
+}
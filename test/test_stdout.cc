@@ -0,0 +1,122 @@
+#include <hue/runtime/runtime.h>
+
+#include <assert.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+
+using namespace hue;
+
+// Reads whatever is in the pipe without blocking
+static std::string readAvailable(int fd) {
+  std::string s;
+  char buf[4096];
+  ssize_t n;
+  while ((n = read(fd, buf, sizeof(buf))) > 0) s.append(buf, n);
+  return s;
+}
+
+static DataS makeData(const std::string& s) {
+  DataS data = (DataS)malloc(sizeof(DataS_) + s.size());
+  data->length = s.size();
+  memcpy(data->data, s.data(), s.size());
+  return data;
+}
+
+static TextS makeText(const UChar* chars, Int length) {
+  TextS text = (TextS)malloc(sizeof(TextS_) + (sizeof(UChar) * length));
+  text->length = length;
+  memcpy(text->data, chars, sizeof(UChar) * length);
+  return text;
+}
+
+int main() {
+  // Capture stdout in a pipe, which isn't a terminal
+  int fds[2];
+  int rc = pipe(fds);
+  assert(rc == 0);
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+  int savedStdout = dup(STDOUT_FILENO);
+  dup2(fds[1], STDOUT_FILENO);
+
+  // Nothing is written until the buffer is flushed
+  DataS data = makeData("data");
+  UChar chars[] = { 'h', 0xe5, 'j', ' ', 0x1f600 };
+  TextS text = makeText(chars, 5);
+  stdout_write(true);
+  stdout_write((Int)-42);
+  stdout_write((Byte)0xff);
+  stdout_write((UChar)0x20ac);
+  stdout_write(data);
+  stdout_write(text);
+  stdout_write((UChar)0xd800); // invalid
+  stdout_write("\n"[0] == '\n');
+  assert(readAvailable(fds[0]) == "");
+  stdout_flush();
+  assert(readAvailable(fds[0]) == "true-42ff\xe2\x82\xac" "datah\xc3\xa5j \xf0\x9f\x98\x80true");
+
+  // Several values in one call
+  OutputValue values[4];
+  values[0].kind = OutputInt;   values[0].i = 7;
+  values[1].kind = OutputUChar; values[1].c = ',';
+  values[2].kind = OutputBool;  values[2].b = false;
+  values[3].kind = OutputText;  values[3].text = text;
+  stdout_write_values(values, 4);
+  stdout_flush();
+  assert(readAvailable(fds[0]) == "7,falseh\xc3\xa5j \xf0\x9f\x98\x80");
+
+  // The buffer is written out when full
+  std::string line(1000, 'x');
+  DataS lineData = makeData(line);
+  size_t written = 0;
+  std::string output;
+  while (output.empty()) {
+    stdout_write(lineData);
+    written += line.size();
+    output = readAvailable(fds[0]);
+  }
+  assert(written > line.size() && output.size() < written);
+  stdout_flush();
+  output += readAvailable(fds[0]);
+  assert(output.size() == written);
+
+  // Threads flush their buffers when they exit
+  std::thread([&]() { stdout_write(data); }).join();
+  assert(readAvailable(fds[0]) == "data");
+
+  // The buffer of the thread calling exit() is flushed at exit, and writes larger than
+  // the buffer go straight out
+  int childFds[2];
+  rc = pipe(childFds);
+  assert(rc == 0);
+  (void)rc;
+  pid_t pid = fork();
+  if (pid == 0) {
+    dup2(childFds[1], STDOUT_FILENO);
+    stdout_write(data);
+    DataS big = makeData(std::string(200000, 'y'));
+    stdout_write(big);
+    free(big);
+    stdout_write(text);
+    exit(0);
+  }
+  close(childFds[1]);
+  std::string childOutput;
+  char buf[4096];
+  ssize_t n;
+  while ((n = read(childFds[0], buf, sizeof(buf))) > 0) childOutput.append(buf, n);
+  int status;
+  waitpid(pid, &status, 0);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  assert(childOutput == "data" + std::string(200000, 'y') + "h\xc3\xa5j \xf0\x9f\x98\x80");
+
+  dup2(savedStdout, STDOUT_FILENO);
+  free(data);
+  free(lineData);
+  free(text);
+  return 0;
+}
@@ -0,0 +1,117 @@
+#include "../src/runtime/TypedVector.h"
+
+#include <iostream>
+#include <vector>
+
+using std::cerr;
+using std::endl;
+using namespace hue;
+
+// Checks that v holds exactly the values of expected
+template <typename T>
+static void assertEqual(const TypedVector<T>* v, const std::vector<T>& expected) {
+  assert(v->count() == expected.size());
+  for (size_t i = 0; i < expected.size(); ++i) {
+    if (v->itemAt(i) != expected[i]) {
+      cerr << "itemAt(" << i << ") returned incorrect value" << endl;
+    }
+    assert(v->itemAt(i) == expected[i]);
+  }
+  size_t offset = 0;
+  v->forEachChunk([&](const T* values, size_t n) {
+    assert(n != 0 && n <= TypedVector<T>::LeafCap);
+    for (size_t j = 0; j < n; ++j) assert(values[j] == expected[offset + j]);
+    offset += n;
+  });
+  assert(offset == expected.size());
+}
+
+template <typename T>
+static void test(T (*valueAt)(size_t)) {
+  typedef TypedVector<T> V;
+  const size_t leafCap = V::LeafCap;
+
+  // Appending, across two root overflows
+  size_t N = (leafCap * 32 * 32) + (leafCap * 3) + 7;
+  std::vector<T> expected;
+  V* v = V::Empty;
+  for (size_t i = 0; i < N; ++i) {
+    V* oldV = v;
+    v = v->append(valueAt(i));
+    oldV->release();
+    expected.push_back(valueAt(i));
+  }
+  assertEqual(v, expected);
+
+  // Bulk creation
+  size_t sizes[] = { 0, 1, leafCap - 1, leafCap, leafCap + 1, leafCap * 32,
+                     (leafCap * 32) + 1, (leafCap * 33) + 1, N };
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+    std::vector<T> values(expected.begin(), expected.begin() + sizes[s]);
+    V* v2 = V::create(values.data(), values.size());
+    assertEqual(v2, values);
+
+    // Keep appending to a bulk-created vector
+    for (size_t i = 0; i < leafCap + 3; ++i) {
+      V* oldV = v2;
+      v2 = v2->append(valueAt(i));
+      oldV->release();
+      values.push_back(valueAt(i));
+    }
+    assertEqual(v2, values);
+    v2->release();
+  }
+
+  // Replacing values in the trie and in the tail leaves the original intact
+  size_t indices[] = { 0, 1, leafCap, N / 2, N - 8, N - 1 };
+  std::vector<T> replaced(expected);
+  V* v3 = v->retain();
+  for (size_t k = 0; k < sizeof(indices) / sizeof(indices[0]); ++k) {
+    V* oldV = v3;
+    v3 = v3->assoc(indices[k], valueAt(k + 3));
+    oldV->release();
+    replaced[indices[k]] = valueAt(k + 3);
+  }
+  assertEqual(v3, replaced);
+  assertEqual(v, expected);
+  v3->release();
+
+  // Like Vector, assoc doesn't append
+  bool threw = false;
+  try { v->assoc(v->count(), valueAt(0)); } catch (std::out_of_range&) { threw = true; }
+  assert(threw);
+  (void)threw;
+
+  // Popping down to empty, collapsing the root along the way
+  while (v->count() != 0) {
+    V* oldV = v;
+    v = v->pop();
+    oldV->release();
+    expected.pop_back();
+    if (expected.size() % 997 == 0) assertEqual(v, expected);
+  }
+  assert(v == V::Empty);
+
+  threw = false;
+  try { v->pop(); } catch (std::out_of_range&) { threw = true; }
+  assert(threw);
+  threw = false;
+  try { v->itemAt(0); } catch (std::out_of_range&) { threw = true; }
+  assert(threw);
+}
+
+static int64_t intAt(size_t i) { return (int64_t)(i * 7) - 1000; }
+static double floatAt(size_t i) { return i * 0.5; }
+static uint8_t byteAt(size_t i) { return (uint8_t)(i * 13); }
+
+int main() {
+  assert(IntVector::LeafCap == 32);
+  assert(FloatVector::LeafCap == 32);
+  assert(ByteVector::LeafCap == 256);
+
+  test<int64_t>(intAt);
+  test<double>(floatAt);
+  test<uint8_t>(byteAt);
+
+  return 0;
+}
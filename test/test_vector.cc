@@ -1,5 +1,3 @@
-#define DEBUG_Node_refcount
-#define DEBUG_Vector_refcount
 #include "../src/runtime/Vector.h"
 
 using std::cerr;
@@ -37,16 +35,295 @@ int main() {
   ((Vector*)v)->release();
   v = 0;
   
+  // Build the same vector using a transient, then keep appending to the transient
+  // after making it persistent, which must not affect the persistent vector.
+  {
+    Vector::Transient t;
+    for (i = 0; i < N; ++i) {
+      t.append((void*)(i * 10));
+    }
+    assert(t.count() == N);
+    v = t.persistent();
+    for (i = 0; i < 100; ++i) {
+      t.append((void*)(i + 1));
+    }
+    assert(t.count() == N + 100);
+    Vector* v2 = t.persistent();
+
+    assert(v->count() == N);
+    for (i = 0; i < N; ++i) {
+      assert((uint64_t)v->itemAt(i) == (uint64_t)(i * 10));
+      assert((uint64_t)v2->itemAt(i) == (uint64_t)(i * 10));
+    }
+    for (i = 0; i < 100; ++i) {
+      assert((uint64_t)v2->itemAt(N + i) == (uint64_t)(i + 1));
+    }
+    v2->release();
+  }
+
+  // A transient created from an existing vector must leave that vector untouched
+  {
+    Vector::Transient t(v);
+    t.append((void*)1);
+    Vector* v2 = t.persistent();
+    Vector* v3 = v2->append((void*)2);
+    assert(v->count() == N);
+    assert(v2->count() == N + 1);
+    assert(v3->count() == N + 2);
+    assert((uint64_t)v2->itemAt(N) == 1);
+    assert((uint64_t)v3->itemAt(N + 1) == 2);
+    assert((uint64_t)v->itemAt(N - 1) == (uint64_t)((N - 1) * 10));
+    v3->release();
+    v2->release();
+  }
+
+  v->release();
+  v = 0;
+  
+  // Bulk construction from an array, around the sizes where the trie changes shape.
+  // Appending to the result must continue the same trie layout.
+  {
+    size_t sizes[] = {0, 1, 31, 32, 33, 64, 1024, 1055, 1056, 1057, 33*1024, 33*1024+33, 100000};
+    for (size_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); ++s) {
+      size_t count = sizes[s];
+      std::vector<void*> values(count + 1);
+      for (i = 0; i < count; ++i) values[i] = (void*)(i * 3);
+      Vector* bv = Vector::create(values.data(), count);
+      assert(bv->count() == count);
+      for (i = 0; i < count; ++i) {
+        assert((uint64_t)bv->itemAt(i) == (uint64_t)(i * 3));
+      }
+      for (i = 0; i < 2000; ++i) {
+        Vector* oldV = bv;
+        bv = bv->append((void*)(i + 7));
+        oldV->release();
+      }
+      assert(bv->count() == count + 2000);
+      for (i = 0; i < count; ++i) {
+        assert((uint64_t)bv->itemAt(i) == (uint64_t)(i * 3));
+      }
+      for (i = 0; i < 2000; ++i) {
+        assert((uint64_t)bv->itemAt(count + i) == (uint64_t)(i + 7));
+      }
+
+      // Chunked iteration must visit every value once, in order
+      Vector::ChunkIterator it(bv);
+      void* const* chunk;
+      size_t visited = 0;
+      while (size_t n = it.next(chunk)) {
+        assert(n <= 32);
+        assert(it.offset() == visited);
+        for (size_t j = 0; j < n; ++j, ++visited) {
+          assert(chunk[j] == bv->itemAt(visited));
+        }
+      }
+      assert(visited == bv->count());
+      bv->release();
+    }
+  }
+  
+  // assoc, pop and subvec must leave the source vector untouched
+  {
+    size_t count = 33*1024 + 40;
+    std::vector<void*> values(count);
+    for (i = 0; i < count; ++i) values[i] = (void*)i;
+    Vector* src = Vector::create(values.data(), count);
+
+    Vector* a = src;
+    for (i = 0; i < count; i += 97) {
+      Vector* oldV = a;
+      a = a->assoc(i, (void*)(i + 1000000));
+      if (oldV != src) oldV->release();
+    }
+    for (i = 0; i < count; ++i) {
+      assert((uint64_t)src->itemAt(i) == i);
+      assert((uint64_t)a->itemAt(i) == ((i % 97 == 0) ? i + 1000000 : i));
+    }
+    a->release();
+
+    Vector* p = src->retain();
+    while (p->count() != 0) {
+      Vector* oldV = p;
+      p = p->pop();
+      oldV->release();
+      if (p->count() % 1000 == 0 || p->count() < 70) {
+        for (i = 0; i < p->count(); ++i) assert((uint64_t)p->itemAt(i) == i);
+        Vector* q = p->append((void*)7);
+        assert(q->count() == p->count() + 1);
+        assert((uint64_t)q->itemAt(p->count()) == 7);
+        q->release();
+      }
+    }
+    p->release();
+
+    size_t ranges[][2] = {{0, 0}, {0, 1}, {0, 32}, {0, 33}, {0, 1024}, {0, 1056},
+                          {0, 1057}, {0, 33*1024}, {0, count - 5}, {0, count},
+                          {1, 2}, {5, 40}, {31, 1100}, {1000, count}};
+    for (size_t r = 0; r < sizeof(ranges)/sizeof(ranges[0]); ++r) {
+      size_t start = ranges[r][0], end = ranges[r][1];
+      Vector* sub = src->subvec(start, end);
+      assert(sub->count() == end - start);
+      for (i = 0; i < sub->count(); ++i) assert((uint64_t)sub->itemAt(i) == start + i);
+      for (i = 0; i < 1100; ++i) {
+        Vector* oldV = sub;
+        sub = sub->append((void*)(i + 5));
+        oldV->release();
+      }
+      for (i = 0; i < end - start; ++i) assert((uint64_t)sub->itemAt(i) == start + i);
+      for (i = 0; i < 1100; ++i) assert((uint64_t)sub->itemAt(end - start + i) == i + 5);
+      sub->release();
+    }
+    for (i = 0; i < count; ++i) assert((uint64_t)src->itemAt(i) == i);
+    src->release();
+  }
+  
+  // Appending writes to a free slot of a shared tail rather than copying it. Only one
+  // of the vectors sharing a tail gets to do that; the others copy it.
+  {
+    hue_stats_t before, after;
+    hue_stats_read(&before);
+    Vector* base = Vector::Empty->append((void*)0);
+    for (i = 1; i < 20; ++i) {
+      Vector* next = base->append((void*)i);
+      base->release();
+      base = next;
+    }
+    hue_stats_read(&after);
+    // One tail node, and one vector per append
+    #if HUE_STATS
+    assert(after.alloc_count - before.alloc_count == 21);
+    #endif
+
+    Vector* a = base->append((void*)100);
+    Vector* b = base->append((void*)200);
+    Vector* aPopped = a->pop();
+    Vector* c = aPopped->append((void*)300);
+    aPopped->release();
+    Vector* d = base->pop();
+    Vector* e = d->append((void*)400);
+    assert(base->count() == 20 && a->count() == 21 && b->count() == 21);
+    assert((uint64_t)a->itemAt(20) == 100);
+    assert((uint64_t)b->itemAt(20) == 200);
+    assert(c->count() == 21 && (uint64_t)c->itemAt(20) == 300);
+    assert(d->count() == 19 && e->count() == 20 && (uint64_t)e->itemAt(19) == 400);
+    assert((uint64_t)base->itemAt(19) == 19);
+    for (i = 0; i < 19; ++i) {
+      assert((uint64_t)a->itemAt(i) == i && (uint64_t)b->itemAt(i) == i);
+      assert((uint64_t)c->itemAt(i) == i && (uint64_t)e->itemAt(i) == i);
+    }
+    assert(!a->equals(b) && a->hash() != b->hash());
+    Vector* ePopped = e->pop();
+    assert(ePopped->equals(d));
+    ePopped->release();
+
+    // A transient and a concatenation must not see values appended by other vectors
+    // sharing the tail
+    Vector::Transient t(base);
+    t.append((void*)500);
+    Vector* f = t.persistent();
+    Vector* g = base->concat(a);
+    assert((uint64_t)f->itemAt(20) == 500 && (uint64_t)a->itemAt(20) == 100);
+    assert(g->count() == 41 && (uint64_t)g->itemAt(20) == 0 && (uint64_t)g->itemAt(40) == 100);
+    g->release();
+    f->release();
+    e->release();
+    d->release();
+    c->release();
+    b->release();
+    a->release();
+    base->release();
+  }
+
+  // Small vectors take one allocation, and behave like any other vector
+  {
+    hue_stats_t before, after;
+    void* values[Vector::SmallMax + 1];
+    for (i = 0; i <= Vector::SmallMax; ++i) values[i] = (void*)(i + 1);
+    hue_stats_read(&before);
+    Vector* s = Vector::create(values, 3);
+    Vector* v = Vector::Empty;
+    for (i = 0; i < Vector::SmallMax; ++i) {
+      Vector* next = v->append(values[i]);
+      v->release();
+      v = next;
+    }
+    hue_stats_read(&after);
+    #if HUE_STATS
+    assert(after.alloc_count - before.alloc_count == 1 + Vector::SmallMax);
+    #endif
+    Vector* big = Vector::create(values, Vector::SmallMax + 1);
+    Vector* grown = v->append(values[Vector::SmallMax]);
+    assert(grown->equals(big) && grown->hash() == big->hash());
+
+    Vector* popped = big->pop();
+    Vector* changed = v->assoc(1, (void*)100);
+    Vector* sliced = v->subvec(1, 4);
+    Vector* joined = s->concat(sliced);
+    assert(popped->equals(v) && popped->hash() == v->hash());
+    assert((uint64_t)changed->itemAt(1) == 100 && (uint64_t)v->itemAt(1) == 2);
+    assert(sliced->count() == 3 && (uint64_t)sliced->itemAt(0) == 2);
+    assert(joined->count() == 6 && (uint64_t)joined->itemAt(3) == 2);
+    {
+      // The transient must not depend on the small vector it was made from
+      Vector::Transient t(s);
+      s->release();
+      t.append((void*)4);
+      s = t.persistent();
+    }
+    assert(s->count() == 4 && (uint64_t)s->itemAt(3) == 4);
+    Vector* combined = big->concat(s);
+    assert(combined->count() == Vector::SmallMax + 5);
+    assert((uint64_t)combined->itemAt(Vector::SmallMax) == Vector::SmallMax + 1);
+    assert((uint64_t)combined->itemAt(Vector::SmallMax + 4) == 4);
+    combined->release();
+    joined->release();
+    sliced->release();
+    changed->release();
+    popped->release();
+    grown->release();
+    big->release();
+    s->release();
+    v->release();
+  }
+
+  // appendConsuming reuses a uniquely referenced vector, and copies one that's shared
+  // or small
+  {
+    hue_stats_t before, after;
+    hue_stats_read(&before);
+    Vector* v = Vector::Empty;
+    Vector* first = 0;
+    for (i = 0; i < N; ++i) {
+      v = v->appendConsuming((void*)i);
+      if (i == Vector::SmallMax) first = v;
+      assert(i <= Vector::SmallMax || v == first);
+    }
+    (void)first;
+    hue_stats_read(&after);
+    assert(after.alloc_count - before.alloc_count < N / 16);
+
+    Vector* shared = v->retain();
+    v = v->appendConsuming((void*)N);
+    assert(v != shared);
+    assert(shared->count() == N);
+    for (i = 0; i < 100; ++i) v = v->appendConsuming((void*)(N + 1 + i));
+    assert(v->count() == N + 101);
+    for (i = 0; i < N + 101; ++i) assert((uint64_t)v->itemAt(i) == (uint64_t)i);
+    for (i = 0; i < N; ++i) assert((uint64_t)shared->itemAt(i) == (uint64_t)i);
+    shared->release();
+    v->release();
+  }
+
+  // Chunked iteration of the empty vector
+  {
+    size_t visited = 0;
+    Vector::Empty->forEachChunk([&](void* const*, size_t n) { visited += n; });
+    assert(visited == 0);
+  }
+  
   // Verify that there are no leaks
-  #ifdef DEBUG_LIVECOUNT_Node
-  //cerr << "livecount of Node: " << DEBUG_LIVECOUNT_Node << endl;
-  assert(DEBUG_LIVECOUNT_Node == 0);
-  #endif
-  
-  #ifdef DEBUG_LIVECOUNT_Vector
-  //cerr << "livecount of Vector: " << DEBUG_LIVECOUNT_Vector << endl;
-  assert(DEBUG_LIVECOUNT_Vector == 0);
-  #endif
+  assert(hue_stats_live_count("hue::Vector::Node") == 0);
+  assert(hue_stats_live_count("hue::Vector") == 0);
   
   return 0;
 }
@@ -0,0 +1,178 @@
+#include "../src/runtime/Vector.h"
+
+#include <sys/time.h>
+
+using std::cerr;
+using std::endl;
+using namespace hue;
+
+typedef std::vector<std::pair<size_t, size_t> > Ranges;
+
+static Vector* makeVector(size_t count, uint64_t base) {
+  std::vector<void*> values(count);
+  for (size_t i = 0; i < count; ++i) values[i] = (void*)(base + i);
+  return Vector::create(values.data(), count);
+}
+
+static Ranges diff(const Vector* a, const Vector* b) {
+  Ranges ranges;
+  a->diff(b, [&](size_t start, size_t end) {
+    ranges.push_back(std::make_pair(start, end));
+  });
+  return ranges;
+}
+
+// Ranges at which a and b differ, computed by comparing every value
+static Ranges slowDiff(const Vector* a, const Vector* b) {
+  Ranges ranges;
+  size_t n = std::max(a->count(), b->count());
+  for (size_t i = 0; i < n; ++i) {
+    bool same = i < a->count() && i < b->count() && a->itemAt(i) == b->itemAt(i);
+    if (same) continue;
+    if (!ranges.empty() && ranges.back().second == i) {
+      ranges.back().second = i + 1;
+    } else {
+      ranges.push_back(std::make_pair(i, i + 1));
+    }
+  }
+  return ranges;
+}
+
+static void check(const Vector* a, const Vector* b) {
+  Ranges expected = slowDiff(a, b);
+  assert(diff(a, b) == expected);
+  assert(a->equals(b) == expected.empty());
+  assert(b->equals(a) == expected.empty());
+  if (expected.empty()) assert(a->hash() == b->hash());
+}
+
+static Vector* assoc(Vector* v, size_t i, uint64_t value) {
+  Vector* v2 = v->assoc(i, (void*)value);
+  v->release();
+  return v2;
+}
+
+static uint64_t microtime() {
+  struct timeval tv;
+  gettimeofday(&tv, 0);
+  return ((uint64_t)tv.tv_sec * 1000000) + tv.tv_usec;
+}
+
+int main() {
+  assert(Vector::Empty->equals(Vector::Empty));
+  assert(Vector::Empty->hash() == 0);
+
+  // Versions of a vector, differing by a few values
+  const size_t N = 100000;
+  Vector* a = makeVector(N, 1);
+  Vector* b = a->retain();
+  check(a, b);
+  b = assoc(b, 5, 0);
+  b = assoc(b, 6, 0);
+  b = assoc(b, 7, 0);
+  b = assoc(b, 40000, 0);
+  b = assoc(b, N - 1, 0);
+  check(a, b);
+  Ranges ranges = diff(a, b);
+  assert(ranges.size() == 3);
+  assert(ranges[0] == std::make_pair((size_t)5, (size_t)8));
+  assert(ranges[1] == std::make_pair((size_t)40000, (size_t)40001));
+  assert(ranges[2] == std::make_pair(N - 1, N));
+  assert(a->hash() != b->hash());
+
+  // Putting the values back makes the vectors equal again, with different nodes
+  b = assoc(b, 5, 6);
+  b = assoc(b, 6, 7);
+  b = assoc(b, 7, 8);
+  b = assoc(b, 40000, 40001);
+  b = assoc(b, N - 1, N);
+  check(a, b);
+
+  // Different lengths
+  Vector* c = a->append((void*)1);
+  Vector* d = a->pop();
+  check(a, c);
+  check(a, d);
+  check(c, d);
+  assert(diff(a, c) == Ranges(1, std::make_pair(N, N + 1)));
+  assert(diff(d, a) == Ranges(1, std::make_pair(N - 1, N)));
+  check(Vector::Empty, a);
+  c->release();
+  d->release();
+
+  // The same values in tries of different shapes
+  Vector* left = a->subvec(0, 33333);
+  Vector* right = a->subvec(33333, N);
+  Vector* joined = left->concat(right);
+  Vector* appended = Vector::Empty;
+  for (size_t i = 0; i < N; ++i) {
+    Vector* v = appended->append((void*)(i + 1));
+    appended->release();
+    appended = v;
+  }
+  check(a, joined);
+  check(a, appended);
+  assert(left->hash() != right->hash());
+  Vector* joined2 = assoc(joined->retain(), 50000, 7);
+  check(a, joined2);
+  check(joined, joined2);
+  assert(diff(joined, joined2) == Ranges(1, std::make_pair((size_t)50000, (size_t)50001)));
+  joined2->release();
+  joined->release();
+  left->release();
+  right->release();
+
+  // A node's cached hash is dropped when a transient modifies the node in place
+  {
+    Vector* short1 = makeVector(1000, 1);
+    Vector::Transient t(short1);
+    Vector* snapshot = t.persistent();
+    snapshot->hash();
+    snapshot->release();
+    short1->release();
+    for (size_t i = 1000; i < N; ++i) t.append((void*)(i + 1));
+    Vector* built = t.persistent();
+    assert(built->hash() == a->hash());
+    check(a, built);
+    built->release();
+  }
+
+  // Comparing versions only visits the nodes which differ
+  const size_t M = 4000000;
+  Vector* big = makeVector(M, 1);
+  Vector* big2 = assoc(big->retain(), M / 2, 0);
+  uint64_t t0 = microtime();
+  const int R = 1000;
+  for (int i = 0; i < R; ++i) {
+    assert(!big->equals(big2));
+    assert(diff(big, big2).size() == 1);
+  }
+  uint64_t t1 = microtime();
+  Vector* copy = makeVector(M, 1);
+  uint64_t t2 = microtime();
+  assert(copy->equals(big));
+  uint64_t t3 = microtime();
+  cerr << "equals+diff of versions: " << ((t1 - t0) * 1000 / R) << " ns, "
+       << "equals of copies: " << (t3 - t2) << " us" << endl;
+
+  // Hashes are cached, so rehashing a version only visits its new nodes
+  t0 = microtime();
+  big->hash();
+  t1 = microtime();
+  big2->hash();
+  t2 = microtime();
+  cerr << "hash: " << (t1 - t0) << " us, hash of version: " << (t2 - t1) << " us" << endl;
+  copy->release();
+  big2->release();
+  big->release();
+
+  appended->release();
+  b->release();
+  a->release();
+
+  // Verify that there are no leaks
+  assert(hue_stats_live_count("hue::Vector::Node") == 0);
+  assert(hue_stats_live_count("hue::Vector") == 0);
+
+  return 0;
+}
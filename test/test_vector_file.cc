@@ -0,0 +1,173 @@
+#include "../src/runtime/Vector.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+using std::cerr;
+using std::endl;
+using namespace hue;
+
+static double msSince(clock_t start) {
+  return ((double)(clock() - start)) / CLOCKS_PER_SEC * 1000.0;
+}
+
+static void assertEqual(const Vector* a, const Vector* b) {
+  assert(a->count() == b->count());
+  for (size_t i = 0; i < a->count(); ++i) {
+    assert(a->itemAt(i) == b->itemAt(i));
+  }
+}
+
+// Writes v to path, maps it back and compares it to v
+static void roundtrip(const Vector* v, const char* path) {
+  bool written = v->writeFile(path);
+  assert(written);
+  (void)written;
+  Vector* mapped = Vector::mapFile(path);
+  assert(mapped != 0);
+  assertEqual(v, mapped);
+  // Hashing doesn't write to the read-only nodes of the mapping
+  assert(mapped->equals(v));
+  assert(mapped->hash() == v->hash());
+
+  // The mapped vector can't be retained or released, but can be used to derive new
+  // vectors
+  mapped->retain();
+  mapped->release();
+  if (mapped->count() != 0) {
+    Vector* v1 = mapped->assoc(0, (void*)12345);
+    Vector* v2 = v1->append((void*)1);
+    assert(v2->itemAt(0) == (void*)12345);
+    assert(v2->count() == v->count() + 1);
+    v2->release();
+    v1->release();
+  }
+  Vector::unmapFile(mapped);
+}
+
+int main(int argc, char **argv) {
+  // This test writes a vector of N values to a file (argv[1]) and compares the time it
+  // takes to map it back into memory with the time it takes to rebuild it by
+  // appending every value.
+  const char* path = (argc > 1) ? argv[1] : "test_vector_file.vec";
+  uint64_t N = (argc > 2) ? atoll(argv[2]) : 1000000;
+
+  std::vector<void*> values(N);
+  for (uint64_t i = 0; i < N; ++i) values[i] = (void*)(i * 3);
+  Vector* v = Vector::create((const void* const*)values.data(), N);
+
+  // Small and empty vectors, and a relaxed trie which shares nodes with itself
+  size_t sizes[] = { 0, 1, 8, 9, 32, 33, 1057 };
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+    Vector* small = Vector::create((const void* const*)values.data(), sizes[s]);
+    roundtrip(small, path);
+    small->release();
+  }
+  Vector* half = v->subvec(77, N / 2);
+  Vector* twice = half->concat(half);
+  roundtrip(twice, path);
+  twice->release();
+  half->release();
+
+  // Mapping at another address than the one the file was written for
+  bool written = v->writeFile(path);
+  assert(written);
+  (void)written;
+  Vector* mapped = Vector::mapFile(path);
+  Vector* mapped2 = Vector::mapFile(path);
+  assert(mapped != mapped2);
+  assertEqual(v, mapped2);
+  Vector::unmapFile(mapped2);
+  Vector::unmapFile(mapped);
+
+  // Corrupt files are rejected when relocated, which happens here since the first
+  // mapping holds the address the file was written for
+  {
+    written = v->writeFile(path);
+    assert(written);
+    FILE* f = fopen(path, "rb");
+    std::string contents;
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) != 0) contents.append(buf, n);
+    fclose(f);
+    mapped = Vector::mapFile(path);
+    std::string badPath = std::string(path) + ".bad";
+
+    // A node header with a length and capacity past 32
+    std::string bad(contents);
+    memset(&bad[4096], 0xff, 64);
+    f = fopen(badPath.c_str(), "wb");
+    fwrite(bad.data(), 1, bad.size(), f);
+    fclose(f);
+    errno = 0;
+    assert(Vector::mapFile(badPath.c_str()) == 0);
+    assert(errno == EINVAL);
+
+    // Random damage is either rejected or relocated without crashing
+    uint64_t r = 88172645463325252ULL;
+    for (int k = 0; k < 200; ++k) {
+      bad = contents;
+      for (int j = 0; j < 4; ++j) {
+        r ^= r << 13; r ^= r >> 7; r ^= r << 17;
+        bad[4096 + (r % (bad.size() - 4096))] ^= (char)(1 << (r >> 61));
+      }
+      f = fopen(badPath.c_str(), "wb");
+      fwrite(bad.data(), 1, bad.size(), f);
+      fclose(f);
+      Vector* m = Vector::mapFile(badPath.c_str());
+      assert(m != 0 || errno == EINVAL);
+      if (m) Vector::unmapFile(m);
+    }
+    unlink(badPath.c_str());
+    Vector::unmapFile(mapped);
+  }
+
+  // Not a vector file
+  errno = 0;
+  assert(Vector::mapFile(argv[0]) == 0);
+  assert(errno == EINVAL);
+
+  // Benchmark
+  clock_t start1 = clock();
+  written = v->writeFile(path);
+  assert(written);
+  cerr << "Writing " << N << " values: " << msSince(start1) << " ms" << endl;
+
+  clock_t start2 = clock();
+  mapped = Vector::mapFile(path);
+  double ms2 = msSince(start2);
+  cerr << "Mapping " << N << " values: " << ms2 << " ms" << endl;
+  assert(mapped->count() == N);
+
+  clock_t start3 = clock();
+  uint64_t sum = 0;
+  mapped->forEachChunk([&](void* const* values, size_t n) {
+    for (size_t j = 0; j < n; ++j) sum += (uint64_t)values[j];
+  });
+  cerr << "Iterating " << N << " mapped values: " << msSince(start3) << " ms" << endl;
+  assert(sum == 3 * (N * (N - 1) / 2));
+  Vector::unmapFile(mapped);
+
+  clock_t start4 = clock();
+  Vector* appended = Vector::Empty;
+  for (uint64_t i = 0; i < N; ++i) {
+    Vector* oldV = appended;
+    appended = appended->append(values[i]);
+    oldV->release();
+  }
+  cerr << "Reloading " << N << " values by appending: " << msSince(start4) << " ms" << endl;
+  appended->release();
+
+  v->release();
+  unlink(path);
+
+  // Verify that there are no leaks
+  assert(hue_stats_live_count("hue::Vector::Node") == 0);
+  assert(hue_stats_live_count("hue::Vector") == 0);
+
+  return 0;
+}
@@ -0,0 +1,142 @@
+#include "../src/runtime/Vector.h"
+
+using std::cerr;
+using std::endl;
+using namespace hue;
+
+static Vector* makeVector(size_t count, uint64_t base) {
+  std::vector<void*> values(count);
+  for (size_t i = 0; i < count; ++i) values[i] = (void*)(base + i);
+  return Vector::create(values.data(), count);
+}
+
+static uint64_t sequentialSum(const Vector* v) {
+  uint64_t sum = 0;
+  v->forEachChunk([&](void* const* values, size_t n) {
+    for (size_t i = 0; i < n; ++i) sum += (uint64_t)values[i];
+  });
+  return sum;
+}
+
+static uint64_t parallelSum(const Vector* v, ThreadPool& pool) {
+  return v->parallelReduce((uint64_t)0,
+    [](void* const* values, size_t n) {
+      uint64_t sum = 0;
+      for (size_t i = 0; i < n; ++i) sum += (uint64_t)values[i];
+      return sum;
+    },
+    [](uint64_t a, uint64_t b) { return a + b; },
+    pool);
+}
+
+static void check(const Vector* v, ThreadPool& pool) {
+  uint64_t expectedSum = sequentialSum(v);
+  uint64_t sum = parallelSum(v, pool);
+  assert(sum == expectedSum);
+  (void)sum; (void)expectedSum;
+
+  // combine isn't commutative: concatenating the first value of each chunk must
+  // preserve the order of the chunks
+  std::vector<void*> firsts = v->parallelReduce(std::vector<void*>(),
+    [](void* const* values, size_t n) { return std::vector<void*>(1, values[0]); },
+    [](std::vector<void*> a, const std::vector<void*>& b) {
+      a.insert(a.end(), b.begin(), b.end());
+      return a;
+    },
+    pool);
+  std::vector<void*> expected;
+  v->forEachChunk([&](void* const* values, size_t n) { expected.push_back(values[0]); });
+  assert(firsts == expected);
+
+  Vector* mapped = v->parallelMap([](void* value) {
+    return (void*)((uint64_t)value * 3 + 1);
+  }, pool);
+  assert(mapped->count() == v->count());
+  for (size_t i = 0; i < v->count(); ++i) {
+    assert((uint64_t)mapped->itemAt(i) == (uint64_t)v->itemAt(i) * 3 + 1);
+  }
+
+  // The mapped vector is a regular vector that can be modified further
+  Vector* appended = mapped->append((void*)7);
+  assert(appended->itemAt(v->count()) == (void*)7);
+  appended->release();
+  mapped->release();
+}
+
+int main() {
+  {
+    ThreadPool pool(4);
+    assert(pool.size() == 4);
+
+    // Nested task groups
+    std::atomic<size_t> ran(0);
+    ThreadPool::TaskGroup group(pool);
+    for (size_t i = 0; i < 16; ++i) {
+      group.spawn([&]() {
+        ThreadPool::TaskGroup inner(pool);
+        for (size_t j = 0; j < 16; ++j) inner.spawn([&]() { ++ran; });
+        inner.wait();
+      });
+    }
+    group.wait();
+    assert(ran == 256);
+
+    size_t sizes[] = { 0, 1, 32, 33, 1056, 5000, 33 * 1024 + 5, 1000000 };
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+      Vector* v = makeVector(sizes[s], 1);
+      check(v, pool);
+      v->release();
+    }
+
+    // Relaxed tries
+    Vector* a = makeVector(100000, 1);
+    Vector* b = makeVector(77777, 200000);
+    Vector* ab = a->concat(b);
+    Vector* sub = ab->subvec(333, 150000);
+    check(ab, pool);
+    check(sub, pool);
+    sub->release();
+    ab->release();
+    b->release();
+    a->release();
+
+    // Stopping the pool has its workers merge the counts of nodes they created
+  }
+
+  // Threads appending to the same vector at once race to claim the next slot of its
+  // tail. Each must end up with its own value.
+  {
+    Vector* made = makeVector(40, 0);
+    Vector* base = made->append((void*)40); // has an appendable tail
+    made->release();
+    const size_t T = 4;
+    std::vector<Vector*> results(T * 100);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < T; ++t) {
+      threads.push_back(std::thread([base, &results, t]() {
+        for (size_t i = 0; i < 100; ++i) {
+          results[t * 100 + i] = base->append((void*)(1000 + t * 100 + i));
+        }
+      }));
+    }
+    for (size_t t = 0; t < T; ++t) threads[t].join();
+    for (size_t k = 0; k < results.size(); ++k) {
+      assert(results[k]->count() == 42);
+      assert((uint64_t)results[k]->itemAt(41) == 1000 + k);
+      assert((uint64_t)results[k]->itemAt(40) == 40);
+      results[k]->release();
+    }
+    base->release();
+  }
+
+  // The shared pool
+  Vector* v = makeVector(200000, 5);
+  assert(parallelSum(v, ThreadPool::shared()) == sequentialSum(v));
+  v->release();
+
+  // Verify that there are no leaks
+  assert(hue_stats_live_count("hue::Vector::Node") == 0);
+  assert(hue_stats_live_count("hue::Vector") == 0);
+
+  return 0;
+}
@@ -0,0 +1,156 @@
+#include "../src/runtime/Vector.h"
+
+using std::cerr;
+using std::endl;
+using namespace hue;
+
+typedef std::vector<void*> Model;
+
+static void verify(const Vector* v, const Model& m) {
+  assert(v->count() == m.size());
+  for (size_t i = 0; i < m.size(); ++i) {
+    if (v->itemAt(i) != m[i]) {
+      cerr << "itemAt(" << i << ") returned " << (uint64_t)v->itemAt(i)
+           << " but expected " << (uint64_t)m[i] << endl;
+    }
+    assert(v->itemAt(i) == m[i]);
+  }
+  size_t visited = 0;
+  Vector::ChunkIterator it(v);
+  void* const* values;
+  while (size_t n = it.next(values)) {
+    for (size_t i = 0; i < n; ++i, ++visited) assert(values[i] == m[visited]);
+  }
+  assert(visited == m.size());
+}
+
+static Vector* makeVector(size_t count, uint64_t base, Model& m) {
+  m.resize(count);
+  for (size_t i = 0; i < count; ++i) m[i] = (void*)(base + i);
+  return Vector::create(m.data(), count);
+}
+
+int main() {
+  // Concatenation of vectors of all kinds of sizes, including tail-only vectors
+  size_t sizes[] = {1, 5, 31, 32, 33, 100, 1024, 1056, 1100, 33*1024, 40000};
+  const size_t nsizes = sizeof(sizes)/sizeof(sizes[0]);
+  for (size_t a = 0; a < nsizes; ++a) {
+    for (size_t b = 0; b < nsizes; ++b) {
+      Model ma, mb;
+      Vector* va = makeVector(sizes[a], 0, ma);
+      Vector* vb = makeVector(sizes[b], 1000000, mb);
+      Vector* vc = va->concat(vb);
+      Model mc(ma);
+      mc.insert(mc.end(), mb.begin(), mb.end());
+      verify(vc, mc);
+      verify(va, ma);
+      verify(vb, mb);
+      va->release();
+      vb->release();
+      vc->release();
+    }
+  }
+
+  // Random sequences of operations, checked against a std::vector model
+  srand(1234);
+  Model m;
+  Vector* v = makeVector(2000, 0, m);
+  uint64_t next = 5000000;
+  for (size_t step = 0; step < 3000; ++step) {
+    Vector* nv = 0;
+    Model nm;
+    switch (rand() % 7) {
+      case 0: { // concat with a fresh vector
+        Model other;
+        Vector* ov = makeVector(rand() % 3000, next, other);
+        next += other.size();
+        nv = v->concat(ov);
+        ov->release();
+        nm = m;
+        nm.insert(nm.end(), other.begin(), other.end());
+        break;
+      }
+      case 1: { // concat with a slice of itself
+        size_t s = m.empty() ? 0 : rand() % m.size();
+        size_t e = m.empty() ? 0 : s + rand() % (m.size() - s + 1);
+        Vector* sv = v->subvec(s, e);
+        nv = sv->concat(v);
+        sv->release();
+        nm.assign(m.begin() + s, m.begin() + e);
+        nm.insert(nm.end(), m.begin(), m.end());
+        break;
+      }
+      case 2: { // slice
+        size_t s = m.empty() ? 0 : rand() % m.size();
+        size_t e = m.empty() ? 0 : s + rand() % (m.size() - s + 1);
+        nv = v->subvec(s, e);
+        nm.assign(m.begin() + s, m.begin() + e);
+        break;
+      }
+      case 3: { // append a few
+        nv = v->retain();
+        nm = m;
+        for (int k = rand() % 70; k > 0; --k) {
+          Vector* t = nv->append((void*)next);
+          nv->release();
+          nv = t;
+          nm.push_back((void*)next++);
+        }
+        break;
+      }
+      case 4: { // pop a few
+        nv = v->retain();
+        nm = m;
+        for (int k = rand() % 70; k > 0 && !nm.empty(); --k) {
+          Vector* t = nv->pop();
+          nv->release();
+          nv = t;
+          nm.pop_back();
+        }
+        break;
+      }
+      case 5: { // assoc
+        nv = v->retain();
+        nm = m;
+        for (int k = 10; k > 0 && !nm.empty(); --k) {
+          size_t i = rand() % nm.size();
+          Vector* t = nv->assoc(i, (void*)next);
+          nv->release();
+          nv = t;
+          nm[i] = (void*)next++;
+        }
+        break;
+      }
+      case 6: { // transient appends
+        Vector::Transient t(v);
+        nm = m;
+        for (int k = rand() % 200; k > 0; --k) {
+          t.append((void*)next);
+          nm.push_back((void*)next++);
+        }
+        nv = t.persistent();
+        break;
+      }
+    }
+    if (nm.size() > 60000) {
+      // Keep the vector from growing without bounds
+      Vector* t = nv->subvec(nm.size() - 20000, nm.size());
+      nv->release();
+      nv = t;
+      nm.erase(nm.begin(), nm.end() - 20000);
+    }
+    if (step % 50 == 0) verify(v, m);
+    v->release();
+    v = nv;
+    m.swap(nm);
+  }
+  verify(v, m);
+  v->release();
+
+  // Verify that there are no leaks
+  assert(hue_stats_live_count("hue::Vector::Node") == 0);
+  
+  assert(hue_stats_live_count("hue::Vector") == 0);
+
+  return 0;
+}